@@ -0,0 +1,37 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "alloc.h"
+
+static atomic_long allocations = 0;
+
+
+void* sim_malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return malloc(size);
+}
+
+void* sim_calloc(size_t count, size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return calloc(count, size);
+}
+
+void* sim_realloc(void* ptr, size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return realloc(ptr, size);
+}
+
+void* sim_aligned_alloc(size_t alignment, size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    // aligned_alloc needs a size that is a multiple of the alignment
+    return aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+}
+
+// Returns the number of allocations made so far
+long allocation_count(void)
+{
+    return atomic_load_explicit(&allocations, memory_order_relaxed);
+}
@@ -0,0 +1,27 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stdlib.h>
+
+
+/*******************************************************/
+/***************** Counted allocations *****************/
+/*******************************************************/
+
+/*
+ * The simulator allocates through these wrappers so the number of heap allocations is known
+ * (the steady state cycle loop should not allocate at all).
+ * The counter is shared by all the simulations of the process.
+ */
+void* sim_malloc(size_t size);
+void* sim_calloc(size_t count, size_t size);
+void* sim_realloc(void* ptr, size_t size);
+
+// Allocates size bytes aligned to alignment (a power of 2), the size is rounded up to a multiple of it
+void* sim_aligned_alloc(size_t alignment, size_t size);
+
+// Returns the number of allocations made so far
+long allocation_count(void);
+
+
+#endif // ALLOC_H
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "core.h"
+#include "memory.h"
+#include "processor.h"
+#include "functional.h"
+#include "batch.h"
+#include "alloc.h"
+
+#define BATCH_LINE_SIZE 8192
+
+
+/*******************************************************/
+/********************  Structs *************************/
+/*******************************************************/
+
+// One simulation of the batch
+typedef struct {
+    int line_number;
+    char* memin_filename;
+    char* outdir;
+    long instructions;  // the instructions of the functional run (0 without a fast-forward)
+    int cycles;         // the result of the run (-1 if it failed)
+} batch_config;
+
+
+/*******************************************************/
+/******************* Batch Functions *******************/
+/*******************************************************/
+
+// Returns a heap copy of the string
+static char* copy_string(const char* str)
+{
+    char* copy = sim_malloc(strlen(str) + 1);
+    if (!copy) {
+        perror("Failed to allocate memory for the batch list");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(copy, str);
+    return copy;
+}
+
+/*
+ * Parses one line of the batch list into the config.
+ * Returns 1 for a config, 0 for a blank or comment line and -1 for a bad line.
+ */
+static int parse_batch_line(char* line, int line_number, batch_config* config)
+{
+    char* fields[3];
+    char* rest = NULL;
+    int count = 0;
+    for (char* field = strtok_r(line, " \t\r\n", &rest); field && count < 3; field = strtok_r(NULL, " \t\r\n", &rest)) {
+        fields[count++] = field;
+    }
+    if (count == 0 || fields[0][0] == '#') {
+        return 0;
+    }
+    if (count != 2) {
+        printf("Error: batch line %d needs 2 fields (memin outdir)\n", line_number);
+        return -1;
+    }
+    memset(config, 0, sizeof(batch_config));
+    config->line_number = line_number;
+    config->memin_filename = copy_string(fields[0]);
+    config->outdir = copy_string(fields[1]);
+    return 1;
+}
+
+// Reads the batch list file, returns the configs and sets their number (NULL on error)
+static batch_config* read_batch_list(char* list_filename, int* num_of_configs)
+{
+    FILE* file = fopen(list_filename, "r");
+    if (!file) {
+        perror("Error opening the batch list");
+        return NULL;
+    }
+    int capacity = 4;
+    batch_config* configs = sim_malloc(capacity * sizeof(batch_config));
+    if (!configs) {
+        perror("Failed to allocate memory for the batch list");
+        exit(EXIT_FAILURE);
+    }
+    *num_of_configs = 0;
+    char line[BATCH_LINE_SIZE];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        if (*num_of_configs == capacity) {
+            capacity *= 2;
+            configs = sim_realloc(configs, capacity * sizeof(batch_config));
+            if (!configs) {
+                perror("Failed to allocate memory for the batch list");
+                exit(EXIT_FAILURE);
+            }
+        }
+        int result = parse_batch_line(line, line_number, &configs[*num_of_configs]);
+        if (result < 0) {
+            fclose(file);
+            free(configs);
+            return NULL;
+        }
+        *num_of_configs += result;
+    }
+    fclose(file);
+    return configs;
+}
+
+// Returns the file names of the simulation: the imem files and traces of the program (freed by free_processor)
+static filenames* batch_file_names(const filenames* program, batch_config* config)
+{
+    filenames* names = sim_malloc(sizeof(filenames));
+    if (!names) {
+        perror("Failed to allocate memory for filenames");
+        exit(EXIT_FAILURE);
+    }
+    set_default_file_names(names, program->num_of_cores);
+    for (int i = 0; i < program->num_of_cores; i++) {
+        free(names->imem_str[i]);
+        names->imem_str[i] = copy_string(program->imem_str[i]);
+    }
+    free(names->memin_str);
+    names->memin_str = copy_string(config->memin_filename);
+    set_output_file_names(names, config->outdir);
+    names->trace_format = program->trace_format;
+    names->trace_filter = program->trace_filter;
+    return names;
+}
+
+/*
+ * Runs the simulations of the configs: their functional runs side by side (with a fast-forward),
+ * then the detailed timing of each one that did not finish, one after the other. A config without memory failed already.
+ */
+static void run_batch_configs(batch_config configs[], main_memory* memories[], int count, const filenames* program,
+                              const latency_config* latency, const fast_forward_config* fast_forward, engine_type engine)
+{
+    processor* cpus[BATCH_WIDTH];
+    main_memory* run_memories[BATCH_WIDTH];
+    long instructions[BATCH_WIDTH];
+    batch_config* run_configs[BATCH_WIDTH];
+    int runs = 0;
+    for (int i = 0; i < count; i++) {
+        if (!memories[i]) {
+            configs[i].cycles = -1;
+            continue;
+        }
+        processor* cpu = init_processor(batch_file_names(program, &configs[i]), latency);
+        cpu->engine = engine;
+        cpu->debug = false;
+        start_run(cpu);
+        cpus[runs] = cpu;
+        run_memories[runs] = memories[i];
+        run_configs[runs] = &configs[i];
+        runs++;
+    }
+    if (runs > 0 && fast_forward->enabled) {
+        run_functional_batch(cpus, run_memories, runs, fast_forward, instructions);
+    }
+    else {
+        memset(instructions, 0, sizeof(instructions));
+    }
+    for (int r = 0; r < runs; r++) {
+        if (!finish(cpus[r])) {
+            run_detailed(cpus[r], run_memories[r]);
+        }
+        run_configs[r]->instructions = instructions[r];
+        run_configs[r]->cycles = end_run(cpus[r], run_memories[r]);
+    }
+}
+
+// Runs the program against every memory image of the batch list, BATCH_WIDTH simulations at a time
+int run_batch(char* list_filename, const filenames* program, const latency_config* latency,
+              const fast_forward_config* fast_forward, engine_type engine)
+{
+    int num_of_configs = 0;
+    batch_config* configs = read_batch_list(list_filename, &num_of_configs);
+    if (!configs) {
+        return -1;
+    }
+    for (int j = 0; j < program->num_of_cores; j++) {
+        FILE* file = fopen(program->imem_str[j], "r");
+        if (!file) {
+            printf("Error: batch: cannot read %s\n", program->imem_str[j]);
+            free(configs);
+            return -1;
+        }
+        fclose(file);
+    }
+    for (int first = 0; first < num_of_configs; first += BATCH_WIDTH) {
+        int count = (num_of_configs - first < BATCH_WIDTH) ? num_of_configs - first : BATCH_WIDTH;
+        main_memory* memories[BATCH_WIDTH];
+        for (int i = 0; i < count; i++) {
+            memories[i] = init_main_memory(configs[first + i].memin_filename);
+            if (!memories[i]) {
+                printf("Error: batch line %d: cannot read %s\n", configs[first + i].line_number, configs[first + i].memin_filename);
+            }
+        }
+        run_batch_configs(&configs[first], memories, count, program, latency, fast_forward, engine);
+        for (int i = 0; i < count; i++) {
+            free_main_memory(memories[i]);
+        }
+    }
+
+    // print the summary in the order of the list
+    int failed = 0;
+    printf("line  instructions  cycles  memin  outdir\n");
+    for (int i = 0; i < num_of_configs; i++) {
+        batch_config* config = &configs[i];
+        if (config->cycles < 0) {
+            printf("%-4d  %12s  %6s  %s  %s\n", config->line_number, "-", "failed", config->memin_filename, config->outdir);
+            failed++;
+        }
+        else {
+            printf("%-4d  %12ld  %6d  %s  %s\n", config->line_number, config->instructions, config->cycles,
+                   config->memin_filename, config->outdir);
+        }
+        free(config->memin_filename);
+        free(config->outdir);
+    }
+    free(configs);
+    return failed;
+}
@@ -0,0 +1,33 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "processor.h"
+
+
+/*******************************************************/
+/******************** Batch runs ***********************/
+/*******************************************************/
+
+// The simulations of a batch that run side by side (a lockstep group holds at most MAX_LANES cores)
+#define BATCH_WIDTH MAX_LANES
+
+/*
+ * Runs the program of the imem files of program against every memory image of the batch list file.
+ * Each line of the list is one simulation:
+ *     memin outdir
+ * Blank lines and lines that start with '#' are skipped.
+ * The outputs of a simulation get their default names inside outdir (the directory must exist),
+ * the traces take the format and the filter of program and the timing is latency.
+ * With a fast_forward, BATCH_WIDTH simulations at a time run functionally side by side (run_functional_batch)
+ * up to its switch point, so the cores of the different simulations that follow the same path through the program
+ * run in lockstep groups. A simulation that did not finish then continues alone with the detailed timing model
+ * of the engine. Only the functional prefix runs in lanes: the detailed model runs the simulations one after the other,
+ * so without a fast_forward a batch is a sequential loop over the list, with the outputs and the throughput
+ * of separate single runs.
+ * Prints one summary line per simulation and returns the number of failed simulations.
+ */
+int run_batch(char* list_filename, const filenames* program, const latency_config* latency,
+              const fast_forward_config* fast_forward, engine_type engine);
+
+
+#endif // BATCH_H
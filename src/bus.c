@@ -1,50 +1,85 @@
+#include <string.h>
 #include "bus.h"
 
-Bus bus;
-char data_source = 4;
-char first_flush = 4;
-uint32_t flush_address = 0;
-static FILE *bustrace_file;
-bool address_done = false;
 
+void init_bus(bus_state* bus, int num_of_cores)
+{
+    memset(&bus->lines, 0, sizeof(Bus));
+    bus->memory_id = (char)num_of_cores;
+    bus->data_source = bus->memory_id;
+    bus->first_flush = bus->memory_id;
+    bus->flush_address = 0;
+    bus->address_done = false;
+    bus->bustrace_file = NULL;
+    bus->trace_format = TRACE_TEXT;
+    bus->trace_ring = NULL;
+    init_trace_filter(&bus->trace_filter);
+    bus->trace_offset = TRACE_NEW_FILE;
+}
 
-void set_bus(char orig_id, enum BusCmd bus_cmd, uint32_t bus_addr, uint32_t bus_data)
+void set_bus(bus_state* bus, char orig_id, enum BusCmd bus_cmd, uint32_t bus_addr, uint32_t bus_data)
 {
-    bus.orig_id = orig_id;
-    bus.bus_cmd = bus_cmd;
-    bus.bus_addr = bus_addr;
-    bus.bus_data = bus_data;
-    bus.bus_shared = false;
+    bus->lines.orig_id = orig_id;
+    bus->lines.bus_cmd = bus_cmd;
+    bus->lines.bus_addr = bus_addr;
+    bus->lines.bus_data = bus_data;
+    bus->lines.bus_shared = false;
 }
 
-void set_shared()
+void set_shared(bus_state* bus)
 {
-    bus.bus_shared = true;
+    bus->lines.bus_shared = true;
 }
 
-void create_bustrace_file(processor *cpu)
+void create_bustrace_file(bus_state* bus, char* filename, trace_format trace_format, const trace_filter* trace_filter)
 {
-    bustrace_file = NULL;
-    open_file(&bustrace_file, cpu->filenames->bustrace_str, "w");
+    bus->trace_format = trace_format;
+    bus->trace_filter = *trace_filter;
+    bus->bustrace_file = open_trace_file(filename, trace_format, BUS_TRACE, bus->trace_offset);
 }
 
-void close_bustrace_file()
+void close_bustrace_file(bus_state* bus)
 {
-    fclose(bustrace_file);
+    if (bus->bustrace_file) {
+        fclose(bus->bustrace_file);
+        bus->bustrace_file = NULL;
+    }
 }
 
-void write_line_to_bustrace_file(processor *cpu, uint32_t cycle)
+void write_line_to_bustrace_file(bus_state* bus, uint32_t cycle)
 {
+    if (!bus_line_is_traced(&bus->trace_filter, (int)cycle, bus->lines.bus_cmd, bus->lines.bus_addr))
+    {
+        return;
+    }
+    if (bus->trace_ring)
+    {
+        trace_record record;
+        record.type = RECORD_BUS_LINE;
+        record.bus_line = (bus_trace_line){ (int)cycle, (uint8_t)bus->lines.orig_id, (uint8_t)bus->lines.bus_cmd,
+                                            bus->lines.bus_addr, bus->lines.bus_data, (uint8_t)bus->lines.bus_shared };
+        push_trace_record(bus->trace_ring, &record);
+        return;
+    }
+    FILE* bustrace_file = bus->bustrace_file;
     if (!bustrace_file)
     {
         printf("Error: Invalid file pointer or uninitialized core/cache.\n");
         return;
     }
+    if (bus->trace_format == TRACE_BINARY)
+    {
+        bus_trace_line line = { (int)cycle, (uint8_t)bus->lines.orig_id, (uint8_t)bus->lines.bus_cmd,
+                                bus->lines.bus_addr, bus->lines.bus_data, (uint8_t)bus->lines.bus_shared };
+        uint8_t record[BUS_RECORD_SIZE];
+        fwrite(record, 1, encode_bus_line(&line, record), bustrace_file);
+        return;
+    }
     // Write the clock cycle number
     fprintf(bustrace_file, "%d ", cycle);
-    fprintf(bustrace_file, "%d ", bus.orig_id);
-    fprintf(bustrace_file, "%d ", bus.bus_cmd);
-    fprintf(bustrace_file, "%05X ", bus.bus_addr);
-    fprintf(bustrace_file, "%08X ", bus.bus_data);
-    fprintf(bustrace_file, "%d\n", bus.bus_shared);
-}
\ No newline at end of file
+    fprintf(bustrace_file, "%d ", bus->lines.orig_id);
+    fprintf(bustrace_file, "%d ", bus->lines.bus_cmd);
+    fprintf(bustrace_file, "%05X ", bus->lines.bus_addr);
+    fprintf(bustrace_file, "%08X ", bus->lines.bus_data);
+    fprintf(bustrace_file, "%d\n", bus->lines.bus_shared);
+}
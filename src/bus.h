@@ -1,8 +1,11 @@
 #ifndef BUS_H
 #define BUS_H
 
-#include "core.h"
-#include "processor.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "trace.h"
+#include "trace_writer.h"
 
 enum BusCmd
 {
@@ -21,16 +24,30 @@ typedef struct
     bool bus_shared;
 } Bus;
 
-extern Bus bus;
-extern char data_source;
-extern char first_flush;
-extern uint32_t flush_address;
-extern bool address_done;
+// The bus of one simulation: its lines and the bookkeeping of the current transaction
+typedef struct
+{
+    Bus lines;
+    char memory_id;         // the bus id of the main memory (the number of cores)
+    char data_source;       // the core that supplies the requested block (memory_id = main memory)
+    char first_flush;       // the core that writes back a modified block before the transfer (memory_id = none)
+    uint32_t flush_address; // the address of the block that is written back
+    bool address_done;      // the last memory access made by the cores completed
+    FILE* bustrace_file;
+    trace_format trace_format;
+    trace_ring* trace_ring;  // set when the writer thread owns the bustrace file (NULL: written here)
+    trace_filter trace_filter; // the bus lines that are written
+    long trace_offset;         // where the run continues the bustrace file (TRACE_NEW_FILE: a new file)
+} bus_state;
 
-void set_bus(char orig_id, enum BusCmd bus_cmd, uint32_t bus_addr, uint32_t bus_data);
-void set_shared();
-void create_bustrace_file(processor *cpu);
-void close_bustrace_file();
-void write_line_to_bustrace_file(processor *cpu, uint32_t cycle);
+// Initializes the bus lines and the transaction bookkeeping (no bustrace file is open)
+void init_bus(bus_state* bus, int num_of_cores);
+void set_bus(bus_state* bus, char orig_id, enum BusCmd bus_cmd, uint32_t bus_addr, uint32_t bus_data);
+void set_shared(bus_state* bus);
+// Opens the bustrace file, only the lines that pass the filter are written to it
+void create_bustrace_file(bus_state* bus, char* filename, trace_format trace_format, const trace_filter* trace_filter);
+// Closes the bustrace file (does nothing if it is already closed or owned by the writer thread)
+void close_bustrace_file(bus_state* bus);
+void write_line_to_bustrace_file(bus_state* bus, uint32_t cycle);
 
 #endif // BUS_H
@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "sram.h"
+#include "core.h"
+#include "memory.h"
+#include "processor.h"
+#include "checkpoint.h"
+#include "config.h"
+#include "alloc.h"
+
+
+/*******************************************************/
+/********************  Structs *************************/
+/*******************************************************/
+
+// A checkpoint file and whether every field so far was written or read in full
+typedef struct {
+    FILE* file;
+    bool ok;
+} checkpoint_file;
+
+#define WRITE_FIELD(checkpoint, field) write_field((checkpoint), &(field), sizeof(field))
+#define READ_FIELD(checkpoint, field) read_field((checkpoint), &(field), sizeof(field))
+
+
+/*******************************************************/
+/****************** Field Functions ********************/
+/*******************************************************/
+
+static void write_field(checkpoint_file* checkpoint, const void* field, size_t size)
+{
+    if (checkpoint->ok && fwrite(field, size, 1, checkpoint->file) != 1) {
+        checkpoint->ok = false;
+    }
+}
+
+static void read_field(checkpoint_file* checkpoint, void* field, size_t size)
+{
+    if (checkpoint->ok && fread(field, size, 1, checkpoint->file) != 1) {
+        checkpoint->ok = false;
+    }
+}
+
+// Prints the error of a checkpoint file that cannot be restored and exits
+static void bad_checkpoint(const char* filename, const char* reason)
+{
+    printf("Error: cannot restore %s: %s\n", filename, reason);
+    exit(EXIT_FAILURE);
+}
+
+// Returns the offset the next line of the trace file goes to (-1 for a closed file)
+static long trace_file_offset(FILE* trace_file)
+{
+    if (!trace_file) {
+        return -1;
+    }
+    fflush(trace_file);
+    return ftell(trace_file);
+}
+
+
+/*******************************************************/
+/******************** Save Functions *******************/
+/*******************************************************/
+
+// Writes the header: the magic, the version and the sizes the layout depends on
+static void save_header(checkpoint_file* checkpoint, processor* cpu)
+{
+    char magic[CHECKPOINT_MAGIC_SIZE] = CHECKPOINT_MAGIC;
+    int sizes[6] = { CHECKPOINT_VERSION, cpu->num_of_cores, MAX_CACHE_BLOCKS, MAX_CACHE_BLOCK_SIZE, NUM_OF_PAGES, PAGE_SIZE };
+    WRITE_FIELD(checkpoint, magic);
+    WRITE_FIELD(checkpoint, sizes);
+}
+
+// Writes the state of the processor besides the cores and the memory
+static void save_processor(checkpoint_file* checkpoint, processor* cpu)
+{
+    WRITE_FIELD(checkpoint, cpu->cycle);
+    WRITE_FIELD(checkpoint, cpu->latency);
+    WRITE_FIELD(checkpoint, cpu->filenames->trace_format);
+    WRITE_FIELD(checkpoint, cpu->filenames->trace_filter);
+    // the bus
+    long bustrace_offset = trace_file_offset(cpu->bus.bustrace_file);
+    WRITE_FIELD(checkpoint, cpu->bus.lines);
+    WRITE_FIELD(checkpoint, cpu->bus.data_source);
+    WRITE_FIELD(checkpoint, cpu->bus.first_flush);
+    WRITE_FIELD(checkpoint, cpu->bus.flush_address);
+    WRITE_FIELD(checkpoint, cpu->bus.address_done);
+    WRITE_FIELD(checkpoint, bustrace_offset);
+    // the transfer in flight and the cycle skipping
+    bool has_data = cpu->transfer.data_from_memory != NULL;
+    WRITE_FIELD(checkpoint, cpu->transfer.address);
+    WRITE_FIELD(checkpoint, cpu->transfer.extra_delay);
+    WRITE_FIELD(checkpoint, has_data);
+    WRITE_FIELD(checkpoint, cpu->transfer.memory_buffer);
+    WRITE_FIELD(checkpoint, cpu->transfer.memory_words);
+    WRITE_FIELD(checkpoint, cpu->last_cycle_changed_nothing);
+    // the round robin queue by core numbers
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        WRITE_FIELD(checkpoint, cpu->round_robin_queue[i]->core_number);
+    }
+    long invalidations = atomic_load(&cpu->directory->invalidations);
+    WRITE_FIELD(checkpoint, invalidations);
+}
+
+// Writes the state of a core and its pipeline
+static void save_core(checkpoint_file* checkpoint, core* core, instructions* pipeline)
+{
+    long coretrace_offset = trace_file_offset(core->cold->coretrace_file);
+    WRITE_FIELD(checkpoint, core->pc);
+    WRITE_FIELD(checkpoint, core->cycle);
+    WRITE_FIELD(checkpoint, core->registers);
+    WRITE_FIELD(checkpoint, core->done);
+    WRITE_FIELD(checkpoint, core->need_the_bus);
+    WRITE_FIELD(checkpoint, core->hold_the_bus);
+    WRITE_FIELD(checkpoint, core->mem_stall_streak);
+    WRITE_FIELD(checkpoint, core->address_done);
+    WRITE_FIELD(checkpoint, *core->stats);
+    // the trace
+    WRITE_FIELD(checkpoint, core->trace_first_cycle);
+    WRITE_FIELD(checkpoint, core->trace_last_cycle);
+    WRITE_FIELD(checkpoint, core->cold->trace_tail);
+    WRITE_FIELD(checkpoint, core->cold->trace_state);
+    WRITE_FIELD(checkpoint, core->cold->trace_line);
+    WRITE_FIELD(checkpoint, coretrace_offset);
+    // the pipeline latches
+    WRITE_FIELD(checkpoint, *pipeline->fetch);
+    WRITE_FIELD(checkpoint, *pipeline->decode);
+    WRITE_FIELD(checkpoint, *pipeline->execute);
+    WRITE_FIELD(checkpoint, *pipeline->memory);
+    WRITE_FIELD(checkpoint, *pipeline->write_back);
+    // the store buffer and the drain of its oldest store
+    WRITE_FIELD(checkpoint, core->cold->store_buffer);
+    WRITE_FIELD(checkpoint, core->store_drain);
+    WRITE_FIELD(checkpoint, core->bus_for_buffer);
+    // the blocks of the cache and the program (checked on restore), their sizes come from the latency of the run
+    write_field(checkpoint, core->cache->blocks, core->cache->num_blocks * sizeof(cache_block));
+    write_field(checkpoint, core->cache->words, core->cache->num_blocks * cache_block_size(core->cache) * sizeof(int));
+    write_field(checkpoint, core->imem->code, core->imem->size * sizeof(decoded_instruction));
+}
+
+// Writes the touched pages of the main memory
+static void save_memory(checkpoint_file* checkpoint, main_memory* memory)
+{
+    int num_of_pages = 0;
+    for (int i = 0; i < NUM_OF_PAGES; i++) {
+        num_of_pages += memory->pages[i] != NULL;
+    }
+    WRITE_FIELD(checkpoint, num_of_pages);
+    for (int i = 0; i < NUM_OF_PAGES; i++) {
+        if (memory->pages[i]) {
+            WRITE_FIELD(checkpoint, i);
+            write_field(checkpoint, memory->pages[i], PAGE_SIZE * sizeof(int));
+        }
+    }
+}
+
+// Writes the checkpoint next to its name and renames it over the last one
+static void save_checkpoint(processor* cpu, main_memory* memory, const char* filename)
+{
+    char* tmp_filename = sim_malloc(strlen(filename) + sizeof(CHECKPOINT_TMP_SUFFIX));
+    if (!tmp_filename) {
+        perror("Failed to allocate memory for the checkpoint file name");
+        exit(EXIT_FAILURE);
+    }
+    strcat(strcpy(tmp_filename, filename), CHECKPOINT_TMP_SUFFIX);
+    checkpoint_file checkpoint = { fopen(tmp_filename, "wb"), true };
+    if (!checkpoint.file) {
+        printf("Error opening file: %s\n", tmp_filename);
+        exit(EXIT_FAILURE);
+    }
+    save_header(&checkpoint, cpu);
+    save_processor(&checkpoint, cpu);
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        save_core(&checkpoint, cpu->cores[i], cpu->core_instructions[i]);
+    }
+    save_memory(&checkpoint, memory);
+    if (fclose(checkpoint.file) != 0 || !checkpoint.ok || rename(tmp_filename, filename) != 0) {
+        printf("Error: failed to write the checkpoint %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    free(tmp_filename);
+}
+
+// Saves checkpoints of the run to the file, the first when the cycle reaches every (stop: end the run there)
+void set_checkpoints(processor* cpu, char* filename, int every, bool stop)
+{
+    cpu->checkpoint.filename = filename;
+    cpu->checkpoint.every = every;
+    cpu->checkpoint.next_cycle = (cpu->cycle / every + 1) * every;
+    cpu->checkpoint.stop = stop;
+    cpu->checkpoint.stopped = false;
+}
+
+// Saves a checkpoint if one is due, returns true if the run stops at it
+bool checkpoint_if_due(processor* cpu, main_memory* memory)
+{
+    checkpoint_config* config = &cpu->checkpoint;
+    if (cpu->cycle < config->next_cycle) {
+        return false;
+    }
+    if (cpu->async_trace) {
+        printf("Error: a checkpoint needs the traces written by the run loop (no --async-trace)\n");
+        exit(EXIT_FAILURE);
+    }
+    save_checkpoint(cpu, memory, config->filename);
+    printf("checkpoint: cycle %d saved to %s\n", cpu->cycle, config->filename);
+    config->next_cycle = (cpu->cycle / config->every + 1) * config->every;
+    config->stopped = config->stop;
+    return config->stopped;
+}
+
+
+/*******************************************************/
+/****************** Restore Functions ******************/
+/*******************************************************/
+
+// Reads the state of the processor besides the cores and the memory (the processor is built from the filenames)
+static processor* restore_processor(checkpoint_file* checkpoint, const char* filename, filenames* filenames)
+{
+    int cycle;
+    latency_config latency;
+    READ_FIELD(checkpoint, cycle);
+    READ_FIELD(checkpoint, latency);
+    READ_FIELD(checkpoint, filenames->trace_format);
+    READ_FIELD(checkpoint, filenames->trace_filter);
+    if (!checkpoint->ok) {
+        bad_checkpoint(filename, "the file is cut short");
+    }
+    if (!valid_config(&latency)) {
+        bad_checkpoint(filename, "bad configuration");
+    }
+    processor* cpu = init_processor(filenames, &latency);
+    cpu->cycle = cycle;
+    // the bus
+    READ_FIELD(checkpoint, cpu->bus.lines);
+    READ_FIELD(checkpoint, cpu->bus.data_source);
+    READ_FIELD(checkpoint, cpu->bus.first_flush);
+    READ_FIELD(checkpoint, cpu->bus.flush_address);
+    READ_FIELD(checkpoint, cpu->bus.address_done);
+    READ_FIELD(checkpoint, cpu->bus.trace_offset);
+    // the transfer in flight and the cycle skipping
+    bool has_data;
+    READ_FIELD(checkpoint, cpu->transfer.address);
+    READ_FIELD(checkpoint, cpu->transfer.extra_delay);
+    READ_FIELD(checkpoint, has_data);
+    READ_FIELD(checkpoint, cpu->transfer.memory_buffer);
+    READ_FIELD(checkpoint, cpu->transfer.memory_words);
+    cpu->transfer.memory_buffer.data = cpu->transfer.memory_words;
+    cpu->transfer.data_from_memory = has_data ? &cpu->transfer.memory_buffer : NULL;
+    READ_FIELD(checkpoint, cpu->last_cycle_changed_nothing);
+    // the round robin queue by core numbers
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        int core_number = -1;
+        READ_FIELD(checkpoint, core_number);
+        if (core_number < 0 || core_number >= cpu->num_of_cores) {
+            bad_checkpoint(filename, "bad round robin queue");
+        }
+        cpu->round_robin_queue[i] = cpu->cores[core_number];
+    }
+    long invalidations = 0;
+    READ_FIELD(checkpoint, invalidations);
+    atomic_store(&cpu->directory->invalidations, invalidations);
+    return cpu;
+}
+
+// Reads the state of a core and its pipeline
+static void restore_core(checkpoint_file* checkpoint, const char* filename, core* core, instructions* pipeline)
+{
+    READ_FIELD(checkpoint, core->pc);
+    READ_FIELD(checkpoint, core->cycle);
+    READ_FIELD(checkpoint, core->registers);
+    READ_FIELD(checkpoint, core->done);
+    READ_FIELD(checkpoint, core->need_the_bus);
+    READ_FIELD(checkpoint, core->hold_the_bus);
+    READ_FIELD(checkpoint, core->mem_stall_streak);
+    READ_FIELD(checkpoint, core->address_done);
+    READ_FIELD(checkpoint, *core->stats);
+    // the trace
+    READ_FIELD(checkpoint, core->trace_first_cycle);
+    READ_FIELD(checkpoint, core->trace_last_cycle);
+    READ_FIELD(checkpoint, core->cold->trace_tail);
+    READ_FIELD(checkpoint, core->cold->trace_state);
+    READ_FIELD(checkpoint, core->cold->trace_line);
+    READ_FIELD(checkpoint, core->cold->trace_offset);
+    // the pipeline latches
+    READ_FIELD(checkpoint, *pipeline->fetch);
+    READ_FIELD(checkpoint, *pipeline->decode);
+    READ_FIELD(checkpoint, *pipeline->execute);
+    READ_FIELD(checkpoint, *pipeline->memory);
+    READ_FIELD(checkpoint, *pipeline->write_back);
+    // the store buffer and the drain of its oldest store
+    READ_FIELD(checkpoint, core->cold->store_buffer);
+    READ_FIELD(checkpoint, core->store_drain);
+    READ_FIELD(checkpoint, core->bus_for_buffer);
+    // the cache, each valid block is added to the directory through its state
+    for (int i = 0; i < core->cache->num_blocks; i++) {
+        cache_block block;
+        READ_FIELD(checkpoint, block);
+        cache_block* cached = &core->cache->blocks[i];
+        cached->tag = block.tag;
+        cached->cycle = block.cycle;
+        cached->last_use = block.last_use;
+        set_block_state(core->cache, cached, block.state);
+    }
+    read_field(checkpoint, core->cache->words, core->cache->num_blocks * cache_block_size(core->cache) * sizeof(int));
+    // the program must be the one of the checkpointed run
+    decoded_instruction code[MAX_IMEM_SIZE];
+    read_field(checkpoint, code, core->imem->size * sizeof(decoded_instruction));
+    if (checkpoint->ok && memcmp(code, core->imem->code, core->imem->size * sizeof(decoded_instruction)) != 0) {
+        printf("Error: cannot restore %s: %s is not the imem of core %d in the checkpoint\n",
+               filename, core->cold->imem_filename, core->core_number);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Reads the touched pages of the main memory
+static main_memory* restore_memory(checkpoint_file* checkpoint, const char* filename)
+{
+    main_memory* memory = sim_calloc(1, sizeof(main_memory));
+    if (!memory) {
+        perror("Failed to allocate memory for main memory");
+        exit(EXIT_FAILURE);
+    }
+    int num_of_pages = 0;
+    READ_FIELD(checkpoint, num_of_pages);
+    for (int i = 0; i < num_of_pages && checkpoint->ok; i++) {
+        int page = -1;
+        READ_FIELD(checkpoint, page);
+        if (page < 0 || page >= NUM_OF_PAGES || memory->pages[page]) {
+            bad_checkpoint(filename, "bad memory page");
+        }
+        memory->pages[page] = sim_malloc(PAGE_SIZE * sizeof(int));
+        if (!memory->pages[page]) {
+            perror("Failed to allocate memory for main memory");
+            exit(EXIT_FAILURE);
+        }
+        read_field(checkpoint, memory->pages[page], PAGE_SIZE * sizeof(int));
+    }
+    return memory;
+}
+
+// Builds the processor and the main memory of a checkpoint file
+processor* restore_checkpoint(const char* filename, filenames* filenames, main_memory** memory)
+{
+    checkpoint_file checkpoint = { fopen(filename, "rb"), true };
+    if (!checkpoint.file) {
+        printf("Error opening file: %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    char magic[CHECKPOINT_MAGIC_SIZE];
+    int sizes[6];
+    READ_FIELD(&checkpoint, magic);
+    READ_FIELD(&checkpoint, sizes);
+    if (!checkpoint.ok || memcmp(magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_SIZE) != 0) {
+        bad_checkpoint(filename, "not a checkpoint file");
+    }
+    if (sizes[0] != CHECKPOINT_VERSION) {
+        bad_checkpoint(filename, "the checkpoint has another version");
+    }
+    if (sizes[1] != filenames->num_of_cores) {
+        printf("Error: cannot restore %s: it has %d cores, the run has %d (--cores)\n", filename, sizes[1], filenames->num_of_cores);
+        exit(EXIT_FAILURE);
+    }
+    if (sizes[2] != MAX_CACHE_BLOCKS || sizes[3] != MAX_CACHE_BLOCK_SIZE || sizes[4] != NUM_OF_PAGES || sizes[5] != PAGE_SIZE) {
+        bad_checkpoint(filename, "the checkpoint has other cache or memory sizes");
+    }
+    processor* cpu = restore_processor(&checkpoint, filename, filenames);
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        restore_core(&checkpoint, filename, cpu->cores[i], cpu->core_instructions[i]);
+    }
+    *memory = restore_memory(&checkpoint, filename);
+    if (!checkpoint.ok) {
+        bad_checkpoint(filename, "the file is cut short");
+    }
+    fclose(checkpoint.file);
+    return cpu;
+}
@@ -0,0 +1,50 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdbool.h>
+#include "memory.h"
+#include "processor.h"
+
+#define CHECKPOINT_MAGIC "SIMCKPT"
+#define CHECKPOINT_MAGIC_SIZE 8
+#define CHECKPOINT_VERSION 6      // changes with the layout of the file
+#define CHECKPOINT_TMP_SUFFIX ".tmp"
+
+
+/*******************************************************/
+/****************** Checkpoint files *******************/
+/*******************************************************/
+
+/*
+ * A checkpoint holds the whole state of a simulation between two cycles:
+ * - the header: the magic, the version, the number of cores and the sizes the layout depends on,
+ * - the processor: cycle, configuration (latency_config), trace format and filter, bus lines and bookkeeping, the bus transfer,
+ *   the round robin queue and the sharing statistics,
+ * - each core: pc, registers, flags, stats, the 5 pipeline latches, the cache blocks with their MESI states,
+ *   the trace state and the offset of its coretrace file (-1 once closed), the imem it ran
+ *   (as many blocks and imem lines as the configuration has),
+ * - the touched pages of the main memory.
+ * Numbers are in the byte order of the host, a checkpoint is restored by a build with the same version.
+ * The trace files are not copied: a restored run cuts them at their offsets and continues them.
+ */
+
+// Saves checkpoints of the run to the file, the first when the cycle reaches every (stop: end the run there)
+void set_checkpoints(processor* cpu, char* filename, int every, bool stop);
+
+/*
+ * Saves a checkpoint if one is due (called by the run loop between two cycles).
+ * The file is written next to its name and renamed over it, so an interrupted save keeps the last checkpoint.
+ * Returns true if the run stops at this checkpoint.
+ */
+bool checkpoint_if_due(processor* cpu, main_memory* memory);
+
+/*
+ * Builds the processor and the main memory of a checkpoint file.
+ * The names of the files come from filenames (the imem files must be the ones of the checkpointed run),
+ * the configuration and the trace settings come from the checkpoint.
+ * Returns NULL if the file is not a checkpoint of this version or does not fit the filenames.
+ */
+processor* restore_checkpoint(const char* filename, filenames* filenames, main_memory** memory);
+
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include "sram.h"
+#include "core.h"
+#include "config.h"
+
+#define CONFIG_LINE_SIZE 1024
+#define MIN_IMEM_SIZE 8  // the program, its halt and the stalls after it need some lines
+
+
+/*******************************************************/
+/****************** Config Functions *******************/
+/*******************************************************/
+
+// Returns the number field of the key in the config (NULL for a key that is not one)
+static int* config_field(latency_config* config, const char* key)
+{
+    if (strcmp(key, "cache_size") == 0) { return &config->cache.size; }
+    if (strcmp(key, "block_size") == 0) { return &config->cache.block_size; }
+    if (strcmp(key, "cache_ways") == 0) { return &config->cache.ways; }
+    if (strcmp(key, "bus_delay") == 0) { return &config->bus_delay; }
+    if (strcmp(key, "block_delay") == 0) { return &config->block_delay; }
+    if (strcmp(key, "extra_delay") == 0) { return &config->extra_delay; }
+    if (strcmp(key, "imem_size") == 0) { return &config->imem_size; }
+    if (strcmp(key, "store_buffer") == 0) { return &config->store_buffer; }
+    return NULL;
+}
+
+// Sets the key of the config to the value, returns false for an unknown key or a value that is not a number
+bool set_config_value(latency_config* config, const char* key, const char* value)
+{
+    char* end;
+    long number = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || number < INT_MIN || number > INT_MAX) {
+        return false;
+    }
+    if (strcmp(key, "forwarding") == 0) {
+        config->forwarding = (number != 0);
+        return true;
+    }
+    if (strcmp(key, "write_allocate") == 0) {
+        config->write_allocate = (number != 0);
+        return true;
+    }
+    int* field = config_field(config, key);
+    if (!field) {
+        return false;
+    }
+    *field = (int)number;
+    return true;
+}
+
+// Applies a "key=value" setting (--set), returns false for a bad setting
+bool set_config_setting(latency_config* config, char* setting)
+{
+    char* value = strchr(setting, '=');
+    if (!value) {
+        return false;
+    }
+    *value = '\0';
+    bool ok = set_config_value(config, setting, value + 1);
+    *value = '=';
+    return ok;
+}
+
+// Applies the settings of the config file, prints the error and returns false for a bad file
+bool read_config_file(const char* filename, latency_config* config)
+{
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        printf("Error opening file: %s\n", filename);
+        return false;
+    }
+    char line[CONFIG_LINE_SIZE];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        char* rest = NULL;
+        char* key = strtok_r(line, " \t=\r\n", &rest);
+        if (!key || key[0] == '#') {
+            continue;
+        }
+        char* value = strtok_r(NULL, " \t=\r\n", &rest);
+        if (!value || strtok_r(NULL, " \t=\r\n", &rest) || !set_config_value(config, key, value)) {
+            printf("Error: config file %s line %d needs a known key and a number\n", filename, line_number);
+            fclose(file);
+            return false;
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+// Returns true if a run can have the config, otherwise prints what is wrong with it and returns false
+bool valid_config(const latency_config* config)
+{
+    if (config->bus_delay < 2 || config->block_delay < 1 || config->extra_delay < 1) {
+        printf("Error: bad latencies (bus_delay >= 2, block_delay >= 1, extra_delay >= 1)\n");
+        return false;
+    }
+    if (config->imem_size < MIN_IMEM_SIZE || config->imem_size > MAX_IMEM_SIZE) {
+        printf("Error: imem_size must be between %d and %d\n", MIN_IMEM_SIZE, MAX_IMEM_SIZE);
+        return false;
+    }
+    if (config->store_buffer < 0 || config->store_buffer > MAX_STORE_BUFFER) {
+        printf("Error: store_buffer must be between 0 and %d\n", MAX_STORE_BUFFER);
+        return false;
+    }
+    if (!config->write_allocate && config->store_buffer == 0) {
+        printf("Error: write_allocate 0 needs a store buffer (store_buffer >= 1)\n");
+        return false;
+    }
+    return valid_cache_geometry(&config->cache);
+}
+
+// True if the two configs are the same
+static bool same_config(const latency_config* first, const latency_config* second)
+{
+    return first->bus_delay == second->bus_delay && first->block_delay == second->block_delay &&
+           first->extra_delay == second->extra_delay && first->forwarding == second->forwarding &&
+           first->cache.size == second->cache.size && first->cache.block_size == second->cache.block_size &&
+           first->cache.ways == second->cache.ways && first->imem_size == second->imem_size &&
+           first->store_buffer == second->store_buffer && first->write_allocate == second->write_allocate;
+}
+
+// True if the config is the default one (set_default_latency)
+bool is_default_config(const latency_config* config)
+{
+    latency_config defaults;
+    set_default_latency(&defaults);
+    return same_config(config, &defaults);
+}
+
+// Sets the config a run of this build starts from: the default one, or the FIXED_* values of a fixed build (see fixed.h)
+void set_build_config(latency_config* config)
+{
+    set_default_latency(config);
+#ifdef FIXED_CONFIG
+    config->cache.size = FIXED_CACHE_SIZE;
+    config->cache.block_size = FIXED_CACHE_BLOCK_SIZE;
+    config->cache.ways = FIXED_CACHE_WAYS;
+    config->bus_delay = FIXED_BUS_DELAY;
+    config->block_delay = FIXED_BLOCK_DELAY;
+    config->extra_delay = FIXED_EXTRA_DELAY;
+    config->imem_size = FIXED_IMEM_SIZE;
+    config->forwarding = FIXED_FORWARDING;
+    config->store_buffer = FIXED_STORE_BUFFER;
+    config->write_allocate = FIXED_WRITE_ALLOCATE;
+#endif
+}
+
+// True if the config is the one of set_build_config
+bool is_build_config(const latency_config* config)
+{
+    latency_config build;
+    set_build_config(&build);
+    return same_config(config, &build);
+}
+
+// Returns true if this build can run the cores with the config (a fixed build runs only its own), otherwise prints why and returns false
+bool build_runs_config(int num_of_cores, const latency_config* config)
+{
+#ifdef FIXED_CONFIG
+    if (num_of_cores != FIXED_NUM_OF_CORES || !is_build_config(config)) {
+        latency_config fixed;
+        set_build_config(&fixed);
+        printf("Error: this build runs only %d cores with the configuration it was compiled for:\n", FIXED_NUM_OF_CORES);
+        write_config(stdout, &fixed);
+        return false;
+    }
+#endif
+    return true;
+}
+
+// Writes the config as "key value" lines (a config file, the stats files of a run that is not the default one end with it)
+void write_config(FILE* file, const latency_config* config)
+{
+    fprintf(file, "cache_size %d\n", config->cache.size);
+    fprintf(file, "block_size %d\n", config->cache.block_size);
+    fprintf(file, "cache_ways %d\n", config->cache.ways);
+    fprintf(file, "bus_delay %d\n", config->bus_delay);
+    fprintf(file, "block_delay %d\n", config->block_delay);
+    fprintf(file, "extra_delay %d\n", config->extra_delay);
+    fprintf(file, "imem_size %d\n", config->imem_size);
+    fprintf(file, "forwarding %d\n", config->forwarding ? 1 : 0);
+    fprintf(file, "store_buffer %d\n", config->store_buffer);
+    fprintf(file, "write_allocate %d\n", config->write_allocate ? 1 : 0);
+}
@@ -0,0 +1,58 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "core.h"
+
+
+/*******************************************************/
+/****************** Run configuration ******************/
+/*******************************************************/
+
+/*
+ * A config file sets the latency_config of a run at run time, one "key value" (or "key=value") per line:
+ *     cache_size 256    the words of a data cache
+ *     block_size 4      the words of a cache block, the words the bus moves on a miss
+ *     cache_ways 1      the blocks of a set (1: direct-mapped)
+ *     bus_delay 17      cycles until the first word of a block comes from memory (>= 2)
+ *     block_delay 4     cycles until the rest of the block comes (>= 1, a word a cycle: change it with block_size)
+ *     extra_delay 4     cycles a modified block takes back to memory (>= 1)
+ *     imem_size 1024    the lines of an imem
+ *     forwarding 0      1: the pipelines forward results (see pipeline_step)
+ *     store_buffer 0    the entries of the store buffer of a core (<= MAX_STORE_BUFFER, 0: none, see store_buffer.h)
+ *     write_allocate 1  0: a buffered store that misses goes around the cache to memory (needs a store buffer)
+ * The values above are the defaults. Blank lines and lines that start with '#' are skipped,
+ * the keys a file does not set keep their values. The address of a word splits into its tag,
+ * its set and its offset in the block by the cache geometry (see cache_tag_bits).
+ */
+
+// Sets the key of the config to the value, returns false for an unknown key or a value that is not a number
+bool set_config_value(latency_config* config, const char* key, const char* value);
+
+// Applies a "key=value" setting (--set), returns false for a bad setting
+bool set_config_setting(latency_config* config, char* setting);
+
+// Applies the settings of the config file, prints the error and returns false for a bad file
+bool read_config_file(const char* filename, latency_config* config);
+
+// Returns true if a run can have the config, otherwise prints what is wrong with it and returns false
+bool valid_config(const latency_config* config);
+
+// True if the config is the default one (set_default_latency)
+bool is_default_config(const latency_config* config);
+
+// Sets the config a run of this build starts from: the default one, or the FIXED_* values of a fixed build (see fixed.h)
+void set_build_config(latency_config* config);
+
+// True if the config is the one of set_build_config
+bool is_build_config(const latency_config* config);
+
+// Returns true if this build can run the cores with the config (a fixed build runs only its own), otherwise prints why and returns false
+bool build_runs_config(int num_of_cores, const latency_config* config);
+
+// Writes the config as "key value" lines (a config file, the stats files of a run that is not the default one end with it)
+void write_config(FILE* file, const latency_config* config);
+
+
+#endif // CONFIG_H
@@ -3,10 +3,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <limits.h>
 #include "sram.h"
 #include "core.h"
+#include <pthread.h>
 #include "memory.h"
-#include "bus.h"
+#include "alloc.h"
+#include "config.h"
 
 
 /*********************** Debug *************************/
@@ -24,8 +27,8 @@ int str_to_int(char *str)
     return (int)strtol(str, NULL, 16); // Convert hex string to int
 }
 
-// Converts a hex string to an instruction and returns true if successed
-bool parse_instruction(instruction* instruction, char* str) 
+// Converts a hex string to a decoded instruction and returns true if successed
+bool parse_instruction(decoded_instruction* instruction, char* str) 
 {
     if (strlen(str) != 8) {
         return -1;
@@ -54,61 +57,163 @@ bool parse_instruction(instruction* instruction, char* str)
     str_opcode[2] = '\0';
 
     // Convert strings to integers
-    instruction->imm = str_to_int(str_imm);
-    instruction->rt = str_to_int(str_rt);
-    instruction->rs = str_to_int(str_rs);
-    instruction->rd = str_to_int(str_rd);
-    instruction->opcode = str_to_int(str_opcode);
-    instruction->ALU_result = 0;
-    instruction->bus_delay = BUS_DELAY;
-    instruction->block_delay = BLOCK_DELAY;
-    instruction->extra_delay = EXTRA_DELAY;
+    instruction->imm = (int16_t)str_to_int(str_imm);
+    instruction->rt = (uint8_t)str_to_int(str_rt);
+    instruction->rs = (uint8_t)str_to_int(str_rs);
+    instruction->rd = (uint8_t)str_to_int(str_rd);
+    instruction->opcode = (uint8_t)str_to_int(str_opcode);
     return 1; // Success
 }
 
-// Converts a hax string line into an instruction structure, Returns 1 if successful, -1 otherwise
-int line_to_instruction(char* line, instruction* inst, int line_index) 
+// Converts a hax string line into a decoded instruction, Returns 1 if successful, -1 otherwise
+int line_to_instruction(char* line, decoded_instruction* inst, int line_index) 
 {
-    inst->pc = line_index;
+    inst->pc = (int16_t)line_index;
     return parse_instruction(inst, line);
 }
 
+// Fills a decoded imem word with a halt or stall (used for the padding after the program)
+static void set_decoded_opcode(decoded_instruction* inst, int opcode)
+{
+    inst->opcode = (uint8_t)opcode;
+    inst->rd = 0;
+    inst->rs = 0;
+    inst->rt = 0;
+    inst->imm = 0;
+    inst->pc = -1;
+}
+
+static void start_oldest_store(core* cpu);
+static bool pipeline_is_empty(instructions* instructions);
+
+// Sets the latencies to the defined default values
+void set_default_latency(latency_config* latency)
+{
+    latency->bus_delay = BUS_DELAY;
+    latency->block_delay = BLOCK_DELAY;
+    latency->extra_delay = EXTRA_DELAY;
+    latency->forwarding = false;
+    set_default_geometry(&latency->cache);
+    latency->imem_size = IMEM_SIZE;
+    latency->store_buffer = 0;
+    latency->write_allocate = true;
+}
+
+// Gives the core new latencies, the instructions in its pipeline get fresh delay counters (none may be on the bus)
+void set_core_latency(core* cpu, instructions* pipeline, const latency_config* latency)
+{
+    cpu->latency = *latency;
+    instruction* latches[] = { pipeline->fetch, pipeline->decode, pipeline->execute, pipeline->memory, pipeline->write_back };
+    for (int i = 0; i < (int)(sizeof(latches) / sizeof(latches[0])); i++) {
+        // halt and stalls never use the bus
+        if (latches[i]->pc != -1) {
+            latches[i]->bus_delay = latency->bus_delay;
+            latches[i]->block_delay = latency->block_delay;
+            latches[i]->extra_delay = latency->extra_delay;
+        }
+    }
+    cpu->cold->store_buffer.size = latency->store_buffer;
+    start_oldest_store(cpu);
+}
+
+// Expands a decoded imem word into a pipeline latch (static fields + fresh delay counters)
+void expand_instruction(instruction* dest, const decoded_instruction* src, const latency_config* latency)
+{
+    dest->pc = src->pc;
+    dest->opcode = src->opcode;
+    dest->rt = src->rt;
+    dest->rs = src->rs;
+    dest->rd = src->rd;
+    dest->imm = src->imm;
+    dest->ALU_result = 0;
+    // halt and stalls never use the bus
+    bool bubble = (src->pc == -1);
+    dest->bus_delay = bubble ? 0 : latency->bus_delay;
+    dest->block_delay = bubble ? 0 : latency->block_delay;
+    dest->extra_delay = bubble ? 0 : latency->extra_delay;
+}
+
 
 /*******************************************************/
 /***************** Core Functions **********************/
 /*******************************************************/
 
-// Initializes the stats structure
-void init_stats(stats** stat) 
+// Returns the bytes of a slot for caches of the geometry: the core_slot and the storage of its cache, in whole host cache lines
+static size_t core_slot_size(const cache_geometry* geometry)
+{
+    size_t size = sizeof(core_slot) + cache_storage_size(geometry);
+    return (size + HOST_CACHE_LINE - 1) & ~(size_t)(HOST_CACHE_LINE - 1);
+}
+
+// Allocates a core arena of count slots for caches of the geometry in one block aligned to the host cache lines
+core_slot* create_core_slots(int count, const cache_geometry* geometry)
 {
-    *stat = (stats*)malloc(sizeof(stats));
-    if (!*stat) {
-        perror("Failed to allocate memory for stats");
+    core_slot* slots = sim_aligned_alloc(HOST_CACHE_LINE, count * core_slot_size(geometry));
+    if (!slots) {
+        perror("Failed to allocate memory for the cores");
         exit(EXIT_FAILURE);
     }
-    (*stat)->total_cycles = 0;
-    (*stat)->total_instructions = 0;
-    (*stat)->read_hit = 0;
-    (*stat)->write_hit = 0;
-    (*stat)->read_miss = 0;
-    (*stat)->write_miss = 0;
-    (*stat)->num_of_decode_stalls = 0;
-    (*stat)->num_of_mem_stalls = 0;
+    return slots;
 }
 
-// Initializes the imem array in the core structure, take the data from the file
-void init_imem(core* cpu) 
+// Returns slot index of a core arena created for the geometry
+core_slot* get_core_slot(core_slot* slots, int index, const cache_geometry* geometry)
 {
-    FILE* file = fopen(cpu->imem_filename, "r");
+    return (core_slot*)((char*)slots + index * core_slot_size(geometry));
+}
+
+// Frees the core arena
+void free_core_slots(core_slot* slots)
+{
+    free(slots);
+}
+
+// Allocates the cold states of count cores, each one aligned to the host cache lines
+core_cold* create_core_cold(int count)
+{
+    core_cold* cold = sim_aligned_alloc(HOST_CACHE_LINE, count * sizeof(core_cold));
+    if (!cold) {
+        perror("Failed to allocate memory for the cores");
+        exit(EXIT_FAILURE);
+    }
+    return cold;
+}
+
+// Frees the cold states of the cores
+void free_core_cold(core_cold* cold)
+{
+    free(cold);
+}
+
+// All the imem images currently loaded, so cores that run the same file share one copy
+static imem_image* loaded_images = NULL;
+static pthread_mutex_t loaded_images_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Compiles the basic blocks of the image (defined after the dispatch tables)
+static void compile_blocks(imem_image* image);
+
+// Parses the imem file into a new image of size lines: the program, a halt after it and 5 stalls below the halt
+static imem_image* parse_imem_image(char* filename, int size)
+{
+    FILE* file = fopen(filename, "r");
     if (!file) {
         perror("Error opening file");
-        return;
+        return NULL;
+    }
+    imem_image* image = (imem_image*)sim_malloc(sizeof(imem_image));
+    if (!image) {
+        perror("Failed to allocate memory for imem");
+        exit(EXIT_FAILURE);
+    }
+    image->size = size;
+    // Words the program never reaches are stalls
+    for (int i = 0; i < size; i++) {
+        set_decoded_opcode(&image->code[i], STALL_OPCODE);
     }
-
     char buffer[1024]; // Buffer for reading lines
     int line_index = 0;
     // Read lines from the file and convert them to instructions
-    while (fgets(buffer, sizeof(buffer), file) && line_index < IMEM_SIZE - 1) {
+    while (fgets(buffer, sizeof(buffer), file) && line_index < size - 1) {
         // Remove newline character
         buffer[strcspn(buffer, "\n")] = '\0';
         // Skip empty lines or lines with only whitespace
@@ -116,7 +221,7 @@ void init_imem(core* cpu)
             continue;
         }
         // Convert the line to an instruction and store it in imem
-        if (line_to_instruction(buffer, &cpu->imem[line_index], line_index) == 1) {
+        if (line_to_instruction(buffer, &image->code[line_index], line_index) == 1) {
             line_index++;
         }
         else {
@@ -124,17 +229,68 @@ void init_imem(core* cpu)
         }
     }
     fclose(file);
-    // Add halt instruction to the last line of imem
-    if (line_index < IMEM_SIZE) {
-        turn_to_halt(&cpu->imem[line_index]);
+    // Add halt instruction to the last line of imem (the 5 stalls below it are already there)
+    if (line_index < size) {
+        set_decoded_opcode(&image->code[line_index], HALT_OPCODE);
     }
-    // Below the halt instruction add 5 stalls if there is room
-    int i = 5;
-    line_index++;
-    while(line_index < IMEM_SIZE && i > 0) {
-        turn_to_stall(&cpu->imem[line_index]);
-        line_index++;
-        i--;
+    compile_blocks(image);
+    return image;
+}
+
+/*
+ * Returns the pre-decoded image of the imem file in an imem of size lines.
+ * Cores that load the same file share one read-only copy (reference counted).
+ */
+imem_image* load_imem_image(char* filename, int size)
+{
+    pthread_mutex_lock(&loaded_images_lock);
+    for (imem_image* image = loaded_images; image; image = image->next) {
+        if (strcmp(image->filename, filename) == 0 && image->size == size) {
+            image->ref_count++;
+            pthread_mutex_unlock(&loaded_images_lock);
+            return image;
+        }
+    }
+    imem_image* image = parse_imem_image(filename, size);
+    if (image) {
+        image->filename = sim_malloc(strlen(filename) + 1);
+        if (!image->filename) {
+            perror("Failed to allocate memory for the imem image");
+            exit(EXIT_FAILURE);
+        }
+        strcpy(image->filename, filename);
+        image->ref_count = 1;
+        image->next = loaded_images;
+        loaded_images = image;
+    }
+    pthread_mutex_unlock(&loaded_images_lock);
+    return image;
+}
+
+// Drops one reference to the image and frees it when no core uses it anymore
+void release_imem_image(const imem_image* image)
+{
+    pthread_mutex_lock(&loaded_images_lock);
+    imem_image** link = &loaded_images;
+    while (*link && *link != image) {
+        link = &(*link)->next;
+    }
+    imem_image* found = *link;
+    if (found && --found->ref_count == 0) {
+        *link = found->next;
+        free(found->filename);
+        free(found);
+    }
+    pthread_mutex_unlock(&loaded_images_lock);
+}
+
+// Initializes the imem of the core structure, take the data from the file
+void init_imem(core* cpu) 
+{
+    cpu->imem = load_imem_image(cpu->cold->imem_filename, cpu->latency.imem_size);
+    if (!cpu->imem) {
+        printf("Error: failed to load imem file %s\n", cpu->cold->imem_filename);
+        exit(EXIT_FAILURE);
     }
 }
 
@@ -147,45 +303,65 @@ void init_imem(core* cpu)
  * - Initializes the instruction memory from the imem file.
  * - Initializes the stats struct.
  */
-core* init_core(int core_num, char* imem_str, char* coretrace_str, char* regout_str, char* stats_str, char* dsram_str, char* tsram_str)
+core* init_core(core_slot* slot, core_cold* cold, int core_num, char* imem_str, char* coretrace_str, char* regout_str, char* stats_str, char* dsram_str, char* tsram_str, const latency_config* latency, trace_format trace_format, const trace_filter* trace_filter)
 {
+    core* cpu = &slot->core;
+    cpu->cold = cold;
     // Initialize the Program Counter (PC)
-    core* cpu = malloc(sizeof(core));
-    if (!cpu) {
-        perror("Failed to allocate memory for core");
-        exit(EXIT_FAILURE);
-    }
     cpu->pc = 0;
     cpu->cycle = 0;
     cpu->core_number = core_num;
     cpu->done = false;
     cpu->need_the_bus = false;
     cpu->hold_the_bus = false;
-    cpu->stats = NULL;
-    cpu->imem_filename = imem_str;
-    cpu->coretrace_filename = coretrace_str;
-    cpu->regout_filename = regout_str;
-    cpu->stats_filename = stats_str;
-    cpu->dsram_filename = dsram_str;
-    cpu->tsram_filename = tsram_str;
+    cpu->mem_stall_streak = 0;
+    cpu->block_cycles = 0;
+    cpu->address_done = -1;
+    cpu->cold->trace_tail[0] = '\0';
+    cpu->cold->trace_format = trace_format;
+    init_core_trace_state(&cpu->cold->trace_state);
+    cpu->cold->trace_ring = NULL;
+    if (!trace_filter || core_is_traced(trace_filter, core_num)) {
+        cpu->trace_first_cycle = trace_filter ? trace_filter->first_cycle : 0;
+        cpu->trace_last_cycle = trace_filter ? trace_filter->last_cycle : INT_MAX;
+    }
+    else {
+        // an empty window, the coretrace file stays empty
+        cpu->trace_first_cycle = INT_MAX;
+        cpu->trace_last_cycle = -1;
+    }
+    cpu->cold->imem_filename = imem_str;
+    cpu->cold->coretrace_filename = coretrace_str;
+    cpu->cold->regout_filename = regout_str;
+    cpu->cold->stats_filename = stats_str;
+    cpu->cold->dsram_filename = dsram_str;
+    cpu->cold->tsram_filename = tsram_str;
+    cpu->latency = *latency;
+    init_store_buffer(&cpu->cold->store_buffer, latency->store_buffer);
+    turn_to_stall(&cpu->store_drain);
+    cpu->bus_for_buffer = false;
+    cpu->wrote_around = false;
     // Initializing the stats fields
-    init_stats(&(cpu->stats));
+    memset(&slot->stats, 0, sizeof(stats));
+    cpu->stats = &slot->stats;
     // Initialize all registers to 0
     for (int i = 0; i < NUM_OF_REGISTERS; i++) {
         cpu->registers[i] = 0;
     }
-    // Allocate and initialize the Cache
-    cpu->cache = (Cache*)malloc(sizeof(Cache));
-    if (cpu->cache) {
-        cache_initialization(cpu->cache);
-    }
-    else {
-        perror("Failed to allocate memory for the Cache");
-        exit(EXIT_FAILURE);
+    // Initialize the Cache
+    cpu->cache = &slot->cache;
+    cache_initialization(cpu->cache, &latency->cache, slot + 1); // its storage follows the slot
+    // The pipeline starts with stalls in all the latches
+    instruction* latches = slot->latches;
+    slot->pipeline = (instructions){ &latches[0], &latches[1], &latches[2], &latches[3], &latches[4] };
+    for (int i = 0; i < 5; i++) {
+        turn_to_stall(&latches[i]);
     }
     // Initialize the instruction memory (imem) using the provided file
     init_imem(cpu);
-    open_file(&cpu->coretrace_file, cpu->coretrace_filename, "w");
+    // the coretrace file is opened by the run (open_core_trace_file)
+    cpu->cold->coretrace_file = NULL;
+    cpu->cold->trace_offset = TRACE_NEW_FILE;
     return cpu;
 }
 
@@ -214,32 +390,71 @@ void copy_instruction(instruction* dest, instruction* src)
     dest->extra_delay = src->extra_delay;
 }
 
-// Creates a structure of 5 instructions and returns a pointer to it (used by the pipeline)
-instructions* create_instructions() 
+/*******************************************************/
+/**************** Dispatch tables **********************/
+/*******************************************************/
+
+// ALU operation of an opcode, receives the values of R[rs] and R[rt] and returns the result
+typedef int (*alu_handler)(int rs_value, int rt_value);
+
+// Branch resolution of an opcode, updates the pc (and $r15 for jal) if the jump is taken
+typedef void (*branch_handler)(core* cpu, int rs_value, int rt_value, int new_pc);
+
+static int alu_add(int rs_value, int rt_value) { return rs_value + rt_value; }  // add, lw, sw:  R[rs] + R[rt]
+static int alu_sub(int rs_value, int rt_value) { return rs_value - rt_value; }  // sub:  R[rd] = R[rs] - R[rt]
+static int alu_and(int rs_value, int rt_value) { return rs_value & rt_value; }  // and:  R[rd] = R[rs] & R[rt]
+static int alu_or (int rs_value, int rt_value) { return rs_value | rt_value; }  //  or:  R[rd] = R[rs] | R[rt]
+static int alu_xor(int rs_value, int rt_value) { return rs_value ^ rt_value; }  // xor:  R[rd] = R[rs] ^ R[rt]
+static int alu_mul(int rs_value, int rt_value) { return rs_value * rt_value; }  // mul:  R[rd] = R[rs] * R[rt]
+static int alu_sll(int rs_value, int rt_value) { return rs_value << rt_value; } // sll:  R[rd] = R[rs] << R[rt]
+static int alu_sra(int rs_value, int rt_value) { return rs_value >> rt_value; } // sra:  R[rd] = R[rs] >> R[rt]
+static int alu_srl(int rs_value, int rt_value) { return (uint32_t)rs_value >> rt_value; } // srl: R[rd] = R[rs] >> R[rt] (Logical shift)
+
+static void branch_beq(core* cpu, int rs_value, int rt_value, int new_pc) { if (rs_value == rt_value) { cpu->pc = new_pc; } }
+static void branch_bne(core* cpu, int rs_value, int rt_value, int new_pc) { if (rs_value != rt_value) { cpu->pc = new_pc; } }
+static void branch_blt(core* cpu, int rs_value, int rt_value, int new_pc) { if (rs_value < rt_value)  { cpu->pc = new_pc; } }
+static void branch_bgt(core* cpu, int rs_value, int rt_value, int new_pc) { if (rs_value > rt_value)  { cpu->pc = new_pc; } }
+static void branch_ble(core* cpu, int rs_value, int rt_value, int new_pc) { if (rs_value <= rt_value) { cpu->pc = new_pc; } }
+static void branch_bge(core* cpu, int rs_value, int rt_value, int new_pc) { if (rs_value >= rt_value) { cpu->pc = new_pc; } }
+// jal:  R[15] = next instruction address, pc = R[rd][9:0]
+static void branch_jal(core* cpu, int rs_value, int rt_value, int new_pc) { cpu->registers[15] = (cpu->pc + 1); cpu->pc = new_pc; }
+
+// Opcodes without an entry do nothing in the EXE phase
+static const alu_handler alu_handlers[256] = {
+    [0] = alu_add, [1] = alu_sub, [2] = alu_and, [3] = alu_or, [4] = alu_xor,
+    [5] = alu_mul, [6] = alu_sll, [7] = alu_sra, [8] = alu_srl,
+    [16] = alu_add, // lw: Prepares the address (to the MEM phase)
+    [17] = alu_add, // sw: Prepares the address (to the MEM phase)
+};
+
+// Opcodes without an entry are not resolved in the decode phase
+static const branch_handler branch_handlers[256] = {
+    [9] = branch_beq, [10] = branch_bne, [11] = branch_blt, [12] = branch_bgt,
+    [13] = branch_ble, [14] = branch_bge, [15] = branch_jal,
+};
+
+// Compiles each ALU word (add to srl) and sets the length of the run of ALU words from each word, last to first
+static void compile_blocks(imem_image* image)
 {
-    instructions* instr = (instructions*)malloc(sizeof(instructions));
-    if (!instr) {
-        perror("Failed to allocate memory for instructions");
-        exit(EXIT_FAILURE);
-    }
-    instr->fetch = (instruction*)malloc(sizeof(instruction));
-    instr->decode = (instruction*)malloc(sizeof(instruction));
-    instr->execute = (instruction*)malloc(sizeof(instruction));
-    instr->memory = (instruction*)malloc(sizeof(instruction));
-    instr->write_back = (instruction*)malloc(sizeof(instruction));
-    if (!instr->fetch || !instr->decode || !instr->execute || !instr->memory || !instr->write_back) {
-        perror("Failed to allocate memory for instructions stages");
-        free_instructions(instr);
-        exit(EXIT_FAILURE);
+    int length = 0;
+    // the pipeline is done when it fetches the last word, so no block reaches it
+    image->block_length[image->size - 1] = 0;
+    for (int pc = image->size - 2; pc >= 0; pc--) {
+        const decoded_instruction* inst = &image->code[pc];
+        compiled_instruction* compiled = &image->compiled[pc];
+        bool alu_word = inst->opcode <= 8 && alu_handlers[inst->opcode];
+        length = alu_word ? length + 1 : 0;
+        image->block_length[pc] = (uint16_t)length;
+        compiled->alu = alu_word ? alu_handlers[inst->opcode] : NULL;
+        compiled->opcode = inst->opcode;
+        compiled->rd = inst->rd;
+        compiled->rs = inst->rs;
+        compiled->rt = inst->rt;
+        compiled->imm = inst->imm & 0xFFF;
     }
-    turn_to_stall(instr->fetch);
-    turn_to_stall(instr->decode);
-    turn_to_stall(instr->execute);
-    turn_to_stall(instr->memory);
-    turn_to_stall(instr->write_back);
-    return instr;
 }
 
+
 // Performing the Fetch phase
 void fetch (core* cpu, instruction* instruction) 
 {
@@ -247,9 +462,8 @@ void fetch (core* cpu, instruction* instruction)
         cpu->pc++;
         return;
     }
-    if(cpu->pc < IMEM_SIZE) {
-        *instruction = cpu->imem[cpu->pc];
-        instruction->ALU_result = 0;
+    if(cpu->pc < cpu->imem->size) {
+        expand_instruction(instruction, &cpu->imem->code[cpu->pc], &cpu->latency);
     }
     else{
         turn_to_stall(instruction);
@@ -257,8 +471,33 @@ void fetch (core* cpu, instruction* instruction)
     cpu->pc++;
 }
 
-// Performing the decode phase, Returns true if a jump should be performed and false otherwise
-bool decode (core* cpu, instruction* instruction)
+// Returns true if the instruction writes the register in its WB phase (like write_back, $imm aside)
+static bool writes_register(const instruction* instruction, int reg)
+{
+    int opcode = instruction->opcode;
+    return reg != 1 && instruction->rd == reg && ((0 <= opcode && opcode <= 8 && reg != 0) || opcode == 16);
+}
+
+/*
+ * Returns the value of the register for the instruction in decode or EXE.
+ * With a bypass (the pipeline of a core with forwarding) the result of the youngest instruction
+ * in the MEM or WB latch that writes the register comes first, then the register file.
+ */
+static int read_register(core* cpu, const instructions* bypass, int reg)
+{
+    if (bypass) {
+        if (writes_register(bypass->memory, reg)) {
+            return bypass->memory->ALU_result;
+        }
+        if (writes_register(bypass->write_back, reg)) {
+            return bypass->write_back->ALU_result;
+        }
+    }
+    return cpu->registers[reg];
+}
+
+// The decode phase, the branch operands are read through the bypass (NULL: the register file)
+static bool decode_from(core* cpu, instruction* instruction, const instructions* bypass)
 {
     if(instruction->opcode == STALL_OPCODE || instruction->opcode == HALT_OPCODE) { 
         return false;
@@ -273,78 +512,173 @@ bool decode (core* cpu, instruction* instruction)
     }
     // Make sure the imm is indeed up to 12 bits in size
     instruction->imm = instruction->imm & 0xFFF;
+    branch_handler handler = branch_handlers[instruction->opcode & 0xFF];
+    if(!handler){
+        return false;
+    }
     // update register $imm to the imm value (just for this calc, we will restore it after)
     int imm = cpu->registers[1];
     cpu->registers[1] = instruction->imm;
-    int opcode = instruction->opcode;
-    // branch resolution (if needed)
-    if(opcode >= 9 && opcode <= 15){
-        // new_pc = R[rd][9:0] (used in case we jump)
-        int new_pc = jump_to_pc(cpu->registers[rd]); // new_pc = R[rd][9:0]
-        // update register $imm to the imm value (just for this calc, we will restore it after)
-        cpu->registers[1] = instruction->imm;
-        switch (opcode) {
-            case 9:  if(cpu->registers[rs] == cpu->registers[rt]) { cpu->pc = new_pc; } break; // beq:  if(R[rs] == R[rt]) pc = R[rd][low bits 9:0]
-            case 10: if(cpu->registers[rs] != cpu->registers[rt]) { cpu->pc = new_pc; } break; // bne:  if(R[rs] != R[rt]) pc = R[rd] [low bits 9:0]
-            case 11: if(cpu->registers[rs] < cpu->registers[rt])  { cpu->pc = new_pc; } break; // blt:  if(R[rs] < R[rt])  pc = R[rd] [low bits 9:0] 
-            case 12: if(cpu->registers[rs] > cpu->registers[rt])  { cpu->pc = new_pc; } break; // bgt:  if(R[rs] > R[rt])  pc = R[rd] [low bits 9:0]
-            case 13: if(cpu->registers[rs] <= cpu->registers[rt]) { cpu->pc = new_pc; } break; // ble:  if(R[rs] <= R[rt]) pc = R[rd] [low bits 9:0]
-            case 14: if(cpu->registers[rs] >= cpu->registers[rt]) { cpu->pc = new_pc; } break; // ble:  if(R[rs] >= R[rt]) pc = R[rd] [low bits 9:0]
-            case 15: cpu->registers[15] = (cpu->pc + 1);  cpu->pc = new_pc; break; // jal:  R[15] = next instruction address, pc = R[rd][9:0]  
-        default:
-            break;
-        }
-        // restore the $r1 value
-        cpu->registers[1] = imm;
-        return true;
-    }
+    // branch resolution, new_pc = R[rd][9:0] (used in case we jump)
+    handler(cpu, read_register(cpu, bypass, rs), read_register(cpu, bypass, rt), jump_to_pc(read_register(cpu, bypass, rd)));
     // restore the $r1 value
     cpu->registers[1] = imm;
-    return false;
+    return true;
 }
 
-// Performing the Execute phase, if needed store the result in ALU-result in the instruction struct
-void execute (core* cpu, instruction* instruction)
+// Performing the decode phase, Returns true if a jump should be performed and false otherwise
+bool decode (core* cpu, instruction* instruction)
+{
+    return decode_from(cpu, instruction, NULL);
+}
+
+// The Execute phase, the operands are read through the bypass (NULL: the register file)
+static void execute_from(core* cpu, instruction* instruction, const instructions* bypass)
 {
     // Do nothing if it is not an arithmetic operation or a memory operation.
-    if((instruction->opcode > 8 && instruction->opcode < 16) || instruction->opcode > 17
-     || instruction->opcode == STALL_OPCODE || instruction->opcode == HALT_OPCODE) { 
+    alu_handler handler = alu_handlers[instruction->opcode & 0xFF];
+    if(!handler) { 
         return;
     }
-    int opcode = instruction->opcode;
-    int rt = instruction->rt;
-    int rs = instruction->rs;
-    // update register $imm to the imm value (just for this calc, we will restore it after)
-    int imm = cpu->registers[1];
+    // $imm holds the imm of the instruction in the EXE phase (the MEM and WB phases read it after)
     cpu->registers[1] = instruction->imm;
-    switch (opcode) {
-        case 0:  instruction->ALU_result = cpu->registers[rs] + cpu->registers[rt]; return;  // add:  R[rd] = R[rs] + R[rt]
-        case 1:  instruction->ALU_result = cpu->registers[rs] - cpu->registers[rt]; return;  // sub:  R[rd] = R[rs] - R[rt]
-        case 2:  instruction->ALU_result = cpu->registers[rs] & cpu->registers[rt]; return;  // and:  R[rd] = R[rs] & R[rt]
-        case 3:  instruction->ALU_result = cpu->registers[rs] | cpu->registers[rt]; return;  //  or:  R[rd] = R[rs] | R[rt]
-        case 4:  instruction->ALU_result = cpu->registers[rs] ^ cpu->registers[rt]; return;  // xor:  R[rd] = R[rs] ^ R[rt]
-        case 5:  instruction->ALU_result = cpu->registers[rs] * cpu->registers[rt]; return;  // mul:  R[rd] = R[rs] * R[rt]
-        case 6:  instruction->ALU_result = cpu->registers[rs] << cpu->registers[rt]; return; // sll:  R[rd] = R[rs] << R[rt]
-        case 7:  instruction->ALU_result = cpu->registers[rs] >> cpu->registers[rt]; return; // sra:  R[rd] = R[rs] >> R[rt]
-        case 8:  instruction->ALU_result = (uint32_t)cpu->registers[rs] >> cpu->registers[rt]; return; // srl: R[rd] = R[rs] >> R[rt] (Logical shift)
-        case 16: instruction->ALU_result = cpu->registers[rs] + cpu->registers[rt]; return; // lw: Prepares the result (to the MEM phase)
-        case 17: instruction->ALU_result = cpu->registers[rs] + cpu->registers[rt]; return; // sw: Prepares the result (to the MEM phase)
-        default: // opcode = stall or invalid opcode 
+    instruction->ALU_result = handler(read_register(cpu, bypass, instruction->rs), read_register(cpu, bypass, instruction->rt));
+}
+
+// Performing the Execute phase, if needed store the result in ALU-result in the instruction struct
+void execute (core* cpu, instruction* instruction)
+{
+    execute_from(cpu, instruction, NULL);
+}
+
+static bool store_word(core* cpu, instruction* instruction, int value, bool allocate, cache_block* data_from_memory, uint32_t *address, bool* extra_delay);
+
+/*
+ * A sw with a store buffer: a hit with no older store in the buffer writes the cache,
+ * otherwise the store retires into the buffer, or waits in MEM while the buffer is full.
+ */
+static bool buffer_store(core* cpu, instruction* instruction, cache_block* data_from_memory, uint32_t* address, bool* extra_delay)
+{
+    store_buffer* buffer = &cpu->cold->store_buffer;
+    uint32_t store_address = (uint32_t)instruction->ALU_result;
+    if (store_buffer_empty(buffer) && search_block(cpu->cache, store_address)) {
+        return sw(cpu, instruction, data_from_memory, address, extra_delay);
+    }
+    if (store_buffer_full(buffer)) {
+        cpu->stats->store_buffer_stalls++;
+        return false;
+    }
+    push_store(buffer, store_address, cpu->registers[instruction->rd]);
+    if (buffer->count == 1) {
+        start_oldest_store(cpu);
+    }
+    return true;
+}
+
+// A lw of a word the store buffer holds gets the youngest store to it, returns false if the buffer has none
+static bool forward_store(core* cpu, instruction* instruction)
+{
+    const buffered_store* store = find_store(&cpu->cold->store_buffer, (uint32_t)instruction->ALU_result);
+    if (!store) {
+        return false;
+    }
+    instruction->ALU_result = store->value;
+    cpu->stats->store_forwards++;
+    return true;
+}
+
+// Makes the drain latch the sw of the oldest buffered store, with fresh delay counters (a stall if the buffer is empty)
+static void start_oldest_store(core* cpu)
+{
+    instruction* drain = &cpu->store_drain;
+    turn_to_stall(drain);
+    drain->extra_delay = 0;
+    if (store_buffer_empty(&cpu->cold->store_buffer)) {
         return;
     }
-    // restore the $r1 value
-    cpu->registers[1] = imm;
+    drain->opcode = 17;
+    drain->ALU_result = (int)oldest_store(&cpu->cold->store_buffer)->address;
+    drain->bus_delay = cpu->latency.bus_delay;
+    drain->block_delay = cpu->latency.block_delay;
+    drain->extra_delay = cpu->latency.extra_delay;
+}
+
+/*
+ * Moves the oldest buffered store on: while the core holds the bus for it, it counts down like a sw miss,
+ * otherwise it writes the cache if its block is there (a miss waits for the bus, see core_needs_bus).
+ * The store leaves the buffer once it is done.
+ */
+static void drain_store_buffer(core* cpu, cache_block* data_from_memory, uint32_t* address, bool* extra_delay)
+{
+    store_buffer* buffer = &cpu->cold->store_buffer;
+    if (store_buffer_empty(buffer)) {
+        return;
+    }
+    const buffered_store* store = oldest_store(buffer);
+    bool on_the_bus = cpu->hold_the_bus && cpu->bus_for_buffer;
+    if (!on_the_bus && !search_block(cpu->cache, store->address)) {
+        return;
+    }
+    if (store_word(cpu, &cpu->store_drain, store->value, cpu->latency.write_allocate, data_from_memory, address, extra_delay)) {
+        pop_store(buffer);
+        start_oldest_store(cpu);
+    }
+}
+
+// Returns true if the lw/sw in the MEM phase waits for the bus: a miss the store buffer does not take or forward
+bool mem_needs_bus(core* cpu, instruction* instruction)
+{
+    if (instruction->opcode != 16 && instruction->opcode != 17) {
+        return false;
+    }
+    uint32_t address = (uint32_t)instruction->ALU_result;
+    if (RUN_STORE_BUFFER(&cpu->latency) && (instruction->opcode == 17 || find_store(&cpu->cold->store_buffer, address))) {
+        return false;
+    }
+    return !search_block(cpu->cache, address);
+}
+
+// Returns true if the oldest buffered store waits for the bus (its block is not in the cache)
+bool store_buffer_needs_bus(core* cpu)
+{
+    return !store_buffer_empty(&cpu->cold->store_buffer) && !search_block(cpu->cache, oldest_store(&cpu->cold->store_buffer)->address);
+}
+
+// Returns the latch whose access the core holds the bus for: the drain latch of the oldest buffered store, or the MEM latch
+instruction* bus_access(core* cpu, instructions* instructions)
+{
+    return cpu->bus_for_buffer ? &cpu->store_drain : instructions->memory;
+}
+
+// True if the access the core holds the bus for brings its block into the cache (a buffered store may go around it)
+bool bus_access_allocates(const core* cpu)
+{
+    return !cpu->bus_for_buffer || cpu->latency.write_allocate;
 }
 
 // Performing the Mem phase, do nothing until the last cycle of the sum of the delays in the delay fields
 bool mem(core* cpu, instruction* instruction, cache_block* data_from_memory, uint32_t* address, bool* extra_delay)
 {
+    // A fence waits until the buffered stores are done
+    if (instruction->opcode == FENCE_OPCODE && !store_buffer_empty(&cpu->cold->store_buffer)) {
+        cpu->stats->fence_stalls++;
+        return false;
+    }
     // No memory operation needed
     if (instruction->opcode != 16 && instruction->opcode != 17) {
         return true;
     }
-    // The operation cannot be completed until the bus is received
-    else if (!cpu->hold_the_bus && !search_block(cpu->cache, (uint32_t)instruction->ALU_result))
+    // With a store buffer a sw retires into it and a lw of a buffered word takes it from there
+    if (RUN_STORE_BUFFER(&cpu->latency)) {
+        if (instruction->opcode == 17) {
+            return buffer_store(cpu, instruction, data_from_memory, address, extra_delay);
+        }
+        if (forward_store(cpu, instruction)) {
+            return true;
+        }
+    }
+    // The operation cannot be completed until the bus is received (for it, not for a buffered store)
+    if (!(cpu->hold_the_bus && !cpu->bus_for_buffer) && !search_block(cpu->cache, (uint32_t)instruction->ALU_result))
     {
         return false;
     }
@@ -379,17 +713,18 @@ bool lw(core* cpu, instruction* instruction, cache_block* data_from_memory, uint
     // lw: R[rd] = MEM[R[rs]+R[rt]] = MEM[ALU_result]
     // break data to address, offset and tag
     uint32_t data = (uint32_t)instruction->ALU_result;
-    address_done = false;
-    uint32_t offset = data % BLOCK_SIZE;
+    cpu->address_done = 0;
+    uint32_t offset = cache_block_offset(cpu->cache, data);
     // block for the search
     cache_block* c_block = NULL;
     bool found = search_block(cpu->cache, data);
     // Cache hit
     if (found) { // search_block returns a pointer to the block if it exists.
         c_block = get_cache_block(cpu->cache, data);
+        use_block(c_block, cpu->cycle);
         instruction->ALU_result = c_block->data[offset];
         cpu->stats->read_hit++;
-        address_done = true;
+        cpu->address_done = 1;
         return true;
     }
     // Cache miss
@@ -417,16 +752,14 @@ bool lw(core* cpu, instruction* instruction, cache_block* data_from_memory, uint
         else
         {
             *extra_delay = false;
-            // create block to insert the cache
-            c_block = (cache_block*)malloc(sizeof(cache_block));
-            if (!c_block) {
-                printf("Memory allocation failed!\n");
-                return false;
-            }
-            c_block->tag = data_from_memory->tag;
+            // create block to insert the cache (insert_block copies it)
+            int words[MAX_CACHE_BLOCK_SIZE];
+            cache_block new_block = { .data = words };
+            c_block = &new_block;
+            c_block->tag = cache_tag(cpu->cache, *address);
             c_block->state = EXCLUSIVE;
             c_block->cycle = cpu->cycle;
-            for(int i = 0; i < CACHE_BLOCK_SIZE; i++){
+            for(int i = 0; i < RUN_BLOCK_SIZE(&cpu->latency); i++){
                 c_block->data[i] = data_from_memory->data[i];
             }
             // load the word we want
@@ -436,7 +769,7 @@ bool lw(core* cpu, instruction* instruction, cache_block* data_from_memory, uint
             cpu->need_the_bus = false;
             cpu->hold_the_bus = false;
             cpu->stats->read_miss++;
-            address_done = true;
+            cpu->address_done = 1;
             return true;
         }
     }
@@ -457,10 +790,19 @@ bool lw(core* cpu, instruction* instruction, cache_block* data_from_memory, uint
 bool sw(core* cpu, instruction* instruction, cache_block* data_from_memory, uint32_t *address, bool* extra_delay)
 {
     // sw: MEM[R[rs]+R[rt]] = R[rd]
+    return store_word(cpu, instruction, cpu->registers[instruction->rd], true, data_from_memory, address, extra_delay);
+}
+
+/*
+ * Stores the value at the address of a sw latch (the sw in MEM, or the drain latch of the oldest buffered store),
+ * like sw. A miss that does not allocate (allocate false) leaves the cache as it is when its bus countdown ends,
+ * the word goes around it to memory (write_around_store).
+ */
+static bool store_word(core* cpu, instruction* instruction, int value, bool allocate, cache_block* data_from_memory, uint32_t *address, bool* extra_delay)
+{
     int data = instruction->ALU_result;
-    address_done = false;
-    uint32_t offset = data % BLOCK_SIZE;
-    //uint32_t tag = *address / (BLOCK_SIZE * NUM_OF_BLOCKS);
+    cpu->address_done = 0;
+    uint32_t offset = cache_block_offset(cpu->cache, (uint32_t)data);
     // block for the search
     bool found = search_block(cpu->cache, data);
     cache_block *c_block;
@@ -468,10 +810,11 @@ bool sw(core* cpu, instruction* instruction, cache_block* data_from_memory, uint
     if (found)
     {
         c_block = get_cache_block(cpu->cache, data);
-        c_block->data[offset] = cpu->registers[instruction->rd];
-        c_block->state = MODIFIED;
+        use_block(c_block, cpu->cycle);
+        c_block->data[offset] = value;
+        set_block_state(cpu->cache, c_block, MODIFIED);
         cpu->stats->write_hit++;
-        address_done = true;
+        cpu->address_done = 1;
         return true;
     }
     // Cache miss
@@ -496,28 +839,38 @@ bool sw(core* cpu, instruction* instruction, cache_block* data_from_memory, uint
         }
         // finished waiting for the whole block, update the cache and move forward (return true)
         //else if (instruction->bus_delay == 0 && instruction->block_delay == 0 && (!*extra_delay || instruction->extra_delay == 0))
+        else if (!allocate)
+        {
+            *extra_delay = false;
+            cpu->wrote_around = true;
+            cpu->around = (buffered_store){ *address, value };
+            cpu->stats->write_miss++;
+            // release the bus
+            cpu->need_the_bus = false;
+            cpu->hold_the_bus = false;
+            cpu->address_done = 1;
+            return true;
+        }
         else
         {
             *extra_delay = false;
-            // create block to insert the cache
-            c_block = (cache_block*)malloc(sizeof(cache_block));
-            if (!c_block) {
-                printf("Memory allocation failed!\n");
-                return false;
-            }
-            c_block->tag = data_from_memory->tag;
+            // create block to insert the cache (insert_block copies it)
+            int words[MAX_CACHE_BLOCK_SIZE];
+            cache_block new_block = { .data = words };
+            c_block = &new_block;
+            c_block->tag = cache_tag(cpu->cache, *address);
             c_block->state = MODIFIED;
             c_block->cycle = cpu->cycle;
-            for(int i = 0; i < CACHE_BLOCK_SIZE; i++){
+            for(int i = 0; i < RUN_BLOCK_SIZE(&cpu->latency); i++){
                 c_block->data[i] = data_from_memory->data[i];
             }
-            c_block->data[offset] = cpu->registers[instruction->rd];
+            c_block->data[offset] = value;
             insert_block(cpu->cache, *address, c_block, cpu->cycle); // Overwrite the old block with the new block
             cpu->stats->write_miss++;                               // count the miss just one
             // release the bus
             cpu->need_the_bus = false;
             cpu->hold_the_bus = false;
-            address_done = true;
+            cpu->address_done = 1;
             return true;
         }
     }
@@ -550,32 +903,38 @@ void write_back (core* cpu, instruction* instruction)
     //cpu->registers[15] = cpu->pc;
 }
 
-// performing one step in the core pipeline
-// Calculates pipeline delays and updates instructions accordingly
-cache_block* pipeline_step(core* cpu, instructions* instructions, cache_block* data_from_memory, uint32_t* address, bool* extra_delay) 
+/*
+ * Returns true if the instruction in decode must wait although the pipeline forwards (see pipeline_step):
+ * a branch reads its operands in decode, before EXE computes its results and MEM loads its words in the cycle,
+ * an instruction that enters EXE reads the MEM latch, where a lw from EXE has no word yet,
+ * and a sw reads its data in MEM, before WB writes the result of the instruction in EXE.
+ */
+static bool bypass_hazard(const instructions* instructions)
 {
-    if (!cpu) {
-        perror("Failed to allocate memory for core");
-        exit(EXIT_FAILURE);
+    const instruction* decoding = instructions->decode;
+    const instruction* exe = instructions->execute;
+    const instruction* memory = instructions->memory;
+    int opcode = decoding->opcode;
+    if (9 <= opcode && opcode <= 15) {
+        int operands[3] = { decoding->rs, decoding->rt, decoding->rd };
+        for (int i = (opcode == 15) ? 2 : 0; i < 3; i++) { // jal only reads its target
+            if (writes_register(exe, operands[i]) || (memory->opcode == 16 && writes_register(memory, operands[i]))) {
+                return true;
+            }
+        }
+        return false;
     }
-
-    cache_block* c_block = NULL;
-    if (*address != -1 && search_block(cpu->cache, *address))
-    {
-        c_block = get_cache_block(cpu->cache, *address);
+    if ((0 <= opcode && opcode <= 8) || opcode == 16 || opcode == 17) {
+        bool load_use = exe->opcode == 16 && (writes_register(exe, decoding->rs) || writes_register(exe, decoding->rt));
+        bool store_data = opcode == 17 && writes_register(exe, decoding->rd);
+        return load_use || store_data;
     }
+    return false;
+}
 
-    if(cpu->done) { return c_block; } // The core has finished executing all instructions.
-
-    
-    
-    
-
-    bool forward_fetch = true;
-    bool forward_decode = true;
-    bool forward_execute = true;
-    bool forward_memory = true;
-
+// Returns true if the instruction in decode waits on a data hazard in this cycle (fetch and decode do not advance)
+static bool decode_waits(core* cpu, instructions* instructions)
+{
     // Preparation before calculations (for convenience)
     int decode_rt = instructions->decode->rt;
     int decode_rs = instructions->decode->rs;
@@ -592,62 +951,101 @@ cache_block* pipeline_step(core* cpu, instructions* instructions, cache_block* d
     bool write_to_reg = (((instructions->write_back->opcode >= 0) && (instructions->write_back->opcode < 9)) || (instructions->write_back->opcode == 16));
     bool data_hazard_decode_and_wb = (((wb_rd == decode_rd) || (wb_rd == decode_rs) || (wb_rd == decode_rt)) && write_to_reg);
     
-    // if there is at least one data hazard
+    // if there is at least one data hazard (with forwarding only the ones the bypass network cannot cover)
     bool data_hazard = (data_hazard_decode_and_exe || data_hazard_decode_and_mem || data_hazard_decode_and_wb);
-    if (cpu->cycle > 1 && (instructions->decode->opcode != HALT_OPCODE) && data_hazard)
-    {
-        forward_fetch = false;
-        forward_decode = false;
+    if (RUN_FORWARDING(&cpu->latency)) {
+        data_hazard = bypass_hazard(instructions);
+    }
+    return cpu->cycle > 1 && (instructions->decode->opcode != HALT_OPCODE) && data_hazard;
+}
+
+// Returns the block of the cache the bus address hits (NULL: a miss or no address), read before each step
+cache_block* snooped_block(core* cpu, uint32_t address)
+{
+    if (address != -1 && search_block(cpu->cache, address)) {
+        return get_cache_block(cpu->cache, address);
+    }
+    return NULL;
+}
+
+// performing one step in the core pipeline
+// Calculates pipeline delays and updates instructions accordingly
+cache_block* pipeline_step(core* cpu, instructions* instructions, cache_block* data_from_memory, uint32_t* address, bool* extra_delay) 
+{
+    if (!cpu) {
+        perror("Failed to allocate memory for core");
+        exit(EXIT_FAILURE);
     }
+
+    cache_block* c_block = snooped_block(cpu, *address);
+
+    if(cpu->done) { return c_block; } // The core has finished executing all instructions.
+
+    // fetch and decode advance unless decode waits on a data hazard, the later phases unless MEM waits
+    bool advance_front = !decode_waits(cpu, instructions);
+    bool advance_back = true;
+
     // Performing the actions
     fetch(cpu, instructions->fetch);
     int prev_pc = cpu->pc;
-    bool jump_taken = decode(cpu, instructions->decode);
-    execute(cpu, instructions->execute);
+    bool jump_taken = decode_from(cpu, instructions->decode, RUN_FORWARDING(&cpu->latency) ? instructions : NULL);
+    execute_from(cpu, instructions->execute, RUN_FORWARDING(&cpu->latency) ? instructions : NULL);
     bool mem_hazard = !mem(cpu, instructions->memory, data_from_memory, address, extra_delay);
+    if (RUN_STORE_BUFFER(&cpu->latency)) {
+        // after the halt the empty pipeline waits for the buffered stores like a fence
+        if (!store_buffer_empty(&cpu->cold->store_buffer) && pipeline_is_empty(instructions)) {
+            cpu->stats->num_of_mem_stalls++;
+            cpu->stats->fence_stalls++;
+        }
+        drain_store_buffer(cpu, data_from_memory, address, extra_delay);
+    }
     // Memory Hazard (cache miss)  → Insert 16 stalls
     if (mem_hazard)
     {
-        forward_fetch = false;
-        forward_decode = false;
-        forward_execute = false;
-        forward_memory = false;
+        advance_front = false;
+        advance_back = false;
         cpu->stats->num_of_mem_stalls++;
+        cpu->mem_stall_streak++;
+    }
+    else {
+        cpu->mem_stall_streak = 0;
     }
     if(CORE_DEBUG && cpu->core_number == CORE_NUM) print_core_trace_hex(cpu, instructions);
-    write_line_to_core_trace_file(cpu, instructions);
+    if (TRACING) {
+        write_line_to_core_trace_file(cpu, instructions);
+    }
     write_back(cpu, instructions->write_back);
     cpu->cycle++;
-    // Advancing the stages in the core pipeline
-    if(forward_memory) { copy_instruction(instructions->write_back, instructions->memory);  }
-    else { turn_to_stall(instructions->write_back);  } // mem Not finished - insert stall
-    if(forward_execute){ copy_instruction(instructions->memory, instructions->execute); }
-    else {  // exe need to wait
-        if(forward_memory){ // if mem is getting forward and exe not - insert stall
-            turn_to_stall(instructions->memory);
-        }
+    // Advancing the stages in the core pipeline: the latches rotate, the one that leaves WB takes the free place
+    instruction* retired = instructions->write_back;
+    if (!advance_back) {
+        turn_to_stall(instructions->write_back); // mem Not finished - insert stall
     }
-    if(forward_decode) { 
-        copy_instruction(instructions->execute, instructions->decode);
-        // We have reached the halt command. We will continue until the pipeline is emptied but turn fetch and decode to stalls.
-        if(instructions->execute->opcode == HALT_OPCODE) {
-            turn_to_stall(instructions->fetch);
-            turn_to_stall(instructions->decode);
+    else {
+        instructions->write_back = instructions->memory;
+        instructions->memory = instructions->execute;
+        if (advance_front) {
+            instructions->execute = instructions->decode;
+            instructions->decode = instructions->fetch;
+            instructions->fetch = retired;
+            // We have reached the halt command. We will continue until the pipeline is emptied but turn fetch and decode to stalls.
+            if (instructions->execute->opcode == HALT_OPCODE) {
+                turn_to_stall(instructions->decode);
+            }
+        }
+        else { // exe need to wait - insert stall
+            instructions->execute = retired;
+            turn_to_stall(instructions->execute);
         }
     }
-    else { // fetch the same instruction again and hold decode in the same place
-        if(jump_taken) { 
+    if (!advance_front) { // fetch the same instruction again and hold decode in the same place
+        if (jump_taken) {
             cpu->pc = prev_pc;
         }
-        if(forward_execute) {
-            turn_to_stall(instructions->execute); // insert stall
-        }
-    }
-    if(forward_fetch)  { copy_instruction(instructions->decode, instructions->fetch);     }
-    else{
         cpu->pc--;
-        copy_instruction(instructions->fetch, instructions->decode);
     }
+    // the fetch latch holds the instruction in decode (the fetch after a stall reads it instead of the imem)
+    copy_instruction(instructions->fetch, instructions->decode);
     // Count all stalls that complete the wb phase
     if(instructions->write_back->opcode == STALL_OPCODE){
         cpu->stats->num_of_decode_stalls++;
@@ -659,7 +1057,7 @@ cache_block* pipeline_step(core* cpu, instructions* instructions, cache_block* d
         // decode stalls = total stalls - mem_stalls + 4 (the number of stalls for filling the pipeline)
         cpu->stats->num_of_decode_stalls = (cpu->stats->num_of_decode_stalls - (cpu->stats->num_of_mem_stalls + 4));
         cpu->done = true;
-        fclose(cpu->coretrace_file);
+        close_core_trace_file(cpu);
     }
     if (*address != -1 && search_block(cpu->cache, *address))
     {
@@ -668,50 +1066,515 @@ cache_block* pipeline_step(core* cpu, instructions* instructions, cache_block* d
     return c_block;
 }
 
-// Check if all instructions are stalls (the core finish running)
-bool done(core* cpu, instructions* instructions)
+// True if all the instructions in the pipeline are stalls
+static bool pipeline_is_empty(instructions* instructions)
 {
     bool b1 = (instructions->fetch->opcode == STALL_OPCODE);
     bool b2 = (instructions->decode->opcode == STALL_OPCODE);
     bool b3 = (instructions->execute->opcode == STALL_OPCODE);
     bool b4 = (instructions->memory->opcode == STALL_OPCODE);
     bool b5 = (instructions->write_back->opcode == STALL_OPCODE);
-    bool just_stalls = (b1 && b2 && b3 && b4 && b5);
+    return (b1 && b2 && b3 && b4 && b5);
+}
+
+// True if the next cycle of the core only moves ALU instructions through its pipeline (see pipeline_block)
+static bool block_cycle(core* cpu, instructions* instructions)
+{
+    int decoding = instructions->decode->opcode;
+    int memory = instructions->memory->opcode;
+    return !cpu->done && !cpu->hold_the_bus && store_buffer_empty(&cpu->cold->store_buffer) &&
+           0 <= decoding && decoding <= 8 && ((0 <= memory && memory <= 8) || memory == STALL_OPCODE) &&
+           cpu->pc < cpu->imem->size - 1 && !decode_waits(cpu, instructions);
+}
 
-    cpu->done = ((just_stalls && cpu->cycle > 0) || (instructions->fetch->pc == IMEM_SIZE-1));
+// Runs the cycles of the core that only move ALU instructions through its pipeline (the cycles of pipeline_step without MEM)
+int pipeline_block(core* cpu, instructions* instructions, int max_cycles)
+{
+    int cycles = 0;
+    int stalls = 0;
+    for (; cycles < max_cycles && block_cycle(cpu, instructions); cycles++) {
+        fetch(cpu, instructions->fetch);
+        // an ALU instruction in decode resolves no branch, MEM has no access to make
+        decode_from(cpu, instructions->decode, RUN_FORWARDING(&cpu->latency) ? instructions : NULL);
+        execute_from(cpu, instructions->execute, RUN_FORWARDING(&cpu->latency) ? instructions : NULL);
+        if(CORE_DEBUG && cpu->core_number == CORE_NUM) print_core_trace_hex(cpu, instructions);
+        if (TRACING) {
+            write_line_to_core_trace_file(cpu, instructions);
+        }
+        write_back(cpu, instructions->write_back);
+        cpu->cycle++;
+        // all the latches advance, the one that leaves WB takes the free place
+        instruction* retired = instructions->write_back;
+        instructions->write_back = instructions->memory;
+        instructions->memory = instructions->execute;
+        instructions->execute = instructions->decode;
+        instructions->decode = instructions->fetch;
+        instructions->fetch = retired;
+        copy_instruction(instructions->fetch, instructions->decode);
+        stalls += (instructions->write_back->opcode == STALL_OPCODE);
+    }
+    cpu->stats->num_of_decode_stalls += stalls;
+    if (cycles > 0) {
+        cpu->mem_stall_streak = 0;
+    }
+    return cycles;
+}
+
+// Check if all instructions are stalls (the core finish running), the buffered stores must be done as well
+bool done(core* cpu, instructions* instructions)
+{
+    bool just_stalls = pipeline_is_empty(instructions);
+
+    cpu->done = ((just_stalls && cpu->cycle > 0) || (instructions->fetch->pc == cpu->imem->size - 1)) && store_buffer_empty(&cpu->cold->store_buffer);
     return cpu->done;
 }
 
-// Frees the core's memory including its cache and the stats
-void free_core(core* cpu)
+// Runs the instruction at the pc of the core functionally, returns false when the pc reaches a halt or the end of the imem
+bool functional_step(core* cpu, int* next_pc, functional_access* access)
 {
-    if (!cpu) {
-        return;
+    access->type = NO_ACCESS;
+    int pc = cpu->pc;
+    // the pipeline is done when it fetches the last imem word
+    if (pc < 0 || pc >= cpu->imem->size - 1) {
+        return false;
     }
-    // Free the cache if it exists
-    if(cpu->cache){
-        free_cache(cpu->cache);
+    const decoded_instruction* inst = &cpu->imem->code[pc];
+    // a stall word stops the fetch like a halt
+    if (inst->opcode == HALT_OPCODE || inst->opcode == STALL_OPCODE) {
+        return false;
+    }
+    int opcode = inst->opcode;
+    int rd = inst->rd;
+    cpu->pc = *next_pc;
+    *next_pc = cpu->pc + 1;
+    // $imm holds the imm of the instruction (decode, EXE and WB all set it)
+    cpu->registers[1] = inst->imm & 0xFFF;
+    branch_handler branch = branch_handlers[opcode];
+    if (branch) {
+        // decode runs after the fetch of the delay slot, the pipeline pc is 2 words ahead (jal always jumps)
+        int following_pc = cpu->pc;
+        cpu->pc = (opcode == 15) ? pc + 2 : -1;
+        branch(cpu, cpu->registers[inst->rs], cpu->registers[inst->rt], jump_to_pc(cpu->registers[rd]));
+        if (opcode == 15 || cpu->pc != -1) {
+            *next_pc = cpu->pc;
+        }
+        cpu->pc = following_pc;
+        return true;
+    }
+    alu_handler alu = alu_handlers[opcode];
+    if (!alu) {
+        return true;
+    }
+    int result = alu(cpu->registers[inst->rs], cpu->registers[inst->rt]);
+    if (opcode == 16) {
+        access->type = LOAD_ACCESS;
+        access->address = (uint32_t)result;
+        access->rd = rd;
     }
-    // Free the stats struct
-    if (cpu->stats) {
-        free(cpu->stats);
+    else if (opcode == 17) {
+        access->type = STORE_ACCESS;
+        access->address = (uint32_t)result;
+        access->value = cpu->registers[rd];
     }
-    // Free the core itself
-    free(cpu);
+    // no R-type result is written to $zero or $imm
+    else if (rd != 0 && rd != 1) {
+        cpu->registers[rd] = result;
+    }
+    return true;
 }
 
-// Frees the structure with the 5 instructions
-void free_instructions(instructions* instructions)
+// Runs the basic block at the pc of the core in one go, returns the number of instructions run (0: none)
+int functional_block(core* cpu, int* next_pc, int max_length)
 {
-    if (!instructions) {
+    int pc = cpu->pc;
+    if (pc < 0 || pc >= cpu->imem->size || *next_pc != pc + 1) {
+        return 0;
+    }
+    int length = cpu->imem->block_length[pc];
+    if (length > max_length) {
+        length = max_length;
+    }
+    if (length < 2) {
+        return 0;
+    }
+    int* registers = cpu->registers;
+    const compiled_instruction* compiled = &cpu->imem->compiled[pc];
+    for (int i = 0; i < length; i++) {
+        registers[1] = compiled[i].imm;
+        int result = compiled[i].alu(registers[compiled[i].rs], registers[compiled[i].rt]);
+        // no R-type result is written to $zero or $imm
+        if (compiled[i].rd > 1) {
+            registers[compiled[i].rd] = result;
+        }
+    }
+    cpu->pc = pc + length;
+    *next_pc = cpu->pc + 1;
+    return length;
+}
+
+// VECTOR_LANES registers of a lockstep group (GCC vector types: SSE2 or AVX2, whichever the build targets)
+typedef uint32_t lane_vector __attribute__((vector_size(VECTOR_LANES * sizeof(uint32_t))));
+typedef int32_t signed_lane_vector __attribute__((vector_size(VECTOR_LANES * sizeof(int32_t))));
+
+// Runs the ALU operation of the opcode on the vectors of lanes (the shifts use the low 5 bits of R[rt], as the host does)
+static void alu_lanes(int opcode, lane_vector* rd, const lane_vector* rs, const lane_vector* rt, int vectors)
+{
+    for (int v = 0; v < vectors; v++) {
+        switch (opcode) {
+        case 0: rd[v] = rs[v] + rt[v]; break;
+        case 1: rd[v] = rs[v] - rt[v]; break;
+        case 2: rd[v] = rs[v] & rt[v]; break;
+        case 3: rd[v] = rs[v] | rt[v]; break;
+        case 4: rd[v] = rs[v] ^ rt[v]; break;
+        case 5: rd[v] = rs[v] * rt[v]; break;
+        case 6: rd[v] = rs[v] << (rt[v] & 31); break;
+        case 7: rd[v] = (lane_vector)((signed_lane_vector)rs[v] >> (signed_lane_vector)(rt[v] & 31)); break;
+        default: rd[v] = rs[v] >> (rt[v] & 31); break;  // 8: srl
+        }
+    }
+}
+
+// Fills the $imm row of the lanes with the imm of the instruction (masked)
+static void set_lanes_imm(lane_registers* lanes, int vectors, int imm)
+{
+    lane_vector imm_value = { 0 };
+    imm_value += (uint32_t)imm;
+    lane_vector* row = (lane_vector*)lanes->registers[1];
+    for (int v = 0; v < vectors; v++) {
+        row[v] = imm_value;
+    }
+}
+
+// Runs the basic block at the pc on all the lanes at once, returns the number of instructions run (0: none)
+int functional_block_lanes(const imem_image* imem, int pc, int max_length, lane_registers* lanes)
+{
+    if (pc < 0 || pc >= imem->size) {
+        return 0;
+    }
+    int length = imem->block_length[pc];
+    if (length > max_length) {
+        length = max_length;
+    }
+    if (length < 2) {
+        return 0;
+    }
+    int vectors = (lanes->lanes + VECTOR_LANES - 1) / VECTOR_LANES;
+    const compiled_instruction* compiled = &imem->compiled[pc];
+    for (int i = 0; i < length; i++) {
+        // no R-type result is written to $zero or $imm
+        if (compiled[i].rd <= 1) {
+            continue;
+        }
+        // $imm holds the imm of the instruction, the row is only filled for the instructions that read it
+        if (compiled[i].rs == 1 || compiled[i].rt == 1) {
+            set_lanes_imm(lanes, vectors, compiled[i].imm);
+        }
+        alu_lanes(compiled[i].opcode, (lane_vector*)lanes->registers[compiled[i].rd],
+                  (const lane_vector*)lanes->registers[compiled[i].rs], (const lane_vector*)lanes->registers[compiled[i].rt], vectors);
+    }
+    // the block ends with the $imm of its last instruction
+    set_lanes_imm(lanes, vectors, compiled[length - 1].imm);
+    return length;
+}
+
+// True if the conditional branch (beq to bge) is taken for the values
+static bool branch_taken(int opcode, int rs_value, int rt_value)
+{
+    switch (opcode) {
+    case 9:  return rs_value == rt_value;
+    case 10: return rs_value != rt_value;
+    case 11: return rs_value < rt_value;
+    case 12: return rs_value > rt_value;
+    case 13: return rs_value <= rt_value;
+    default: return rs_value >= rt_value;  // 14: bge
+    }
+}
+
+// Runs the instruction at the pc on all the lanes at once, returns false (nothing runs) if a branch parts the lanes
+bool functional_step_lanes(const imem_image* imem, int* pc, int* next_pc, lane_registers* lanes)
+{
+    const decoded_instruction* inst = &imem->code[*pc];
+    int opcode = inst->opcode;
+    int vectors = (lanes->lanes + VECTOR_LANES - 1) / VECTOR_LANES;
+    int following_pc = *next_pc;
+    int following_next_pc = following_pc + 1;
+    // $imm holds the imm of the instruction before its registers are read
+    set_lanes_imm(lanes, vectors, inst->imm & 0xFFF);
+    if (opcode >= 9 && opcode <= 15) {
+        // every lane must take the branch the same way, to the same pc (jal always jumps)
+        const int32_t* rs = lanes->registers[inst->rs];
+        const int32_t* rt = lanes->registers[inst->rt];
+        const int32_t* rd = lanes->registers[inst->rd];
+        bool taken = (opcode == 15) || branch_taken(opcode, rs[0], rt[0]);
+        int target = jump_to_pc(rd[0]);
+        for (int lane = 1; lane < lanes->lanes; lane++) {
+            bool lane_taken = (opcode == 15) || branch_taken(opcode, rs[lane], rt[lane]);
+            if (lane_taken != taken || (taken && jump_to_pc(rd[lane]) != target)) {
+                return false;
+            }
+        }
+        if (taken) {
+            following_next_pc = target;
+        }
+        if (opcode == 15) {
+            // decode runs 2 words after the jal, which saves the word after that
+            for (int lane = 0; lane < lanes->lanes; lane++) {
+                lanes->registers[15][lane] = *pc + 3;
+            }
+        }
+    }
+    // no R-type result is written to $zero or $imm
+    else if (opcode <= 8 && inst->rd > 1) {
+        alu_lanes(opcode, (lane_vector*)lanes->registers[inst->rd],
+                  (const lane_vector*)lanes->registers[inst->rs], (const lane_vector*)lanes->registers[inst->rt], vectors);
+    }
+    *pc = following_pc;
+    *next_pc = following_next_pc;
+    return true;
+}
+
+// Returns true if the two latches hold the same instruction (their ALU results may differ)
+static bool same_latch(const instruction* first, const instruction* second)
+{
+    return first->pc == second->pc && first->opcode == second->opcode && first->rt == second->rt &&
+           first->rs == second->rs && first->rd == second->rd && first->imm == second->imm &&
+           first->bus_delay == second->bus_delay && first->block_delay == second->block_delay &&
+           first->extra_delay == second->extra_delay;
+}
+
+// True if the other core can run the next pipeline block of the leader in lockstep with it
+bool joins_pipeline_block(core* leader, instructions* leader_pipeline, core* other, instructions* other_pipeline)
+{
+    return other->imem == leader->imem && other->cycle == leader->cycle && other->pc == leader->pc &&
+           same_latch(other_pipeline->fetch, leader_pipeline->fetch) && same_latch(other_pipeline->decode, leader_pipeline->decode) &&
+           same_latch(other_pipeline->execute, leader_pipeline->execute) && same_latch(other_pipeline->memory, leader_pipeline->memory) &&
+           same_latch(other_pipeline->write_back, leader_pipeline->write_back) && block_cycle(other, other_pipeline);
+}
+
+static void build_core_trace_line(core* cpu, instructions* instructions, core_trace_line* line);
+
+// Returns the lanes of the register for the instruction in EXE, through the bypass of the latches when the pipeline forwards
+static const lane_vector* operand_lanes(core* leader, instructions* control, int32_t* results[], lane_registers* lanes, int reg)
+{
+    if (RUN_FORWARDING(&leader->latency)) {
+        if (writes_register(control->memory, reg)) {
+            return (const lane_vector*)results[3];
+        }
+        if (writes_register(control->write_back, reg)) {
+            return (const lane_vector*)results[4];
+        }
+    }
+    return (const lane_vector*)lanes->registers[reg];
+}
+
+// Copies the first vectors of a row of lanes to another
+static void copy_lanes(int32_t* dest, const int32_t* src, int vectors)
+{
+    for (int v = 0; v < vectors; v++) {
+        ((lane_vector*)dest)[v] = ((const lane_vector*)src)[v];
+    }
+}
+
+// Runs the next pipeline block of the cores of a lockstep group at once (the cycles of pipeline_block on each core)
+int pipeline_block_lanes(core* cores[], instructions* pipelines[], int count, int max_cycles)
+{
+    core* leader = cores[0];
+    instructions* control = pipelines[0];
+    lane_registers lanes;
+    // the ALU result of each latch by lanes, in the order of the phases (fetch to WB), rotated with the latches
+    _Alignas(HOST_CACHE_LINE) int32_t result_rows[NUM_OF_TRACE_STAGES][MAX_LANES];
+    int32_t* results[NUM_OF_TRACE_STAGES];
+    memset(&lanes, 0, sizeof(lanes));
+    memset(result_rows, 0, sizeof(result_rows));
+    lanes.lanes = count;
+    for (int lane = 0; lane < count; lane++) {
+        instruction* latches[NUM_OF_TRACE_STAGES] = { pipelines[lane]->fetch, pipelines[lane]->decode, pipelines[lane]->execute,
+                                                      pipelines[lane]->memory, pipelines[lane]->write_back };
+        for (int i = 0; i < NUM_OF_TRACE_STAGES; i++) {
+            results[i] = result_rows[i];
+            result_rows[i][lane] = latches[i]->ALU_result;
+        }
+        for (int reg = 0; reg < NUM_OF_REGISTERS; reg++) {
+            lanes.registers[reg][lane] = cores[lane]->registers[reg];
+        }
+    }
+    int vectors = (count + VECTOR_LANES - 1) / VECTOR_LANES;
+    int cycles = 0;
+    int stalls = 0;
+    int retired = 0;
+    for (; cycles < max_cycles && block_cycle(leader, control); cycles++) {
+        // a fetch that reads the imem (or passes its end) starts the latch with no ALU result
+        if (control->fetch->opcode != STALL_OPCODE || leader->pc == 0) {
+            memset(results[0], 0, vectors * sizeof(lane_vector));
+        }
+        fetch(leader, control->fetch);
+        // an ALU instruction in decode resolves no branch, MEM has no access to make
+        decode_from(leader, control->decode, NULL);
+        instruction* exe = control->execute;
+        if (alu_handlers[exe->opcode & 0xFF]) {
+            // $imm holds the imm of the instruction in the EXE phase, a lw/sw adds its address
+            set_lanes_imm(&lanes, vectors, exe->imm);
+            alu_lanes(exe->opcode <= 8 ? exe->opcode : 0, (lane_vector*)results[2],
+                      operand_lanes(leader, control, results, &lanes, exe->rs), operand_lanes(leader, control, results, &lanes, exe->rt), vectors);
+        }
+        if (TRACING) {
+            core_trace_line line;
+            build_core_trace_line(leader, control, &line);
+            for (int lane = 0; lane < count; lane++) {
+                core* cpu = cores[lane];
+                if (line.cycle < cpu->trace_first_cycle || line.cycle > cpu->trace_last_cycle) {
+                    continue;
+                }
+                for (int i = 0; i < NUM_OF_TRACE_REGISTERS; i++) {
+                    line.registers[i] = lanes.registers[FIRST_TRACE_REGISTER + i][lane];
+                }
+                cpu->cold->trace_line = line;
+                write_core_trace_line(cpu, &cpu->cold->trace_line);
+            }
+        }
+        // WB: $imm takes the imm of the instruction, an R-type or a lw writes its result
+        instruction* wb = control->write_back;
+        int opcode = wb->opcode;
+        if (opcode != STALL_OPCODE && opcode != HALT_OPCODE) {
+            set_lanes_imm(&lanes, vectors, wb->imm);
+            if (!((0 <= opcode && opcode <= 8 && (wb->rd == 0 || wb->rd == 1)) || (opcode > 8 && opcode != 16))) {
+                copy_lanes(lanes.registers[wb->rd], results[4], vectors);
+                retired++;
+            }
+        }
+        leader->cycle++;
+        // all the latches advance, the one that leaves WB takes the free place
+        instruction* retired_latch = control->write_back;
+        control->write_back = control->memory;
+        control->memory = control->execute;
+        control->execute = control->decode;
+        control->decode = control->fetch;
+        control->fetch = retired_latch;
+        copy_instruction(control->fetch, control->decode);
+        int32_t* retired_results = results[4];
+        memmove(&results[1], &results[0], 4 * sizeof(int32_t*));
+        results[0] = retired_results;
+        copy_lanes(results[0], results[1], vectors);
+        stalls += (control->write_back->opcode == STALL_OPCODE);
+    }
+    // each core ends with the leader's latches, its own results and registers
+    for (int lane = 0; lane < count; lane++) {
+        core* cpu = cores[lane];
+        instructions* pipeline = pipelines[lane];
+        if (lane > 0) {
+            copy_instruction(pipeline->fetch, control->fetch);
+            copy_instruction(pipeline->decode, control->decode);
+            copy_instruction(pipeline->execute, control->execute);
+            copy_instruction(pipeline->memory, control->memory);
+            copy_instruction(pipeline->write_back, control->write_back);
+            cpu->pc = leader->pc;
+            cpu->cycle = leader->cycle;
+        }
+        instruction* latches[NUM_OF_TRACE_STAGES] = { pipeline->fetch, pipeline->decode, pipeline->execute, pipeline->memory, pipeline->write_back };
+        for (int i = 0; i < NUM_OF_TRACE_STAGES; i++) {
+            latches[i]->ALU_result = results[i][lane];
+        }
+        for (int reg = 0; reg < NUM_OF_REGISTERS; reg++) {
+            cpu->registers[reg] = lanes.registers[reg][lane];
+        }
+        cpu->stats->num_of_decode_stalls += stalls;
+        cpu->stats->total_instructions += retired;
+        if (cycles > 0) {
+            cpu->mem_stall_streak = 0;
+        }
+    }
+    return cycles;
+}
+
+// Returns the pc of the instruction in the decode latch and sets next_pc to the pc after it (-1: the core is ending)
+int pipeline_resume_pc(core* cpu, instructions* instructions, int* next_pc)
+{
+    // the fetch already moved the pc past the decode latch (or to the target of the branch before it)
+    if (instructions->decode->pc != -1) {
+        *next_pc = cpu->pc;
+        return instructions->decode->pc;
+    }
+    // a pipeline that did not fetch yet (the start of the run or after restart_pipeline)
+    if (cpu->cycle == 0 || instructions->fetch->pc == cpu->pc) {
+        *next_pc = cpu->pc + 1;
+        return cpu->pc;
+    }
+    return -1;
+}
+
+// Empties the pipeline of the core and restarts it at the pc (the first step fetches it)
+void restart_pipeline(core* cpu, instructions* instructions, int pc)
+{
+    turn_to_stall(instructions->decode);
+    turn_to_stall(instructions->execute);
+    turn_to_stall(instructions->memory);
+    turn_to_stall(instructions->write_back);
+    // fetch only reads the imem while its latch is not a stall (or the pc is 0)
+    cpu->pc = pc;
+    expand_instruction(instructions->fetch, &cpu->imem->code[pc], &cpu->latency);
+    cpu->mem_stall_streak = 0;
+}
+
+// Returns true if the next step of the core will repeat its last step exactly (waiting on a lw/sw miss)
+bool core_is_frozen(core* cpu, instructions* instructions)
+{
+    if (cpu->done || cpu->mem_stall_streak < 2 || !store_buffer_empty(&cpu->cold->store_buffer)) {
+        return false;
+    }
+    instruction* mem_instruction = instructions->memory;
+    if (mem_instruction->opcode != 16 && mem_instruction->opcode != 17) {
+        return false;
+    }
+    return !search_block(cpu->cache, (uint32_t)mem_instruction->ALU_result);
+}
+
+// Performs the given number of frozen steps at once, the coretrace lines are the same except the cycle
+void skip_frozen_cycles(core* cpu, int cycles)
+{
+    // only the skipped cycles inside the trace window are written
+    int first = (cpu->cycle > cpu->trace_first_cycle) ? cpu->cycle : cpu->trace_first_cycle;
+    int last = (cpu->cycle + cycles - 1 < cpu->trace_last_cycle) ? cpu->cycle + cycles - 1 : cpu->trace_last_cycle;
+    if (TRACING && first <= last && first == cpu->trace_first_cycle) {
+        // the line they repeat was before the window and was only kept in numbers
+        core_trace_line line = cpu->cold->trace_line;
+        line.cycle = first;
+        write_core_trace_line(cpu, &line);
+        first++;
+    }
+    int count = last - first + 1;
+    if (!TRACING || count <= 0) {
+        // nothing to write
+    }
+    else if (cpu->cold->trace_ring) {
+        trace_record record;
+        record.type = RECORD_CORE_REPEAT;
+        record.repeat.cycle = first;
+        record.repeat.count = count;
+        push_trace_record(cpu->cold->trace_ring, &record);
+    }
+    else if (cpu->cold->trace_format == TRACE_BINARY) {
+        uint8_t record[CORE_REPEAT_SIZE];
+        fwrite(record, 1, encode_core_repeat(first, count, record), cpu->cold->coretrace_file);
+    }
+    else {
+        for (int i = 0; i < count; i++) {
+            fprintf(cpu->cold->coretrace_file, "%d %s", first + i, cpu->cold->trace_tail);
+        }
+    }
+    cpu->cycle += cycles;
+    cpu->stats->num_of_mem_stalls += cycles;
+    // the WB phase is a stall in each of these cycles
+    cpu->stats->num_of_decode_stalls += cycles;
+}
+
+// Drops the core's reference to the imem image (the rest of the core lives in its arena slot)
+void free_core(core* cpu)
+{
+    if (!cpu) {
         return;
     }
-    free(instructions->fetch);
-    free(instructions->decode);
-    free(instructions->execute);
-    free(instructions->memory);
-    free(instructions->write_back);
-    free(instructions);
+    // Drop the core's reference to the shared imem image
+    release_imem_image(cpu->imem);
 }
 
 // turn instruction to stall
@@ -747,39 +1610,86 @@ void turn_to_halt(instruction* instruction)
 /*************** Create output files *******************/
 /*******************************************************/
 
-// Writes a line to the coretrace.txt file after each cycle
+// Fills the coretrace line of this cycle in numbers
+static void build_core_trace_line(core* cpu, instructions* instructions, core_trace_line* line)
+{
+    instruction* stages[5] = {instructions->fetch, instructions->decode, instructions->execute, instructions->memory, instructions->write_back};
+    line->cycle = cpu->cycle;
+    for (int i = 0; i < NUM_OF_TRACE_STAGES; i++) {
+        line->pcs[i] = (int16_t)stages[i]->pc;
+    }
+    for (int i = 0; i < NUM_OF_TRACE_REGISTERS; i++) {
+        line->registers[i] = cpu->registers[FIRST_TRACE_REGISTER + i];
+    }
+}
+
+// Writes a line to the coretrace.txt file after each cycle (inside the trace window)
 void write_line_to_core_trace_file(core* cpu, instructions* instructions) 
 {
     if (!cpu) {
         printf("Error: Invalid file pointer or uninitialized core/cache.\n");
         return;
     }
-    // Write the clock cycle number
-    fprintf(cpu->coretrace_file, "%d ", cpu->cycle);
-    // Write the PC values for each pipeline stage
-    if(instructions->fetch->pc != -1) { fprintf(cpu->coretrace_file, "%03X ", instructions->fetch->pc); }
-    else{ fprintf(cpu->coretrace_file, "--- "); }
-
-    if(instructions->decode->pc != -1) { fprintf(cpu->coretrace_file, "%03X ", instructions->decode->pc); }
-    else{ fprintf(cpu->coretrace_file, "--- "); }
-
-    if(instructions->execute->pc != -1) { fprintf(cpu->coretrace_file, "%03X ", instructions->execute->pc); }
-    else{ fprintf(cpu->coretrace_file, "--- "); }
-
-    if(instructions->memory->pc != -1) { fprintf(cpu->coretrace_file, "%03X ", instructions->memory->pc); }
-    else{ fprintf(cpu->coretrace_file, "--- "); }
-    
-    if(instructions->write_back->pc != -1) { fprintf(cpu->coretrace_file, "%03X ", instructions->write_back->pc); }
-    else{ fprintf(cpu->coretrace_file, "--- "); }
+    if (cpu->cycle >= cpu->trace_first_cycle && cpu->cycle <= cpu->trace_last_cycle) {
+        build_core_trace_line(cpu, instructions, &cpu->cold->trace_line);
+        write_core_trace_line(cpu, &cpu->cold->trace_line);
+    }
+    else if (cpu->mem_stall_streak > 0) {
+        // the processor may skip the repeats of this line into the window (skip_frozen_cycles)
+        build_core_trace_line(cpu, instructions, &cpu->cold->trace_line);
+    }
+    if(done(cpu, instructions)){
+        close_core_trace_file(cpu);
+    }
+}
 
+// Writes a coretrace line given in numbers
+void write_core_trace_line(core* cpu, const core_trace_line* line)
+{
+    if (cpu->cold->trace_ring) {
+        // The writer thread formats the line and closes the file at the end of the run
+        trace_record record;
+        record.type = RECORD_CORE_LINE;
+        record.core_line = *line;
+        push_trace_record(cpu->cold->trace_ring, &record);
+        return;
+    }
+    if (cpu->cold->trace_format == TRACE_BINARY) {
+        // Only the registers that changed since the last line are written
+        uint8_t record[CORE_LINE_MAX_SIZE];
+        fwrite(record, 1, encode_core_line(&cpu->cold->trace_state, line, record), cpu->cold->coretrace_file);
+        return;
+    }
+    // Build the line without the cycle number (kept for the cycles the processor skips)
+    char* tail = cpu->cold->trace_tail;
+    int length = 0;
+    // Write the PC values for each pipeline stage
+    for (int i = 0; i < NUM_OF_TRACE_STAGES; i++) {
+        if(line->pcs[i] != -1) { length += sprintf(tail + length, "%03X ", line->pcs[i]); }
+        else{ length += sprintf(tail + length, "--- "); }
+    }
     // Write the register values (starting from R2)
-    for (int i = 2; i < NUM_OF_REGISTERS; i++) {
-        fprintf(cpu->coretrace_file, "%08X ", cpu->registers[i]);
+    for (int i = 0; i < NUM_OF_TRACE_REGISTERS; i++) {
+        length += sprintf(tail + length, "%08X ", line->registers[i]);
     }
     // End the line
-    fprintf(cpu->coretrace_file, "\n");
-    if(done(cpu, instructions)){
-        fclose(cpu->coretrace_file);
+    sprintf(tail + length, "\n");
+    // Write the clock cycle number and the line
+    fprintf(cpu->cold->coretrace_file, "%d %s", line->cycle, tail);
+}
+
+// Opens the coretrace file, a new one or the one of a restored checkpoint at its offset
+void open_core_trace_file(core* cpu)
+{
+    cpu->cold->coretrace_file = open_trace_file(cpu->cold->coretrace_filename, cpu->cold->trace_format, CORE_TRACE, cpu->cold->trace_offset);
+}
+
+// Closes the coretrace file (does nothing if it is already closed)
+void close_core_trace_file(core* cpu)
+{
+    if (cpu->cold->coretrace_file) {
+        fclose(cpu->cold->coretrace_file);
+        cpu->cold->coretrace_file = NULL;
     }
 }
 
@@ -796,7 +1706,7 @@ void create_output_files(core* cpu)
 void create_regout_file(core* cpu) 
 {
     FILE* regout_file = NULL;
-    open_file(&regout_file, cpu->regout_filename, "w");
+    open_file(&regout_file, cpu->cold->regout_filename, "w");
     // Write the register values (starting from R2)
     for (int i = 2; i < NUM_OF_REGISTERS; i++) {
         fprintf(regout_file, "%08X\n", cpu->registers[i]);
@@ -809,7 +1719,7 @@ void create_regout_file(core* cpu)
 void create_stats_file(core* cpu) 
 {
     FILE* file = NULL;
-    open_file(&file, cpu->stats_filename, "w");
+    open_file(&file, cpu->cold->stats_filename, "w");
 
     // Write the values
     fprintf(file, "cycles %d\n", cpu->stats->total_cycles);
@@ -820,6 +1730,15 @@ void create_stats_file(core* cpu)
     fprintf(file, "write_miss %d\n", cpu->stats->write_miss);
     fprintf(file, "decode_stall %d\n", cpu->stats->num_of_decode_stalls);
     fprintf(file, "mem_stall %d\n", cpu->stats->num_of_mem_stalls);
+    if (cpu->latency.store_buffer > 0) {
+        fprintf(file, "store_buffer_stall %d\n", cpu->stats->store_buffer_stalls);
+        fprintf(file, "fence_stall %d\n", cpu->stats->fence_stalls);
+        fprintf(file, "store_forward %d\n", cpu->stats->store_forwards);
+    }
+    // a run that is not the default one says what it ran (the stats of the default run keep their format)
+    if (!is_default_config(&cpu->latency)) {
+        write_config(file, &cpu->latency);
+    }
 
     // Close the file
     fclose(file);
@@ -829,13 +1748,14 @@ void create_stats_file(core* cpu)
 void create_dsram_file(core* cpu)
 {
     FILE* file = NULL;
-    open_file(&file, cpu->dsram_filename, "w");
+    open_file(&file, cpu->cold->dsram_filename, "w");
     if (!file) {
         perror("Error opening dsram file");
         return;
     }
-    for (int i = 0; i < NUM_BLOCKS; i++) {
-        for (int j = 0; j < CACHE_BLOCK_SIZE; j++) {
+    int block_size = cache_block_size(cpu->cache);
+    for (int i = 0; i < cpu->cache->num_blocks; i++) {
+        for (int j = 0; j < block_size; j++) {
             fprintf(file, "%08X\n", cpu->cache->blocks[i].data[j]);
         }
     }
@@ -846,11 +1766,13 @@ void create_dsram_file(core* cpu)
 void create_tsram_file(core* cpu)
 {
     FILE* file = NULL;
-    open_file(&file, cpu->tsram_filename, "w");
-    for (int i = 0; i < NUM_BLOCKS; i++) {
-        uint32_t tag = cpu->cache->blocks[i].tag & 0xFFF; // Tag 12 bits
+    open_file(&file, cpu->cold->tsram_filename, "w");
+    // 12 tag bits in the default cache, the address bits above the set and the offset in the block
+    int tag_bits = cache_tag_bits(cpu->cache);
+    for (int i = 0; i < cpu->cache->num_blocks; i++) {
+        uint32_t tag = cpu->cache->blocks[i].tag & ((1u << tag_bits) - 1);
         MESI_state state = cpu->cache->blocks[i].state & 0x3; // MESI state 2 bits
-        uint32_t tsram_entry = (state << 12) | tag; // MESI 12-13 MSB, Tag 0-11 LSB
+        uint32_t tsram_entry = (state << tag_bits) | tag; // MESI above the tag (bits 12-13 in the default cache)
 
         fprintf(file, "%08X\n", tsram_entry);
     }
@@ -874,22 +1796,20 @@ void open_file(FILE** f, char* filename, char* c)
 /*************** Debugging functions *******************/
 /*******************************************************/
 
-// Test single core, executes all instructions in the core instruction memory
-void run_core(core* cpu, main_memory* memory)
+// Test single core, executes all instructions in the core instruction memory on its pipeline (the latches of its slot)
+void run_core(core* cpu, instructions* instructions, main_memory* memory)
 {
-    // Allocate memory for the instructions
-    instructions* instructions = create_instructions();
     cache_block* data_from_memory = NULL;
     bool extra_delay = false;
     uint32_t address = 0;
+    open_core_trace_file(cpu);
     while(!done(cpu, instructions) || cpu->pc == 0) {
         // Performing the actions
         pipeline_step(cpu, instructions, data_from_memory, &address, &extra_delay);
     }
     // create the regout.txt file
     create_output_files(cpu);
-    // Ensure to free allocated memory at the end of the function
-    free_instructions(instructions);
+    // the caller frees the slot of the core
     free_core(cpu);
 }
 
@@ -900,7 +1820,7 @@ char* get_instruction_as_a_string(instruction* instr)
     const char* opcodes[] = {
         "add", "sub", "and", "or", "xor", "mul", "sll", "sra", "srl",
         "beq", "bne", "blt", "bgt", "ble", "bge", "jal", "lw", "sw", 
-        " ", " ", "halt"
+        "fence", " ", "halt"
     };
     // registers list
     const char* registers[] = {
@@ -916,7 +1836,7 @@ char* get_instruction_as_a_string(instruction* instr)
     snprintf(imm_str, sizeof(imm_str), "%d", instr->imm);
     // Calculating the size of the final string
     size_t size = strlen(opcode_str) + strlen(rt_str) + strlen(rs_str) + strlen(rd_str) + strlen(imm_str) + 32;
-    char* result = (char*)malloc(size * sizeof(char));
+    char* result = (char*)sim_malloc(size * sizeof(char));
     if (!result) {
         perror("Failed to allocate memory for instruction string");
         return NULL;
@@ -936,10 +1856,12 @@ void print_imem(core* cpu)
 {
     printf("Instruction Memory:\n");
 
-    for (int i = 0; i < IMEM_SIZE; i++) {
-        instruction* inst = &cpu->imem[i];
+    for (int i = 0; i < cpu->imem->size; i++) {
+        instruction expanded;
+        instruction* inst = &expanded;
+        expand_instruction(inst, &cpu->imem->code[i], &cpu->latency);
         // Check if the instruction is non-empty
-        if (inst->opcode != 0 || inst->rt != 0 || inst->rs != 0 || inst->rd != 0 || inst->imm != 0) {
+        if (inst->opcode != STALL_OPCODE && (inst->opcode != 0 || inst->rt != 0 || inst->rs != 0 || inst->rd != 0 || inst->imm != 0)) {
             char* inst_str = get_instruction_as_a_string(inst);
             if (inst_str) {
                 printf("%s\n", inst_str);
@@ -9,6 +9,9 @@
 #include <stdbool.h>
 #include "sram.h"
 #include "memory.h"
+#include "trace.h"
+#include "trace_writer.h"
+#include "store_buffer.h"
 #include "core.h"
 
 
@@ -17,18 +20,44 @@
 /*******************************************************/
 
 #define NUM_OF_REGISTERS 16
-#define IMEM_SIZE 1024   // 1024 lines of 32 bits
+#define IMEM_SIZE 1024   // 1024 lines of 32 bits (the default, see latency_config)
+#define MAX_IMEM_SIZE 4096 // the most lines an imem can have
 #define HALT_OPCODE 20
 #define STALL_OPCODE 21
+#define FENCE_OPCODE 18 // waits in MEM until the store buffer of the core is empty
 #define BUS_DELAY 17  // Delay until the first word is retrieved from memory (16 + 1)
 #define BLOCK_DELAY 4 // Delay until the entire block is received
 #define EXTRA_DELAY 4 // Delay until the entire block from the cache moves to memory
+#define TRACE_TAIL_SIZE 160 // A coretrace line without the cycle number (5 pcs + 14 registers)
+#define HOST_CACHE_LINE 64  // bytes in a cache line of the host (each core of an arena starts a new one)
+#define MAX_LANES 64        // the cores a lockstep group can hold (see functional_block_lanes)
+#if defined(__AVX2__)
+#define VECTOR_LANES 8      // the lanes one vector operation of a lockstep block runs (one AVX2 register)
+#else
+#define VECTOR_LANES 4      // the lanes one vector operation of a lockstep block runs (one SSE2 register)
+#endif
 
 
 /*******************************************************/
 /*********************  Structs ************************/
 /*******************************************************/
 
+/*
+ * The configuration of a simulation: the bus latencies (the defaults are BUS_DELAY, BLOCK_DELAY and EXTRA_DELAY),
+ * the pipeline, the geometry of the caches and the size of the imem. A config file and the command line
+ * set it at run time (see config.h).
+ */
+typedef struct {
+    int bus_delay;   // cycles until the first word is retrieved from memory
+    int block_delay; // cycles until the entire block is received
+    int extra_delay; // cycles until a modified block moves from the cache to memory
+    bool forwarding; // the bypass network of the pipeline (see pipeline_step), off by default
+    cache_geometry cache; // the data caches, CACHE_SIZE words in blocks of CACHE_BLOCK_SIZE, direct-mapped by default
+    int imem_size;   // the lines of the imem, up to MAX_IMEM_SIZE (IMEM_SIZE by default, the jumps reach the first 512)
+    int store_buffer;    // the entries of the store buffer of each core, up to MAX_STORE_BUFFER (0 by default: none)
+    bool write_allocate; // a buffered store that misses brings its block into the cache (the default), else it goes around it
+} latency_config;
+
 // Structure of a single instruction
 typedef struct {
     int pc;
@@ -44,6 +73,38 @@ typedef struct {
                      // this is the additional number of cycles that the instruction will wait
 } instruction;
 
+// Pre-decoded form of an imem word, built once when the imem file is loaded (8 bytes, 8 per host cache line)
+typedef struct {
+    uint8_t opcode;
+    uint8_t rd;
+    uint8_t rs;
+    uint8_t rt;
+    int16_t imm;
+    int16_t pc;      // pc shown in the trace, -1 for the halt/stalls padding added after the program
+} decoded_instruction;
+
+// An ALU instruction compiled for the functional mode: its operation, its operands and its $imm (masked)
+typedef struct {
+    int (*alu)(int rs_value, int rt_value);
+    uint8_t opcode;  // selects the vector operation of a lockstep block
+    uint8_t rd;
+    uint8_t rs;
+    uint8_t rt;
+    int imm;
+} compiled_instruction;
+
+// Read-only instruction memory image, shared by all the cores that load the same imem file
+typedef struct imem_image {
+    char* filename;
+    int ref_count;
+    struct imem_image* next;
+    int size;                                   // the lines of the imem (the first size words of the arrays are used)
+    decoded_instruction code[MAX_IMEM_SIZE];
+    // the basic blocks, compiled once when the image is loaded (see functional_block)
+    uint16_t block_length[MAX_IMEM_SIZE];           // the ALU instructions that run straight from each word
+    compiled_instruction compiled[MAX_IMEM_SIZE];   // the compiled form of each ALU word
+} imem_image;
+
 // A set of 5 instructions currently in the pipeline
 typedef struct {
     instruction* fetch;
@@ -53,6 +114,20 @@ typedef struct {
     instruction* write_back;
 } instructions;
 
+// The memory access of an instruction run by functional_step (the caller performs it)
+typedef enum {
+    NO_ACCESS,
+    LOAD_ACCESS,   // lw: registers[rd] = the word at address
+    STORE_ACCESS   // sw: the word at address = value
+} access_type;
+
+typedef struct {
+    access_type type;
+    uint32_t address;
+    int rd;
+    int value;
+} functional_access;
+
 // Structure of core statistics - for the stats file
 typedef struct {
     int total_cycles;
@@ -63,35 +138,93 @@ typedef struct {
     int write_miss;
     int num_of_decode_stalls;
     int num_of_mem_stalls;
+    int store_buffer_stalls; // the mem stalls of a sw waiting for a full store buffer
+    int fence_stalls;        // the mem stalls of a fence (or the halt) waiting for the store buffer to drain
+    int store_forwards;      // the lw that got their word from the store buffer
 
 } stats;
 
 
+/*
+ * The state of a core the cycle loop does not walk every cycle: its file names, its coretrace file and the state of
+ * its lines, and its store buffer. The cold states of a processor are an array apart from the core arena
+ * (core_cold[i] of cores[i]), so the slots hold only the per-cycle fields and the cache.
+ */
+typedef struct {
+    // files names the core need to create
+    _Alignas(HOST_CACHE_LINE) char* imem_filename;
+    char* coretrace_filename;
+    char* regout_filename;
+    char* stats_filename;
+    char* dsram_filename;
+    char* tsram_filename;
+    // files 
+    FILE* coretrace_file; // the only file the core need to update each step (NULL once closed)
+    long trace_offset;    // where the run continues the coretrace file (TRACE_NEW_FILE: a new file)
+    trace_format trace_format;
+    char trace_tail[TRACE_TAIL_SIZE]; // the last line written to coretrace, without the cycle number (text)
+    core_trace_state trace_state;     // the registers of the last line written to coretrace (binary)
+    trace_ring* trace_ring;           // set when the writer thread owns the coretrace file (NULL: written here)
+    core_trace_line trace_line;       // the last line in numbers (before the window: the last MEM stall line)
+    // the store buffer (see store_buffer.h)
+    store_buffer store_buffer;
+} core_cold;
+
 // Core structures
 typedef struct {
     int pc;
     int cycle;
     int core_number;
     int registers[NUM_OF_REGISTERS];
-    instruction imem[IMEM_SIZE];
+    const imem_image* imem;
+    latency_config latency;
     Cache* cache;
     stats* stats;
     // flags
     bool done;         // if true, signals to the processor that this core finish the imem instructions
     bool need_the_bus; // if true, signals to the processor that this core needs the bus
     bool hold_the_bus; // if true, Signals to the processor that this core currently owns the bus
-    // files names the core need to create
-    char* imem_filename;
-    char* coretrace_filename;
-    char* regout_filename;
-    char* stats_filename;
-    char* dsram_filename;
-    char* tsram_filename;
-    // files 
-    FILE* coretrace_file; // the only file the core need to update each step
+    int mem_stall_streak; // number of consecutive cycles the whole pipeline waited on the MEM phase
+    int block_cycles;     // the cycles of a pipeline block the core ran ahead of the processor (see pipeline_block)
+    int address_done;     // set by lw/sw in the MEM phase: 1 the access completed, 0 still waiting, -1 no access this cycle
+    int trace_first_cycle; // the cycles whose coretrace lines are written (inclusive)
+    int trace_last_cycle;
+    core_cold* cold;       // the file names, the coretrace file and the store buffer of the core
+    // the store buffer drain (the buffer itself is in cold)
+    instruction store_drain; // the oldest buffered store as a sw (its bus countdown)
+    bool bus_for_buffer;     // the bus request of the core is for the oldest buffered store, not for the lw/sw in MEM
+    bool wrote_around;       // a store went around the cache in this step, the processor writes it to memory (write_around_store)
+    buffered_store around;   // that store
 
 } core;
 
+/*
+ * One core of the core arena of a processor: the core, its stats, its pipeline latches and its cache
+ * in one block (its cold state is apart, see core_cold), the blocks and the words of the cache follow the struct (cache_storage_size of the geometry
+ * of the run, so a slot takes whole host cache lines of the size its geometry needs).
+ * The slots of the arena are contiguous and aligned to the host cache lines,
+ * so the cycle loop walks the cores through adjacent memory and no two cores share a line
+ * (the parallel engine runs them on different threads).
+ */
+typedef struct {
+    _Alignas(HOST_CACHE_LINE) core core;
+    stats stats;
+    instructions pipeline;  // points at the latches below (the pipeline rotates the pointers)
+    instruction latches[5];
+    Cache cache;
+} core_slot;
+
+/*
+ * The registers of the cores of a lockstep group, one row per register with a lane per core,
+ * so each instruction of a block runs on all the cores with a few vector operations
+ * (the basic blocks of the functional mode and the pipeline blocks of the detailed one).
+ * The lanes after the group up to a whole vector are padding (their values do not matter).
+ */
+typedef struct {
+    _Alignas(HOST_CACHE_LINE) int32_t registers[NUM_OF_REGISTERS][MAX_LANES];
+    int lanes;
+} lane_registers;
+
 
 /*******************************************************/
 /**************** Assembler Functions*******************/
@@ -103,40 +236,76 @@ int str_to_int(char* str);
 /*
  * Parses an 8-digit string into components and converts them to integers.
  * Parameters:
- * - imm: Pointer to store the integer value of the 3 least significant digits.
- * - rt: Pointer to store the integer value of the fourth least significant digit.
- * - rs: Pointer to store the integer value of the fifth least significant digit.
- * - rd: Pointer to store the integer value of the sixth least significant digit.
- * - opcode: Pointer to store the integer value of the 2 most significant digits.
+ * - imm: the integer value of the 3 least significant digits.
+ * - rt: the integer value of the fourth least significant digit.
+ * - rs: the integer value of the fifth least significant digit.
+ * - rd: the integer value of the sixth least significant digit.
+ * - opcode: the integer value of the 2 most significant digits.
  * - str: 8-character string representing the input.
  * Returns 1 if parsing and conversion are successful, -1 otherwise.
  */
-bool parse_instruction(instruction* instruction, char* str);
+bool parse_instruction(decoded_instruction* instruction, char* str);
+
+// Converts a hax string line into a decoded instruction, Returns 1 if successful, -1 otherwise.
+int line_to_instruction(char* line, decoded_instruction* inst, int line_index);
+
+// Expands a decoded imem word into a pipeline latch (static fields + fresh delay counters)
+void expand_instruction(instruction* dest, const decoded_instruction* src, const latency_config* latency);
+
+// Sets the latencies to the defined default values (no forwarding, the default cache geometry and imem size)
+void set_default_latency(latency_config* latency);
 
-// Converts a hax string line into an instruction structure, Returns 1 if successful, -1 otherwise.
-int line_to_instruction(char* line, instruction* inst, int line_index);
+// Gives the core new latencies, the instructions in its pipeline get fresh delay counters (none may be on the bus)
+void set_core_latency(core* cpu, instructions* pipeline, const latency_config* latency);
 
 
 /*******************************************************/
 /***************** Core Functions **********************/
 /*******************************************************/
 
-// Initializes the stats structure
-void init_stats(stats** stat);
+// Allocates a core arena of count slots for caches of the geometry in one block aligned to the host cache lines
+core_slot* create_core_slots(int count, const cache_geometry* geometry);
+
+// Returns slot index of a core arena created for the geometry
+core_slot* get_core_slot(core_slot* slots, int index, const cache_geometry* geometry);
+
+// Frees the core arena (its cores are freed first with free_core)
+void free_core_slots(core_slot* slots);
+
+// Allocates the cold states of count cores, each one aligned to the host cache lines
+core_cold* create_core_cold(int count);
+
+// Frees the cold states of the cores
+void free_core_cold(core_cold* cold);
+
+/*
+ * Returns the pre-decoded image of the imem file in an imem of size lines.
+ * Cores that load the same file share one read-only copy (reference counted),
+ * also across simulations that run at the same time on different threads.
+ */
+imem_image* load_imem_image(char* filename, int size);
+
+// Drops one reference to the image and frees it when no core uses it anymore
+void release_imem_image(const imem_image* image);
 
-// Initializes the imem array in the core structure, take the data from the imem file
+// Initializes the imem of the core structure, take the data from the imem file (imem_size lines of its latency)
 void init_imem(core* cpu);
 
 /*
- * Initializes the entire core structure:
+ * Initializes the entire core structure in its slot of a core arena (the slot holds the core, its cache,
+ * its stats and its pipeline) and its cold state:
  * - Sets pc and cycle to 0.
- * - Initializes output filenames.
+ * - Initializes output filenames (in cold).
  * - Initializes all registers to zeros.
- * - Initializes the cache with zeros and INVALID state.
+ * - Initializes the cache with zeros and INVALID state, in the geometry of latency->cache.
+ * - Fills the pipeline latches with stalls.
  * - Initializes the instruction memory from the imem file.
  * - Initializes the stats struct.
+ * - Copies the bus latencies of the simulation.
+ * - Sets the trace format of the coretrace file (the run opens it).
+ * - Takes the coretrace cycle window from the trace filter (NULL: every cycle).
  */
-core* init_core(int core_num, char* imem_str, char* coretrace_str, char* regout_str, char* stats_str, char* dsram_str, char* tsram_str);
+core* init_core(core_slot* slot, core_cold* cold, int core_num, char* imem_str, char* coretrace_str, char* regout_str, char* stats_str, char* dsram_str, char* tsram_str, const latency_config* latency, trace_format trace_format, const trace_filter* trace_filter);
 
 // Extracts the low 9 bits and returns them as an int - used in jump instructions
 int jump_to_pc(int imm);
@@ -144,9 +313,6 @@ int jump_to_pc(int imm);
 // Copies one instruction structure to another
 void copy_instruction(instruction* dest, instruction* src);
 
-// Creates a structure of 5 instructions and returns a pointer to it (used by the pipeline)
-instructions* create_instructions();
-
 // Performing the Fetch phase
 void fetch (core* cpu, instruction* instruction);
 
@@ -187,20 +353,124 @@ bool lw(core* cpu, instruction* instruction, cache_block* data_from_memory, uint
 */
 bool sw(core *cpu, instruction *instruction, cache_block *data_from_memory, uint32_t *address, bool *extra_delay);
 
+// Returns true if the lw/sw in the MEM phase waits for the bus: a miss the store buffer does not take or forward
+bool mem_needs_bus(core* cpu, instruction* instruction);
+
+// Returns true if the oldest buffered store waits for the bus (its block is not in the cache)
+bool store_buffer_needs_bus(core* cpu);
+
+// Returns the latch whose access the core holds the bus for: the drain latch of the oldest buffered store, or the MEM latch
+instruction* bus_access(core* cpu, instructions* instructions);
+
+// True if the access the core holds the bus for brings its block into the cache (a buffered store may go around it)
+bool bus_access_allocates(const core* cpu);
+
 // Performing the WB phase
-void write_beck (core* cpu, instruction* instruction);
+void write_back (core* cpu, instruction* instruction);
 
-// performing one step in the core pipeline, Calculates pipeline delays and updates instructions accordingly
+/*
+ * performing one step in the core pipeline, Calculates pipeline delays and updates instructions accordingly.
+ * Without forwarding, decode waits while an instruction in EXE, MEM or WB uses one of its registers.
+ * With forwarding (cpu->latency.forwarding) EXE and the branches in decode read the results in the MEM
+ * and WB latches (EX->EX, MEM->EX and MEM->decode), and decode only waits:
+ * - one cycle after a lw whose result the next instruction uses (the load-use interlock),
+ * - for a branch operand that EXE computes, or a lw in MEM loads, in this cycle,
+ * - for the register a sw stores, while EXE computes it (the store data is read in MEM, from the register file).
+ * $imm is never forwarded, each instruction reads its own imm.
+ */
 cache_block* pipeline_step(core* cpu, instructions* instructions, cache_block* data_from_memory, uint32_t* address, bool* extra_delay);
 
-// Check if all instructions are stalls (the core finish running)
+// Check if all instructions are stalls (the core finish running) and the store buffer is empty
 bool done(core* cpu, instructions* instructions);
 
-// Frees the core's memory including its cache and the stats
-void free_core(core* cpu);
+/*
+ * Runs the instruction at the pc of the core functionally: no pipeline latches, no delays, no trace.
+ * next_pc is the pc after it, a taken branch sets it once its delay slot ran (the pipeline resolves
+ * branches in decode after fetching the next word, jal saves the pc 3 words after it like the pipeline).
+ * The access of a lw/sw is returned to the caller, which performs it.
+ * Returns false when the pc reaches a halt or the end of the imem (the instruction is not run).
+ */
+bool functional_step(core* cpu, int* next_pc, functional_access* access);
+
+/*
+ * Runs the basic block at the pc of the core functionally in one go: the ALU instructions (add to srl)
+ * from the pc up to the first branch, lw/sw, halt or stall, at most max_length of them.
+ * Only a core that is not in a delay slot (next_pc is the word after the pc) runs a block.
+ * The registers, pc and next_pc end as after functional_step of each of the instructions,
+ * the caller accounts their cycles. Returns the number of instructions run (0: no block of 2 or more here).
+ */
+int functional_block(core* cpu, int* next_pc, int max_length);
+
+/*
+ * Runs the basic block at pc of the image on all the lanes at once, like functional_block on each
+ * of the cores of a lockstep group (the caller checks that they are not in a delay slot and moves their pcs).
+ * Returns the number of instructions run (0: no block of 2 or more here).
+ */
+int functional_block_lanes(const imem_image* imem, int pc, int max_length, lane_registers* lanes);
+
+/*
+ * Runs the instruction at pc of the image (not a lw/sw, halt or stall) on all the lanes at once,
+ * like functional_step on each of the cores of a lockstep group (pc and next_pc are theirs and move on).
+ * Returns false if a branch would send the lanes to different pcs (the lanes only get the $imm of the branch).
+ */
+bool functional_step_lanes(const imem_image* imem, int* pc, int* next_pc, lane_registers* lanes);
+
+/*
+ * Returns the pc of the first instruction that did not pass the decode phase (the one in the decode latch)
+ * and sets next_pc to the pc after it (the target of a branch whose delay slot it is).
+ * Returns -1 if the core only drains the instructions before its end.
+ */
+int pipeline_resume_pc(core* cpu, instructions* instructions, int* next_pc);
+
+// Empties the pipeline of the core and restarts it at the pc (the first step fetches it)
+void restart_pipeline(core* cpu, instructions* instructions, int pc);
+
+/*
+ * Returns true if the next step of the core will repeat its last step exactly:
+ * the whole pipeline has waited on a lw/sw miss for at least 2 cycles (so the WB phase is empty
+ * and the registers do not change anymore) and the block is still not in the cache.
+ * Only the bus countdown of the MEM instruction and the counters can advance in such a step.
+ */
+bool core_is_frozen(core* cpu, instructions* instructions);
 
-// Frees the structure with the 5 instructions
-void free_instructions(instructions* instructions);
+/*
+ * Runs up to max_cycles cycles of the core at once while they only move ALU instructions through
+ * its pipeline: decode holds an ALU instruction without a hazard, MEM an ALU instruction or a stall,
+ * the store buffer is empty, the core does not hold the bus and the fetch does not reach the last
+ * imem word. Such cycles touch neither the cache nor the bus, so the core may run them ahead of
+ * the other cores. Each cycle writes its coretrace line, the stall counters are updated once.
+ * Returns the cycles it ran (0: the next cycle needs pipeline_step: a hazard, a lw/sw, a branch...).
+ */
+int pipeline_block(core* cpu, instructions* instructions, int max_cycles);
+
+/*
+ * Returns true if the other core can run the next pipeline block of the leader in lockstep with it:
+ * it can start a block (see pipeline_block), runs the same imem image and is at the same cycle and pc,
+ * and its latches hold the same instructions (their ALU results may differ).
+ */
+bool joins_pipeline_block(core* leader, instructions* leader_pipeline, core* other, instructions* other_pipeline);
+
+/*
+ * Runs the next pipeline block of the cores of a lockstep group (count of them, the leader first, see
+ * joins_pipeline_block) at once, like pipeline_block on each: the leader's latches drive the phases,
+ * the registers and the ALU results of the latches are kept by lanes (lane_registers), so EXE and WB run
+ * on all the cores with a few vector operations. Each core writes its own coretrace lines, and ends
+ * with the leader's latches and its own registers and results. Returns the cycles it ran.
+ */
+int pipeline_block_lanes(core* cores[], instructions* pipelines[], int count, int max_cycles);
+
+// Returns the block of the cache the bus address hits (NULL: a miss or no address), read before each step
+cache_block* snooped_block(core* cpu, uint32_t address);
+
+/*
+ * Performs the given number of frozen steps at once (see core_is_frozen):
+ * writes the repeated coretrace lines (inside the trace window) and updates the cycle and the stall counters.
+ * The bus countdown of the MEM instruction is advanced by the processor.
+ */
+void skip_frozen_cycles(core* cpu, int cycles);
+
+// Drops the core's reference to the imem image (the core, its cache and its stats live in its arena slot)
+void free_core(core* cpu);
 
 // turn instruction to stall
 void turn_to_stall(instruction* instruction);
@@ -213,22 +483,31 @@ void turn_to_halt(instruction* instruction);
 /*************** Create output files *******************/
 /*******************************************************/
 
-// Writes a line to the coretrace.txt file after each cycle
+// Writes a line to the coretrace.txt file after each cycle (inside the trace window)
 void write_line_to_core_trace_file(core* cpu, instructions* instructions);
 
+// Writes a coretrace line given in numbers (text, binary or to the ring of the writer thread)
+void write_core_trace_line(core* cpu, const core_trace_line* line);
+
+// Opens the coretrace file, a new one or the one of a restored checkpoint at its offset
+void open_core_trace_file(core* cpu);
+
+// Closes the coretrace file (does nothing if it is already closed)
+void close_core_trace_file(core* cpu);
+
 // Generates all the output files (Except of coretrace.txt) at once
 void create_output_files(core* cpu);
 
 // Generates the file "regout.txt"
 void create_regout_file(core* cpu);
 
-// Generates the file "stats.txt"
+// Generates the file "stats.txt" (a run that is not the default one adds its configuration, see write_config)
 void create_stats_file(core* cpu);
 
-// Generates the file dsram.txt
+// Generates the file dsram.txt (the blocks set by set, the ways of a set in order)
 void create_dsram_file(core* cpu);
 
-// Generates the file tsram.txt
+// Generates the file tsram.txt (a line per block like dsram: the MESI state above the cache_tag_bits of the tag)
 void create_tsram_file(core* cpu);
 
 // Opens a single file and returns an error if not opened.
@@ -239,8 +518,8 @@ void open_file(FILE** f, char* filename, char* c);
 /*************** Debugging functions *******************/
 /*******************************************************/
 
-// Test single core, executes all instructions in the core instruction memory
-void run_core(core* cpu, main_memory* memory);
+// Test single core, executes all instructions in the core instruction memory on its pipeline (the latches of its slot)
+void run_core(core* cpu, instructions* instructions, main_memory* memory);
 
 // create instruction as a string
 char* get_instruction_as_a_string(instruction* instr);
@@ -0,0 +1,369 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "core.h"
+#include "memory.h"
+#include "processor.h"
+#include "bus.h"
+#include "trace.h"
+#include "fanout.h"
+#include "alloc.h"
+
+#define FANOUT_LINE_SIZE 4096
+#define FANOUT_MAX_FIELDS 5 // outdir and 4 overrides
+
+
+/*******************************************************/
+/********************  Structs *************************/
+/*******************************************************/
+
+// One variant of the fan-out
+typedef struct {
+    int line_number;
+    char* outdir;
+    latency_config latency;
+    bool reorder;                  // the variant sets the round robin queue
+    int queue[MAX_NUM_OF_CORES];   // the cores in the order of the round robin queue
+} fanout_variant;
+
+
+/*******************************************************/
+/***************** Variant list Functions **************/
+/*******************************************************/
+
+// Returns a heap copy of the string
+static char* copy_string(const char* str)
+{
+    char* copy = sim_malloc(strlen(str) + 1);
+    if (!copy) {
+        perror("Failed to allocate memory for the variant list");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(copy, str);
+    return copy;
+}
+
+// Parses a comma separated list of all the core numbers (each once) into the queue of the variant
+static bool parse_queue(char* value, int num_of_cores, fanout_variant* variant)
+{
+    bool seen[MAX_NUM_OF_CORES] = { false };
+    int count = 0;
+    char* rest = NULL;
+    for (char* field = strtok_r(value, ",", &rest); field; field = strtok_r(NULL, ",", &rest)) {
+        char* end;
+        long core_num = strtol(field, &end, 10);
+        if (*end != '\0' || core_num < 0 || core_num >= num_of_cores || seen[core_num] || count == num_of_cores) {
+            return false;
+        }
+        seen[core_num] = true;
+        variant->queue[count++] = (int)core_num;
+    }
+    variant->reorder = true;
+    return count == num_of_cores;
+}
+
+// Parses a positive latency override, returns false for a bad value
+static bool parse_delay(const char* value, int min, int* delay)
+{
+    char* end;
+    long number = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || number < min || number > INT_MAX) {
+        return false;
+    }
+    *delay = (int)number;
+    return true;
+}
+
+/*
+ * Parses one line of the variant list, the latencies start from the ones of the run.
+ * Returns 1 for a variant, 0 for a blank or comment line and -1 for a bad line.
+ */
+static int parse_variant_line(char* line, int line_number, const processor* cpu, fanout_variant* variant)
+{
+    char* fields[FANOUT_MAX_FIELDS + 1];
+    char* rest = NULL;
+    int count = 0;
+    for (char* field = strtok_r(line, " \t\r\n", &rest); field && count <= FANOUT_MAX_FIELDS; field = strtok_r(NULL, " \t\r\n", &rest)) {
+        fields[count++] = field;
+    }
+    if (count == 0 || fields[0][0] == '#') {
+        return 0;
+    }
+    if (count > FANOUT_MAX_FIELDS) {
+        printf("Error: variant line %d has more than %d fields\n", line_number, FANOUT_MAX_FIELDS);
+        return -1;
+    }
+    memset(variant, 0, sizeof(fanout_variant));
+    variant->line_number = line_number;
+    variant->latency = cpu->latency;
+    for (int i = 1; i < count; i++) {
+        char* value = strchr(fields[i], '=');
+        bool ok = false;
+        if (value) {
+            *value++ = '\0';
+            if (strcmp(fields[i], "bus_delay") == 0) { ok = parse_delay(value, 2, &variant->latency.bus_delay); }
+            else if (strcmp(fields[i], "block_delay") == 0) { ok = parse_delay(value, 1, &variant->latency.block_delay); }
+            else if (strcmp(fields[i], "extra_delay") == 0) { ok = parse_delay(value, 1, &variant->latency.extra_delay); }
+            else if (strcmp(fields[i], "queue") == 0) { ok = parse_queue(value, cpu->num_of_cores, variant); }
+        }
+        if (!ok) {
+            printf("Error: variant line %d has a bad override %s (bus_delay >= 2, block_delay >= 1, extra_delay >= 1, "
+                   "queue = all the cores once)\n", line_number, fields[i]);
+            return -1;
+        }
+    }
+    variant->outdir = copy_string(fields[0]);
+    return 1;
+}
+
+// Frees the directories of the variants and the array
+static void free_variants(fanout_variant* variants, int num_of_variants)
+{
+    for (int i = 0; i < num_of_variants; i++) {
+        free(variants[i].outdir);
+    }
+    free(variants);
+}
+
+// Reads the variant list file, returns the variants and sets their number (NULL on error)
+static fanout_variant* read_variant_list(char* list_filename, const processor* cpu, int* num_of_variants)
+{
+    FILE* file = fopen(list_filename, "r");
+    if (!file) {
+        perror("Error opening the variant list");
+        return NULL;
+    }
+    int capacity = 4;
+    fanout_variant* variants = sim_malloc(capacity * sizeof(fanout_variant));
+    if (!variants) {
+        perror("Failed to allocate memory for the variant list");
+        exit(EXIT_FAILURE);
+    }
+    *num_of_variants = 0;
+    char line[FANOUT_LINE_SIZE];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        if (*num_of_variants == capacity) {
+            capacity *= 2;
+            variants = sim_realloc(variants, capacity * sizeof(fanout_variant));
+            if (!variants) {
+                perror("Failed to allocate memory for the variant list");
+                exit(EXIT_FAILURE);
+            }
+        }
+        int result = parse_variant_line(line, line_number, cpu, &variants[*num_of_variants]);
+        if (result < 0) {
+            fclose(file);
+            free_variants(variants, *num_of_variants);
+            return NULL;
+        }
+        *num_of_variants += result;
+    }
+    fclose(file);
+    if (*num_of_variants == 0) {
+        printf("Error: the variant list %s is empty\n", list_filename);
+        free(variants);
+        return NULL;
+    }
+    return variants;
+}
+
+
+/*******************************************************/
+/******************* Fan-out Functions *****************/
+/*******************************************************/
+
+// Closes an open trace file of the run and returns where the variant continues it (TRACE_NEW_FILE if it is closed)
+static long detach_trace_file(FILE** trace_file, long closed_offset)
+{
+    if (!*trace_file) {
+        return closed_offset;
+    }
+    // the parent flushed the file before the fork, closing it here writes nothing
+    long offset = ftell(*trace_file);
+    fclose(*trace_file);
+    *trace_file = NULL;
+    return offset;
+}
+
+// Copies the trace written up to the fork to the new name (the variant continues it there)
+static void copy_trace_prefix(char* old_name, const char* new_name, trace_format format)
+{
+    if (strcmp(old_name, new_name) != 0) {
+        copy_trace_file(old_name, new_name, format);
+    }
+    free(old_name);
+}
+
+// Runs one variant in the forked child: moves the outputs to its directory, applies the overrides and runs to the end
+static int run_variant(processor* cpu, main_memory* memory, fanout_variant* variant)
+{
+    trace_format format = cpu->filenames->trace_format;
+    cpu->bus.trace_offset = detach_trace_file(&cpu->bus.bustrace_file, TRACE_NEW_FILE);
+    char* bustrace = copy_string(cpu->filenames->bustrace_str);
+    char* coretraces[MAX_NUM_OF_CORES];
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        core* core = cpu->cores[i];
+        core->cold->trace_offset = detach_trace_file(&core->cold->coretrace_file, core->cold->trace_offset);
+        coretraces[i] = copy_string(core->cold->coretrace_filename);
+    }
+    set_processor_output_names(cpu, variant->outdir);
+    copy_trace_prefix(bustrace, cpu->filenames->bustrace_str, format);
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        copy_trace_prefix(coretraces[i], cpu->filenames->coretrace_str[i], format);
+    }
+
+    set_processor_latency(cpu, &variant->latency);
+    if (variant->reorder) {
+        for (int i = 0; i < cpu->num_of_cores; i++) {
+            cpu->round_robin_queue[i] = cpu->cores[variant->queue[i]];
+        }
+    }
+    cpu->pause_cycle = INT_MAX;
+    start_run(cpu);
+    run_cycles(cpu, memory);
+    return end_run(cpu, memory);
+}
+
+// Flushes the trace files of the run, so the children start from files that hold everything up to the fork
+static void flush_trace_files(processor* cpu)
+{
+    if (cpu->bus.bustrace_file) {
+        fflush(cpu->bus.bustrace_file);
+    }
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        if (cpu->cores[i]->cold->coretrace_file) {
+            fflush(cpu->cores[i]->cold->coretrace_file);
+        }
+    }
+    fflush(stdout);
+}
+
+// Forks the child of one variant, the child writes its number of cycles to cycles and exits
+static pid_t fork_variant(processor* cpu, main_memory* memory, fanout_variant* variant, int* cycles)
+{
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("Failed to fork a variant");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        *cycles = run_variant(cpu, memory, variant);
+        fflush(stdout);
+        _exit(EXIT_SUCCESS);
+    }
+    return pid;
+}
+
+// Runs the variants in child processes, up to jobs at a time. Sets the cycles of each variant (-1 if it failed)
+static void run_variants(processor* cpu, main_memory* memory, fanout_variant* variants, int num_of_variants, int jobs, int* cycles)
+{
+    pid_t* pids = sim_malloc(num_of_variants * sizeof(pid_t));
+    if (!pids) {
+        perror("Failed to allocate memory for the variant processes");
+        exit(EXIT_FAILURE);
+    }
+    int started = 0;
+    int running = 0;
+    while (started < num_of_variants || running > 0) {
+        if (started < num_of_variants && running < jobs) {
+            cycles[started] = -1;
+            pids[started] = fork_variant(cpu, memory, &variants[started], &cycles[started]);
+            started++;
+            running++;
+            continue;
+        }
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) {
+            perror("Failed to wait for a variant");
+            exit(EXIT_FAILURE);
+        }
+        running--;
+        for (int i = 0; i < started; i++) {
+            if (pids[i] == pid && !(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS)) {
+                cycles[i] = -1;
+            }
+        }
+    }
+    free(pids);
+}
+
+/*
+ * Runs the processor up to the fork cycle, then runs each variant of the list in its own child process.
+ * Prints one summary line per variant and returns the number of failed variants (-1 for a bad list).
+ */
+int run_fanout(processor* cpu, main_memory* memory, int fork_cycle, char* list_filename, int jobs)
+{
+    int num_of_variants = 0;
+    fanout_variant* variants = read_variant_list(list_filename, cpu, &num_of_variants);
+    if (!variants) {
+        free_processor(cpu);
+        return -1;
+    }
+
+    // the run up to the fork: no writer thread (a child would not have it) and the serial loop (it pauses)
+    engine_type engine = cpu->engine;
+    bool async_trace = cpu->async_trace;
+    cpu->engine = SERIAL_ENGINE;
+    cpu->async_trace = false;
+    cpu->pause_cycle = fork_cycle;
+    start_run(cpu);
+    run_cycles(cpu, memory);
+    if (finish(cpu)) {
+        printf("fanout: the run finished at cycle %d, before the fork cycle %d (its outputs are the run's own)\n", cpu->cycle, fork_cycle);
+        end_run(cpu, memory);
+        free_variants(variants, num_of_variants);
+        return 0;
+    }
+    cpu->engine = engine;
+    cpu->async_trace = async_trace;
+    printf("fanout: forking %d variants at cycle %d\n", num_of_variants, cpu->cycle);
+    flush_trace_files(cpu);
+
+    // the children write their results to pages they share with the parent
+    int* cycles = mmap(NULL, num_of_variants * sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (cycles == MAP_FAILED) {
+        perror("Failed to map the results of the variants");
+        exit(EXIT_FAILURE);
+    }
+    if (jobs <= 0) {
+        jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (jobs < 1) {
+        jobs = 1;
+    }
+    run_variants(cpu, memory, variants, num_of_variants, jobs, cycles);
+
+    // print the summary in the order of the list
+    int failed = 0;
+    printf("line  bus_delay  block_delay  extra_delay  cycles  outdir\n");
+    for (int i = 0; i < num_of_variants; i++) {
+        fanout_variant* variant = &variants[i];
+        if (cycles[i] < 0) {
+            printf("%-4d  %9d  %11d  %11d  %6s  %s\n", variant->line_number, variant->latency.bus_delay,
+                   variant->latency.block_delay, variant->latency.extra_delay, "failed", variant->outdir);
+            failed++;
+        }
+        else {
+            printf("%-4d  %9d  %11d  %11d  %6d  %s\n", variant->line_number, variant->latency.bus_delay,
+                   variant->latency.block_delay, variant->latency.extra_delay, cycles[i], variant->outdir);
+        }
+    }
+    munmap(cycles, num_of_variants * sizeof(int));
+    free_variants(variants, num_of_variants);
+    // the run keeps the traces up to the fork
+    close_bustrace_file(&cpu->bus);
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        close_core_trace_file(cpu->cores[i]);
+    }
+    free_processor(cpu);
+    return failed;
+}
@@ -0,0 +1,31 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include "memory.h"
+#include "processor.h"
+
+
+/*******************************************************/
+/******************* Variant fan-out *******************/
+/*******************************************************/
+
+/*
+ * Runs the processor up to the fork cycle, then forks one child process per variant of the list file.
+ * The children share the warmed-up processor and main memory through the copy-on-write pages of fork,
+ * each one applies its overrides and runs to the end. Each line of the list is one variant:
+ *     outdir [bus_delay=N] [block_delay=N] [extra_delay=N] [queue=i,j,...]
+ * queue is the round robin order of the cores from the fork on (all the cores, each once).
+ * Blank lines and lines that start with '#' are skipped.
+ * The run forks at the first cycle from fork_cycle on in which no core holds the bus,
+ * so the new latencies start with the next bus transaction (the variants keep the forwarding of the run).
+ * The outputs of a variant get their default names inside outdir (the directory must exist),
+ * its traces start with a copy of the traces up to the fork (the run leaves those in its own trace files).
+ * The run up to the fork uses the serial engine and no trace writer, the variants run with the engine of cpu.
+ * Up to jobs variants run at a time (jobs <= 0: one per online host core).
+ * Prints one summary line per variant and returns the number of failed variants (-1 for a bad list).
+ * Frees the processor, the caller frees the memory.
+ */
+int run_fanout(processor* cpu, main_memory* memory, int fork_cycle, char* list_filename, int jobs);
+
+
+#endif // FANOUT_H
@@ -0,0 +1,62 @@
+#ifndef FIXED_H
+#define FIXED_H
+
+
+/*******************************************************/
+/**************** Fixed configuration ******************/
+/*******************************************************/
+
+/*
+ * A fixed build (make fast) runs one configuration only. The header it is compiled with
+ * (FIXED_CONFIG, fixed_default.h unless make gets another one) sets the number of cores, the cache
+ * geometry, the latencies, the imem size, forwarding, the store buffer and tracing as constants. The hot paths
+ * (pipeline_step, the run loop, search_block) read them through the macros below, so in a fixed build
+ * the loops over the cores and the ways have constant bounds, the tag math folds to constant shifts
+ * and a feature that is off compiles out. In the generic build the macros read the run time values.
+ * A fixed build refuses to run another configuration (build_runs_config).
+ */
+
+#ifdef FIXED_CONFIG
+#include FIXED_CONFIG
+
+// a configuration written before the store buffer has none
+#ifndef FIXED_STORE_BUFFER
+#define FIXED_STORE_BUFFER 0
+#define FIXED_WRITE_ALLOCATE 1
+#endif
+
+#define FIXED_POWER_OF_2(x) ((x) > 0 && ((x) & ((x) - 1)) == 0)
+_Static_assert(FIXED_POWER_OF_2(FIXED_CACHE_SIZE) && FIXED_POWER_OF_2(FIXED_CACHE_BLOCK_SIZE) && FIXED_POWER_OF_2(FIXED_CACHE_WAYS),
+               "the cache geometry of a fixed build is made of powers of 2");
+
+#define FIXED_BLOCK_BITS __builtin_ctz(FIXED_CACHE_BLOCK_SIZE)
+#define FIXED_SET_BITS __builtin_ctz(FIXED_CACHE_SIZE / FIXED_CACHE_BLOCK_SIZE / FIXED_CACHE_WAYS)
+
+#define RUN_NUM_OF_CORES(cpu) FIXED_NUM_OF_CORES      // the cores of the processor
+#define RUN_BUS_DELAY(latency) FIXED_BUS_DELAY        // the latencies of the latency_config of the run
+#define RUN_EXTRA_DELAY(latency) FIXED_EXTRA_DELAY
+#define RUN_BLOCK_SIZE(latency) FIXED_CACHE_BLOCK_SIZE
+#define RUN_FORWARDING(latency) FIXED_FORWARDING
+#define RUN_STORE_BUFFER(latency) FIXED_STORE_BUFFER
+#define CACHE_WAYS(cache) FIXED_CACHE_WAYS            // the geometry of a Cache (or a sharer_directory)
+#define CACHE_SET_BITS(cache) FIXED_SET_BITS
+#define CACHE_BLOCK_BITS(cache) FIXED_BLOCK_BITS
+#define TRACING FIXED_TRACING                         // 0: the coretraces and the bustrace stay empty
+
+#else
+
+#define RUN_NUM_OF_CORES(cpu) ((cpu)->num_of_cores)
+#define RUN_BUS_DELAY(latency) ((latency)->bus_delay)
+#define RUN_EXTRA_DELAY(latency) ((latency)->extra_delay)
+#define RUN_BLOCK_SIZE(latency) ((latency)->cache.block_size)
+#define RUN_FORWARDING(latency) ((latency)->forwarding)
+#define RUN_STORE_BUFFER(latency) ((latency)->store_buffer)
+#define CACHE_WAYS(cache) ((cache)->ways)
+#define CACHE_SET_BITS(cache) ((cache)->set_bits)
+#define CACHE_BLOCK_BITS(cache) ((cache)->block_bits)
+#define TRACING 1
+
+#endif // FIXED_CONFIG
+
+
+#endif // FIXED_H
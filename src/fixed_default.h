@@ -0,0 +1,23 @@
+#ifndef FIXED_DEFAULT_H
+#define FIXED_DEFAULT_H
+
+/*
+ * The configuration of a fixed build (see fixed.h): the default one, 4 cores with traces.
+ * Another configuration is a copy of this file given to make: make fast FIXED_CONFIG=my_config.h
+ * The values must make a valid config (valid_config), the run checks them when it starts.
+ */
+
+#define FIXED_NUM_OF_CORES 4
+#define FIXED_CACHE_SIZE 256       // cache_size
+#define FIXED_CACHE_BLOCK_SIZE 4   // block_size
+#define FIXED_CACHE_WAYS 1         // cache_ways
+#define FIXED_BUS_DELAY 17         // bus_delay
+#define FIXED_BLOCK_DELAY 4        // block_delay
+#define FIXED_EXTRA_DELAY 4        // extra_delay
+#define FIXED_IMEM_SIZE 1024       // imem_size
+#define FIXED_FORWARDING 0         // forwarding
+#define FIXED_STORE_BUFFER 0       // store_buffer
+#define FIXED_WRITE_ALLOCATE 1     // write_allocate
+#define FIXED_TRACING 1            // 0: no coretrace and bustrace lines are written
+
+#endif // FIXED_DEFAULT_H
@@ -0,0 +1,645 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <string.h>
+#include "sram.h"
+#include "core.h"
+#include "memory.h"
+#include "processor.h"
+#include "alloc.h"
+#include "functional.h"
+
+#define ADDRESS_MASK (MAIN_MEMORY_SIZE - 1) // the 20 bit address space
+
+
+/*******************************************************/
+/****************** Functional memory ******************/
+/*******************************************************/
+
+// Writes the words of a block of the cache back to the main memory (the block holds the given address)
+static void write_block_back(main_memory* memory, const Cache* cache, cache_block* block, uint32_t address)
+{
+    int block_size = cache_block_size(cache);
+    uint32_t first = address & ADDRESS_MASK & ~(uint32_t)(block_size - 1);
+    for (int i = 0; i < block_size; i++) {
+        write_word(memory, first + i, block->data[i]);
+    }
+}
+
+/*
+ * Brings the block of the address into the cache of the core with the MESI transitions of the bus:
+ * a modified copy in another cache is flushed to memory first, the other copies become shared (BusRd)
+ * or invalid (exclusive: BusRdX), and a modified block the new one overwrites is written back.
+ */
+static void bring_block(processor* cpu, main_memory* memory, int core_index, uint32_t address, bool exclusive)
+{
+    uint64_t sharers = directory_sharers(cpu->directory, address) & ~((uint64_t)1 << core_index);
+    bool shared = (sharers != 0);
+    while (sharers) {
+        Cache* other = cpu->cores[__builtin_ctzll(sharers)]->cache;
+        sharers &= sharers - 1;
+        cache_block* copy = get_cache_block(other, address);
+        if (copy->state == MODIFIED) {
+            write_block_back(memory, other, copy, address);
+        }
+        set_block_state(other, copy, exclusive ? INVALID : SHARED);
+    }
+    Cache* cache = cpu->cores[core_index]->cache;
+    cache_block* block = get_cache_block(cache, address);
+    // a shared copy that becomes exclusive keeps its data
+    if (search_block(cache, address)) {
+        return;
+    }
+    if (block->state == MODIFIED) {
+        write_block_back(memory, cache, block, cache_block_address(cache, block));
+    }
+    int words[MAX_CACHE_BLOCK_SIZE];
+    cache_block new_block = { .data = words };
+    int block_size = cache_block_size(cache);
+    uint32_t first = address & ADDRESS_MASK & ~(uint32_t)(block_size - 1);
+    new_block.tag = cache_tag(cache, address);
+    new_block.state = exclusive ? MODIFIED : (shared ? SHARED : EXCLUSIVE);
+    for (int i = 0; i < block_size; i++) {
+        new_block.data[i] = read_word(memory, first + i);
+    }
+    insert_block(cache, address, &new_block, cpu->cycle);
+}
+
+// Returns the word at the address as the core sees it
+static int load_word(processor* cpu, main_memory* memory, int core_index, uint32_t address, bool warm_caches)
+{
+    if (!warm_caches) {
+        return read_word(memory, address);
+    }
+    Cache* cache = cpu->cores[core_index]->cache;
+    if (!search_block(cache, address)) {
+        bring_block(cpu, memory, core_index, address, false);
+    }
+    cache_block* block = get_cache_block(cache, address);
+    use_block(block, cpu->cycle);
+    return block->data[cache_block_offset(cache, address)];
+}
+
+// Stores the word at the address for the core
+static void store_word(processor* cpu, main_memory* memory, int core_index, uint32_t address, int value, bool warm_caches)
+{
+    if (!warm_caches) {
+        write_word(memory, address, value);
+        return;
+    }
+    Cache* cache = cpu->cores[core_index]->cache;
+    if (!search_block(cache, address) || get_cache_block(cache, address)->state == SHARED) {
+        bring_block(cpu, memory, core_index, address, true);
+    }
+    cache_block* block = get_cache_block(cache, address);
+    use_block(block, cpu->cycle);
+    block->data[cache_block_offset(cache, address)] = value;
+    set_block_state(cache, block, MODIFIED);
+}
+
+
+/*******************************************************/
+/******************** Lockstep groups ******************/
+/*******************************************************/
+
+// The functional run of one processor (a batch runs several of them side by side, see run_functional_batch)
+typedef struct {
+    processor* cpu;
+    main_memory* memory;
+    int next_pc[MAX_NUM_OF_CORES];
+    int block_cycles[MAX_NUM_OF_CORES]; // the cycles left of the block each core runs
+    bool stepped[MAX_NUM_OF_CORES];     // the core ran its instruction in its lockstep group in this cycle
+    int group_of[MAX_NUM_OF_CORES];     // the lockstep group of each core (-1: the core steps on its own)
+    int max_block;                      // the longest block the cores may start in this cycle
+    int skip;                           // the cycles from this one on in which all the cores are inside their blocks
+    int running_cores;
+    long instructions;
+    bool reached;                       // the run reached its switch point
+    bool running;                       // false once the run finished or handed over at its switch point
+} functional_run;
+
+// A core of a functional run
+typedef struct {
+    functional_run* run;
+    int core;
+} lockstep_member;
+
+/*
+ * Cores that run the same imem image at the same pc run in lockstep, in one processor or across the
+ * processors of a batch: the group keeps their registers in the lanes of one lane_registers file
+ * (the registers of the cores are stale meanwhile), and its basic blocks, ALU words and branches
+ * run on all the lanes at once with vector operations.
+ * The group breaks up (its registers go back to the cores) before a lw/sw, a halt, a branch
+ * that sends its members to different pcs and at the end of the run of one of its members.
+ */
+typedef struct {
+    int count;                           // 0: the group is free
+    lockstep_member members[MAX_LANES];  // the cores of the lanes
+    lane_registers lanes;
+} lockstep_group;
+
+typedef struct {
+    int num_of_groups;                  // a group has 2 cores or more, so half the cores are always enough
+    int step;                           // counts the cycles in which groups were formed
+    int seen_step[MAX_IMEM_SIZE];       // the last step a core looked for a group at the pc
+    lockstep_member seen[MAX_IMEM_SIZE];  // that core
+    lockstep_group groups[];
+} lockstep_state;
+
+// Allocates the lockstep state of a functional run of the cores (no groups)
+static lockstep_state* create_lockstep_state(int num_of_cores)
+{
+    int num_of_groups = num_of_cores / 2;
+    size_t size = sizeof(lockstep_state) + num_of_groups * sizeof(lockstep_group);
+    lockstep_state* state = sim_aligned_alloc(HOST_CACHE_LINE, (size + HOST_CACHE_LINE - 1) & ~(size_t)(HOST_CACHE_LINE - 1));
+    if (!state) {
+        perror("Failed to allocate memory for the lockstep groups");
+        exit(EXIT_FAILURE);
+    }
+    // the padding lanes of the groups start as zeros
+    memset(state, 0, size);
+    state->num_of_groups = num_of_groups;
+    return state;
+}
+
+// True if the instruction at the pc can run in a lockstep group (a lw/sw, halt or the end of the imem breaks it up)
+static bool lockstep_instruction(const imem_image* imem, int pc)
+{
+    if (pc < 0 || pc >= imem->size - 1) {
+        return false;
+    }
+    int opcode = imem->code[pc].opcode;
+    return opcode != 16 && opcode != 17 && opcode != HALT_OPCODE && opcode != STALL_OPCODE;
+}
+
+// Returns the core of the member
+static core* member_core(lockstep_member member)
+{
+    return member.run->cpu->cores[member.core];
+}
+
+// Moves the registers of the group back to its cores and frees the group
+static void break_lockstep_group(lockstep_group* group)
+{
+    for (int k = 0; k < group->count; k++) {
+        core* member = member_core(group->members[k]);
+        for (int r = 0; r < NUM_OF_REGISTERS; r++) {
+            member->registers[r] = group->lanes.registers[r][k];
+        }
+        group->members[k].run->group_of[group->members[k].core] = -1;
+    }
+    group->count = 0;
+}
+
+// Adds the core to the next lane of the group
+static void add_lockstep_member(lockstep_state* state, int g, lockstep_member member)
+{
+    lockstep_group* group = &state->groups[g];
+    int k = group->count++;
+    group->members[k] = member;
+    group->lanes.lanes = group->count;
+    member.run->group_of[member.core] = g;
+    for (int r = 0; r < NUM_OF_REGISTERS; r++) {
+        group->lanes.registers[r][k] = member_core(member)->registers[r];
+    }
+}
+
+/*
+ * Adds the core to the group of the core that found the pc first, or to a free group with that core.
+ * Returns false if that group is full (the core then leads the next group at the pc).
+ */
+static bool join_lockstep_group(lockstep_state* state, lockstep_member first, lockstep_member member)
+{
+    int g = first.run->group_of[first.core];
+    if (g >= 0 && state->groups[g].count == MAX_LANES) {
+        return false;
+    }
+    if (g < 0) {
+        g = 0;
+        while (state->groups[g].count > 0) {
+            g++;
+        }
+        add_lockstep_member(state, g, first);
+    }
+    add_lockstep_member(state, g, member);
+    return true;
+}
+
+// Groups the cores that step on their own in this cycle with the other cores at the same pc of the same image
+static void form_lockstep_groups(lockstep_state* state, functional_run runs[], int count)
+{
+    state->step++;
+    for (int r = 0; r < count; r++) {
+        functional_run* run = &runs[r];
+        for (int i = 0; run->running && i < run->cpu->num_of_cores; i++) {
+            core* core = run->cpu->cores[i];
+            if (run->group_of[i] >= 0 || core->done || run->block_cycles[i] > 0 || run->next_pc[i] != core->pc + 1
+                || !lockstep_instruction(core->imem, core->pc)) {
+                continue;
+            }
+            int pc = core->pc;
+            lockstep_member member = { run, i };
+            // the first core at the pc leads the group (cores of another image at the same pc step on their own)
+            if (state->seen_step[pc] != state->step) {
+                state->seen_step[pc] = state->step;
+                state->seen[pc] = member;
+            }
+            else if (member_core(state->seen[pc])->imem == core->imem && !join_lockstep_group(state, state->seen[pc], member)) {
+                state->seen[pc] = member;
+            }
+        }
+    }
+}
+
+/*
+ * Runs this cycle of the groups whose cores step now: their basic block or their instruction on all the lanes at once.
+ * The members end as after step_core, stepped marks them for this cycle.
+ * A group that reaches a lw/sw or halt, or a branch that parts its members, breaks up (its cores step on their own).
+ */
+static void step_lockstep_groups(lockstep_state* state)
+{
+    for (int g = 0; g < state->num_of_groups; g++) {
+        lockstep_group* group = &state->groups[g];
+        if (group->count == 0) {
+            continue;
+        }
+        lockstep_member leader = group->members[0];
+        if (leader.run->block_cycles[leader.core] > 0) {
+            continue;
+        }
+        const imem_image* imem = member_core(leader)->imem;
+        int pc = member_core(leader)->pc;
+        int next = leader.run->next_pc[leader.core];
+        if (!lockstep_instruction(imem, pc)) {
+            break_lockstep_group(group);
+            continue;
+        }
+        // the block must fit the runs of all the members
+        int max_block = imem->size;
+        for (int k = 0; k < group->count; k++) {
+            int run_max_block = group->members[k].run->max_block;
+            max_block = run_max_block < max_block ? run_max_block : max_block;
+        }
+        // a group in the delay slot of a taken branch runs the slot alone, like step_core
+        bool block = max_block > 1 && next == pc + 1;
+        int length = block ? functional_block_lanes(imem, pc, max_block, &group->lanes) : 0;
+        if (length > 0) {
+            pc += length;
+            next = pc + 1;
+        }
+        else if (functional_step_lanes(imem, &pc, &next, &group->lanes)) {
+            length = 1;
+        }
+        else {
+            break_lockstep_group(group);
+            continue;
+        }
+        for (int k = 0; k < group->count; k++) {
+            functional_run* run = group->members[k].run;
+            int i = group->members[k].core;
+            run->cpu->cores[i]->pc = pc;
+            run->cpu->cores[i]->cycle += length;
+            run->next_pc[i] = next;
+            run->block_cycles[i] = length - 1;
+            run->stepped[i] = true;
+        }
+    }
+}
+
+// Breaks up the groups of the cores of the run (their other cores step on their own)
+static void leave_lockstep_groups(lockstep_state* state, functional_run* run)
+{
+    for (int i = 0; i < run->cpu->num_of_cores; i++) {
+        if (run->group_of[i] >= 0) {
+            break_lockstep_group(&state->groups[run->group_of[i]]);
+        }
+    }
+}
+
+
+/*******************************************************/
+/***************** Fast-forward Functions **************/
+/*******************************************************/
+
+// True once the run reaches the switch point (instructions: the instructions the cores ran so far)
+static bool switch_point_reached(processor* cpu, const fast_forward_config* config, long instructions)
+{
+    switch (config->point) {
+    case SWITCH_AT_CYCLE:
+        return cpu->cycle >= config->value;
+    case SWITCH_AT_INSTRUCTIONS:
+        return instructions >= config->value;
+    case SWITCH_AT_PC:
+        for (int i = 0; i < cpu->num_of_cores; i++) {
+            if ((config->core < 0 || config->core == i) && !cpu->cores[i]->done && cpu->cores[i]->pc == config->value) {
+                return true;
+            }
+        }
+        return false;
+    }
+    return false;
+}
+
+// True if a running core has a taken branch whose delay slot did not run yet (the pipeline cannot start there)
+static bool branch_pending(processor* cpu, const int next_pc[])
+{
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        if (!cpu->cores[i]->done && next_pc[i] != cpu->cores[i]->pc + 1) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Returns the most instructions a basic block may run from this cycle on (1: no block).
+ * A block runs its instructions ahead of the other cores, so it must end before the switch point:
+ * the points in cycles and instructions bound it, a pc point may be reached by any core inside it.
+ */
+static int max_block_length(processor* cpu, const fast_forward_config* config, long instructions)
+{
+    int running = 0;
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        running += !cpu->cores[i]->done;
+    }
+    long limit = 1;
+    switch (config->point) {
+    case SWITCH_AT_CYCLE:
+        limit = config->value - cpu->cycle;
+        break;
+    case SWITCH_AT_INSTRUCTIONS:
+        // each running core adds at most one instruction a cycle
+        limit = (config->value - instructions - 1) / running + 1;
+        break;
+    case SWITCH_AT_PC:
+        break;
+    }
+    // no block is longer than the imem
+    int imem_size = cpu->latency.imem_size;
+    return limit < imem_size ? (int)limit : imem_size;
+}
+
+// Returns the cycles from this one on in which every running core only runs its block (0: a core steps now)
+static int common_block_cycles(processor* cpu, const int block_cycles[], int* running)
+{
+    int cycles = INT_MAX;
+    *running = 0;
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        if (!cpu->cores[i]->done) {
+            cycles = block_cycles[i] < cycles ? block_cycles[i] : cycles;
+            (*running)++;
+        }
+    }
+    return *running > 0 ? cycles : 0;
+}
+
+// A core that reached its halt: the halt takes its cycle and the core is done (the stats as the pipeline sets them)
+static void finish_functional_core(core* core)
+{
+    core->cycle++;
+    core->done = true;
+    core->stats->total_cycles = core->cycle;
+    core->stats->total_instructions = core->cycle - core->stats->num_of_decode_stalls;
+    core->stats->num_of_decode_stalls -= core->stats->num_of_mem_stalls;
+    close_core_trace_file(core);
+}
+
+/*
+ * Runs one instruction of the core, or starts the basic block at its pc (its cycles are counted at once,
+ * block_cycles is set to the cycles of its other instructions). Returns false if the core is done.
+ */
+static bool step_core(processor* cpu, main_memory* memory, int core_index, int* next_pc, bool warm_caches,
+                      int max_block, int* block_cycles)
+{
+    core* core = cpu->cores[core_index];
+    int length = max_block > 1 ? functional_block(core, next_pc, max_block) : 0;
+    if (length > 0) {
+        core->cycle += length;
+        *block_cycles = length - 1;
+        return true;
+    }
+    functional_access access;
+    if (!functional_step(core, next_pc, &access)) {
+        finish_functional_core(core);
+        return false;
+    }
+    if (access.type == LOAD_ACCESS) {
+        int value = load_word(cpu, memory, core_index, access.address, warm_caches);
+        // the WB phase sets $imm before it writes the loaded word (a lw writes any register)
+        core->registers[access.rd] = value;
+    }
+    else if (access.type == STORE_ACCESS) {
+        store_word(cpu, memory, core_index, access.address, access.value, warm_caches);
+    }
+    core->cycle++;
+    return true;
+}
+
+// Completes the MEM and WB phases of an instruction that left the EXE phase
+static void complete_instruction(processor* cpu, main_memory* memory, int core_index, instruction* latch, bool warm_caches)
+{
+    core* core = cpu->cores[core_index];
+    if (latch->opcode == 16) {
+        latch->ALU_result = load_word(cpu, memory, core_index, (uint32_t)latch->ALU_result, warm_caches);
+    }
+    else if (latch->opcode == 17) {
+        store_word(cpu, memory, core_index, (uint32_t)latch->ALU_result, core->registers[latch->rd], warm_caches);
+    }
+    write_back(core, latch);
+}
+
+/*
+ * Takes the core out of its pipeline: the instructions that passed the decode phase are completed
+ * (oldest first), the instruction in the decode latch is the first one the functional steps run.
+ * Returns the number of completed instructions.
+ */
+static int drain_pipeline(processor* cpu, main_memory* memory, int core_index, int* next_pc, bool warm_caches)
+{
+    core* core = cpu->cores[core_index];
+    instructions* pipeline = cpu->core_instructions[core_index];
+    instruction* in_flight[] = { pipeline->write_back, pipeline->memory, pipeline->execute };
+    int completed = 0;
+    bool halting = false;
+    write_back(core, pipeline->write_back);
+    // the buffered stores are older than the instruction in MEM
+    store_buffer* buffer = &core->cold->store_buffer;
+    for (; !store_buffer_empty(buffer); pop_store(buffer)) {
+        const buffered_store* store = oldest_store(buffer);
+        store_word(cpu, memory, core_index, store->address, store->value, warm_caches);
+    }
+    turn_to_stall(&core->store_drain);
+    core->bus_for_buffer = false;
+    complete_instruction(cpu, memory, core_index, pipeline->memory, warm_caches);
+    execute(core, pipeline->execute);
+    complete_instruction(cpu, memory, core_index, pipeline->execute, warm_caches);
+    for (int i = 0; i < (int)(sizeof(in_flight) / sizeof(in_flight[0])); i++) {
+        halting = halting || in_flight[i]->opcode == HALT_OPCODE;
+        // the cycle that moved an instruction into WB already counted it as retired (cycles - stalls)
+        completed += (i > 0 && in_flight[i]->opcode != HALT_OPCODE && in_flight[i]->opcode != STALL_OPCODE);
+        turn_to_stall(in_flight[i]);
+    }
+    // the instructions completed here take no cycle, the stalls leave them out of the retired count
+    core->stats->num_of_decode_stalls -= completed;
+    int pc = halting ? -1 : pipeline_resume_pc(core, pipeline, next_pc);
+    if (pc < 0) {
+        finish_functional_core(core);
+    }
+    else {
+        core->pc = pc;
+    }
+    return completed;
+}
+
+// Starts the functional run of the processor: its pipelines are drained into the functional state
+static void start_functional_run(functional_run* run, processor* cpu, main_memory* memory, const fast_forward_config* config)
+{
+    memset(run, 0, sizeof(functional_run));
+    run->cpu = cpu;
+    run->memory = memory;
+    run->running = true;
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        run->group_of[i] = -1;
+        if (!cpu->cores[i]->done) {
+            run->instructions += drain_pipeline(cpu, memory, i, &run->next_pc[i], config->warm_caches);
+        }
+    }
+}
+
+// Ends the functional run of the processor: the running cores get empty pipelines that start at their pcs
+static void end_functional_run(lockstep_state* state, functional_run* run)
+{
+    processor* cpu = run->cpu;
+    leave_lockstep_groups(state, run);
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        if (!cpu->cores[i]->done) {
+            restart_pipeline(cpu->cores[i], cpu->core_instructions[i], cpu->cores[i]->pc);
+        }
+    }
+    // the functional run made no bus transactions: the pipelines start with the bus idle and its last access done,
+    // otherwise the first idle cycle would write back the MODIFIED block of address 0 as if a transfer replaced it
+    cpu->bus.data_source = cpu->bus.memory_id;
+    cpu->bus.first_flush = cpu->bus.memory_id;
+    cpu->bus.address_done = true;
+    cpu->last_cycle_changed_nothing = false;
+    run->running = false;
+}
+
+// Runs one functional cycle of the processor, after its lockstep groups ran theirs
+static void run_functional_cycle(functional_run* run, const fast_forward_config* config)
+{
+    processor* cpu = run->cpu;
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        if (run->stepped[i]) {
+            // the core ran its instruction (or started its block) in its lockstep group
+            run->stepped[i] = false;
+            run->instructions++;
+        }
+        else if (run->block_cycles[i] > 0) {
+            run->block_cycles[i]--;
+            run->instructions++;
+        }
+        else if (!cpu->cores[i]->done && step_core(cpu, run->memory, i, &run->next_pc[i], config->warm_caches,
+                                                   run->max_block, &run->block_cycles[i])) {
+            run->instructions++;
+        }
+    }
+    cpu->cycle++;
+}
+
+/*
+ * Runs the processors functionally side by side, each from its current cycle up to the switch point and hands them over to their pipelines.
+ * The cores of a processor still take one instruction a cycle in turn (so the lw/sw of the cores keep their order),
+ * a core that ran a basic block in one go only counts the instructions of the block in the cycles after it.
+ * The cycles in which all the cores of all the running processors are inside their blocks pass at once,
+ * so the cores of the different processors keep meeting at the same pcs and run in lockstep groups.
+ */
+void run_functional_batch(processor* cpus[], main_memory* memories[], int count, const fast_forward_config* config, long instructions[])
+{
+    functional_run* runs = sim_malloc(count * sizeof(functional_run));
+    if (!runs) {
+        perror("Failed to allocate memory for the functional runs");
+        exit(EXIT_FAILURE);
+    }
+    int num_of_cores = 0;
+    for (int r = 0; r < count; r++) {
+        start_functional_run(&runs[r], cpus[r], memories[r], config);
+        num_of_cores += cpus[r]->num_of_cores;
+    }
+    lockstep_state* lockstep = create_lockstep_state(num_of_cores);
+    int running = count;
+    while (running > 0) {
+        // the cycles in which all the cores are inside their blocks pass at once
+        int skip = INT_MAX;
+        for (int r = 0; r < count; r++) {
+            functional_run* run = &runs[r];
+            if (!run->running) {
+                continue;
+            }
+            processor* cpu = run->cpu;
+            run->reached = run->reached || switch_point_reached(cpu, config, run->instructions);
+            if (finish(cpu) || (run->reached && !branch_pending(cpu, run->next_pc))) {
+                end_functional_run(lockstep, run);
+                running--;
+                continue;
+            }
+            run->skip = common_block_cycles(cpu, run->block_cycles, &run->running_cores);
+            skip = run->skip < skip ? run->skip : skip;
+        }
+        if (running == 0) {
+            break;
+        }
+        if (skip > 0) {
+            for (int r = 0; r < count; r++) {
+                functional_run* run = &runs[r];
+                for (int i = 0; run->running && i < run->cpu->num_of_cores; i++) {
+                    run->block_cycles[i] -= run->cpu->cores[i]->done ? 0 : skip;
+                }
+                if (run->running) {
+                    run->instructions += (long)skip * run->running_cores;
+                    run->cpu->cycle += skip;
+                }
+            }
+            continue;
+        }
+        for (int r = 0; r < count; r++) {
+            if (runs[r].running) {
+                runs[r].max_block = runs[r].reached ? 1 : max_block_length(runs[r].cpu, config, runs[r].instructions);
+            }
+        }
+        form_lockstep_groups(lockstep, runs, count);
+        step_lockstep_groups(lockstep);
+        for (int r = 0; r < count; r++) {
+            if (runs[r].running) {
+                run_functional_cycle(&runs[r], config);
+            }
+        }
+    }
+    for (int r = 0; r < count; r++) {
+        instructions[r] = runs[r].instructions;
+    }
+    free(lockstep);
+    free(runs);
+}
+
+// Runs the cores of the processor functionally up to the switch point and hands them over to the pipelines
+long run_functional(processor* cpu, main_memory* memory, const fast_forward_config* config)
+{
+    long instructions;
+    run_functional_batch(&cpu, &memory, 1, config, &instructions);
+    return instructions;
+}
+
+// Runs the fast-forward of the run (cpu->fast_forward) and hands the cores over to the detailed timing model
+void fast_forward(processor* cpu, main_memory* memory)
+{
+    long instructions = run_functional(cpu, memory, &cpu->fast_forward);
+    cpu->fast_forward.enabled = false;
+    if (finish(cpu)) {
+        printf("fast-forward: %ld instructions, the run finished at cycle %d\n", instructions, cpu->cycle);
+    }
+    else {
+        printf("fast-forward: %ld instructions, detailed timing from cycle %d\n", instructions, cpu->cycle);
+    }
+}
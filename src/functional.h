@@ -0,0 +1,47 @@
+#ifndef FUNCTIONAL_H
+#define FUNCTIONAL_H
+
+#include "memory.h"
+#include "processor.h"
+
+
+/*******************************************************/
+/***************** Functional fast-forward *************/
+/*******************************************************/
+
+/*
+ * Runs the cores functionally from the current cycle up to the switch point of the config
+ * (SWITCH_AT_INSTRUCTIONS counts the instructions of this call). Called between two cycles in which
+ * no core holds the bus: the instructions that passed the decode phase are completed first.
+ * Each step every running core executes one instruction on its registers and the memory,
+ * without pipeline latches, bus timing or trace lines (a step is one cycle).
+ * A core at a basic block of ALU instructions runs it in one go (functional_block), the cycles
+ * in which all the running cores are inside their blocks pass at once. A block never runs past
+ * a cycle or instruction switch point, a pc switch point runs instruction by instruction.
+ * Cores that load the same imem file and reach the same pc run in lockstep, their registers in the
+ * lanes of one vector register file, until a lw/sw, a halt or a branch they do not all take the same way.
+ * The loads and stores go straight to the main memory, or through the caches with the MESI
+ * transitions of the bus when warm_caches is set.
+ * At the switch point (delayed after a taken branch until its delay slot ran) every running core
+ * gets an empty pipeline that starts at its pc, and the detailed timing model continues from there.
+ * The stats count a functional instruction as one cycle, the cache hits and misses are not counted.
+ * The cores interleave one instruction at a time, so a program with a data race between the cores
+ * can end differently than under the detailed timing.
+ * Returns the number of instructions the cores ran.
+ */
+long run_functional(processor* cpu, main_memory* memory, const fast_forward_config* config);
+
+/*
+ * Runs the functional runs of several independent processors side by side (run_functional of each, with the config),
+ * instructions[i] gets the instructions processor i ran. The cycles in which all the cores of the running
+ * processors are inside their blocks pass at once, so the cores of the different processors that follow
+ * the same path through the same imem image meet at the same pcs and run in lockstep groups.
+ * The processors share nothing else: a processor whose cores part from the others continues on its own.
+ */
+void run_functional_batch(processor* cpus[], main_memory* memories[], int count, const fast_forward_config* config, long instructions[]);
+
+// Runs the fast-forward of the run (cpu->fast_forward) and prints where the detailed timing starts
+void fast_forward(processor* cpu, main_memory* memory);
+
+
+#endif // FUNCTIONAL_H
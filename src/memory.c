@@ -4,7 +4,9 @@
 #include <stdlib.h>
 #include "sram.h"
 #include "memory.h"
+#include "alloc.h"
 
+#define PRINT_BLOCK_SIZE 4  // words on a line of the debug prints
 
 
 
@@ -18,23 +20,48 @@ int string_to_int(char* str)
     return (int)strtol(str, NULL, 16); // Convert hex string to int
 }
 
+// Returns the page of the address, allocates it if it is not touched yet
+static int* touch_page(main_memory* mem, uint32_t word)
+{
+    int** page = &mem->pages[word / PAGE_SIZE];
+    if (!*page) {
+        *page = sim_calloc(PAGE_SIZE, sizeof(int));
+        if (!*page) {
+            perror("Failed to allocate memory for a main memory page");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return *page;
+}
+
+// Returns the word at the address (0 for an untouched page)
+int read_word(main_memory* mem, uint32_t address)
+{
+    uint32_t word = address & (MAIN_MEMORY_SIZE - 1);
+    int* page = mem->pages[word / PAGE_SIZE];
+    return page ? page[word % PAGE_SIZE] : 0;
+}
+
+// Writes the word at the address, allocates its page on the first nonzero write
+void write_word(main_memory* mem, uint32_t address, int value)
+{
+    uint32_t word = address & (MAIN_MEMORY_SIZE - 1);
+    if (value == 0 && !mem->pages[word / PAGE_SIZE]) {
+        return;
+    }
+    touch_page(mem, word)[word % PAGE_SIZE] = value;
+}
+
 // Initializes the main_memory array in the core structure from the file "memin.txt".
-// If the file has fewer lines than MAIN_MEMORY_SIZE, the remaining values are set to 0.
+// Only the pages that hold a nonzero word of the file are allocated, the rest of the memory reads as 0.
 main_memory* init_main_memory(char* filename) 
 {
-    // Allocate memory for the main memory structure
-    main_memory* mem = malloc(sizeof(main_memory));
+    // Allocate memory for the main memory structure (no page is touched)
+    main_memory* mem = sim_calloc(1, sizeof(main_memory));
     if (!mem) {
         perror("Failed to allocate memory for main memory");
         exit(EXIT_FAILURE);
     }
-    // Initialize all blocks
-    for (int i = 0; i < NUM_OF_BLOCKS; i++) {
-        mem->blocks[i].tag = (uint32_t)i/64;  // Ensure tag starts at 0
-        for (int j = 0; j < BLOCK_SIZE; j++) {
-            mem->blocks[i].data[j] = 0;
-        }
-    }
     // Open memory input file
     FILE* file = fopen(filename, "r");
     if (!file) {
@@ -44,28 +71,14 @@ main_memory* init_main_memory(char* filename)
     }
     char line[20];
     int line_number = 0;
-    int block_index = 0;
-    int block_offset = 0;
-    while (fgets(line, sizeof(line), file) != NULL) {
+    while (fgets(line, sizeof(line), file) != NULL && line_number < MAIN_MEMORY_SIZE) {
         line[strcspn(line, "\n")] = '\0';
         if (strlen(line) == 0) { 
             line_number++;
             continue;
         }
         uint32_t value = (uint32_t)strtol(line, NULL, 16);
-        block_index = line_number / BLOCK_SIZE;
-        block_offset = line_number % BLOCK_SIZE;
-        if (block_index < NUM_OF_BLOCKS) {
-            mem->blocks[block_index].data[block_offset] = value;
-        }
-        line_number++;
-    }
-    while (line_number < MAIN_MEMORY_SIZE) {
-        block_index = line_number / BLOCK_SIZE;
-        block_offset = line_number % BLOCK_SIZE;
-        if (block_index < NUM_OF_BLOCKS) {
-            mem->blocks[block_index].data[block_offset] = 0;
-        }
+        write_word(mem, line_number, value);
         line_number++;
     }
     fclose(file);
@@ -73,44 +86,52 @@ main_memory* init_main_memory(char* filename)
 }
 
 /*
-Returns a copy of the block from the memory array.
+Copies the block of the address from the memory array into block and returns it (no allocation).
 Adjusts to memory boundaries so that there is no overflow.
-If the array is not initialized, an empty block is returned.
 */
-memory_block* get_block(main_memory* mem, uint32_t address) 
+memory_block* get_block(main_memory* mem, uint32_t address, int block_size, memory_block* mem_block) 
 {
     if (!mem) {
         printf("Error: Memory is not initialized.\n");
         return NULL;
     }
-    memory_block* mem_block = malloc(sizeof(memory_block));
-    if (!mem_block) {
-        perror("Failed to allocate memory for memory block");
-        exit(EXIT_FAILURE);
-    }
-    int index = get_index(address);
+    uint32_t first_word = address & (MAIN_MEMORY_SIZE - 1) & ~(uint32_t)(block_size - 1);
     // Return a copy of the appropriate block
-    mem_block->tag = mem->blocks[index].tag;
-    for(int i = 0; i < BLOCK_SIZE; i++){
-        mem_block->data[i] = mem->blocks[index].data[i];
+    for(int i = 0; i < block_size; i++){
+        mem_block->data[i] = read_word(mem, first_word + i);
     }
     return mem_block;
 }
 
 
-void insert_block_to_memory(main_memory* mem, uint32_t address, memory_block new_block) 
+void insert_block_to_memory(main_memory* mem, uint32_t address, int block_size, const memory_block* new_block) 
 {
     if (!mem) {
         printf("Error: Memory pointer is NULL in write_block_to_memory.\n");
         return;
     }
-    // Compute the index in memory based on the tag
-    uint32_t index = get_index(address);
-    uint32_t tag = get_tag(address);
-    // Replace the old block with the new block
-    mem->blocks[index] = new_block;
-    // Update the tag of the new block
-    mem->blocks[index].tag = tag;
+    // Replace the old block with the new block (the tag follows from the address)
+    uint32_t first_word = address & (MAIN_MEMORY_SIZE - 1) & ~(uint32_t)(block_size - 1);
+    for (int i = 0; i < block_size; i++) {
+        write_word(mem, first_word + i, new_block->data[i]);
+    }
+}
+
+
+// Returns a new main memory with the same content (for several runs from one memin file), copies only the touched pages
+main_memory* copy_main_memory(const main_memory* source)
+{
+    main_memory* mem = sim_calloc(1, sizeof(main_memory));
+    if (!mem) {
+        perror("Failed to allocate memory for main memory");
+        exit(EXIT_FAILURE);
+    }
+    for (int p = 0; p < NUM_OF_PAGES; p++) {
+        if (source->pages[p]) {
+            memcpy(touch_page(mem, (uint32_t)p * PAGE_SIZE), source->pages[p], PAGE_SIZE * sizeof(int));
+        }
+    }
+    return mem;
 }
 
 
@@ -119,6 +140,9 @@ void free_main_memory(main_memory* memory)
     if (!memory) {
         return;
     }
+    for (int p = 0; p < NUM_OF_PAGES; p++) {
+        free(memory->pages[p]);
+    }
     // Free the main memory itself
     free(memory);
 }
@@ -135,26 +159,24 @@ void create_memout_file(main_memory* mem, char* filename)
         perror("Error opening memout file or Memory structure is NULL");
         return;
     }
-    // Find the last nonzero element in memory
+    // Find the last nonzero element in memory, only the touched pages can hold one
     int last_nonzero_index = 0;
-    for (int i = 0; i < NUM_OF_BLOCKS; i++) {
-        for (int j = 0; j < BLOCK_SIZE; j++) {
-            if (mem->blocks[i].data[j] != 0) {
-                last_nonzero_index = i * BLOCK_SIZE + j; // Store absolute index of last nonzero element
+    for (int p = NUM_OF_PAGES - 1; p >= 0 && last_nonzero_index == 0; p--) {
+        if (!mem->pages[p]) {
+            continue;
+        }
+        for (int i = PAGE_SIZE - 1; i >= 0; i--) {
+            if (mem->pages[p][i] != 0) {
+                last_nonzero_index = p * PAGE_SIZE + i; // Store absolute index of last nonzero element
+                break;
             }
         }
     }
     // Print memory contents up to the last nonzero element
-    int current_index = 0;
-    for (int i = 0; i < NUM_OF_BLOCKS; i++) {
-        for (int j = 0; j < BLOCK_SIZE; j++) {
-            // Ensure we are within valid memory bounds
-            fprintf(file, "%08X\n", mem->blocks[i].data[j]);
-            if (current_index == last_nonzero_index) {
-                fclose(file);
-                return;
-            }
-            current_index++;
+    for (int p = 0; p * PAGE_SIZE <= last_nonzero_index; p++) {
+        int* page = mem->pages[p];
+        for (int i = 0; i < PAGE_SIZE && p * PAGE_SIZE + i <= last_nonzero_index; i++) {
+            fprintf(file, "%08X\n", page ? page[i] : 0);
         }
     }
     fclose(file);
@@ -173,24 +195,31 @@ void print_memory(main_memory* mem) {
     }
     printf("Main Memory (Non-Zero Entries):\n");
     int count = 0;
-    for (int i = 0; i < NUM_OF_BLOCKS; i++) {
-        int is_non_zero_block = 0; // Flag to check if the block has non-zero data
-        for (int j = 0; j < BLOCK_SIZE; j++) {
-            if (mem->blocks[i].data[j] != 0) {
-                is_non_zero_block = 1;
-                break;
-            }
+    for (int p = 0; p < NUM_OF_PAGES; p++) {
+        int* page = mem->pages[p];
+        if (!page) {
+            continue;
         }
-        if (is_non_zero_block) {
-            printf("Block[%d]: { ", i);
-            for (int j = 0; j < BLOCK_SIZE; j++) {
-                printf("%d", mem->blocks[i].data[j]);
-                if (j < BLOCK_SIZE - 1) {
-                    printf(", ");
+        for (int i = 0; i < PAGE_SIZE; i += PRINT_BLOCK_SIZE) {
+            int is_non_zero_block = 0; // Flag to check if the block has non-zero data
+            for (int j = 0; j < PRINT_BLOCK_SIZE; j++) {
+                if (page[i + j] != 0) {
+                    is_non_zero_block = 1;
+                    break;
                 }
             }
-            printf(" } - Tag: %u\n", mem->blocks[i].tag);
-            count++;
+            if (is_non_zero_block) {
+                int block_index = (p * PAGE_SIZE + i) / PRINT_BLOCK_SIZE;
+                printf("Block[%d]: { ", block_index);
+                for (int j = 0; j < PRINT_BLOCK_SIZE; j++) {
+                    printf("%d", page[i + j]);
+                    if (j < PRINT_BLOCK_SIZE - 1) {
+                        printf(", ");
+                    }
+                }
+                printf(" } - Address: %05X\n", (unsigned)block_index * PRINT_BLOCK_SIZE);
+                count++;
+            }
         }
     }
     if (count == 0) {
@@ -200,26 +229,30 @@ void print_memory(main_memory* mem) {
 }
 
 
-// Prints the entire main_memory array in the core structure.
+// Prints the blocks of every touched page of the main_memory.
 void print_all_memory(main_memory* mem) {
     if (!mem) {
         printf("Error: Memory pointer is NULL in print_all_memory.\n");
         return;
     }
-    printf("Main Memory (All Entries):\n");
-    for (int i = 0; i < NUM_OF_BLOCKS; i++) {
-        printf("Block[%d]: { ", i);
-        for (int j = 0; j < BLOCK_SIZE; j++) {
-            printf("%d", mem->blocks[i].data[j]);
-            if (j < BLOCK_SIZE - 1) {
-                printf(", ");
+    printf("Main Memory (All Touched Pages):\n");
+    for (int p = 0; p < NUM_OF_PAGES; p++) {
+        int* page = mem->pages[p];
+        if (!page) {
+            continue;
+        }
+        for (int i = 0; i < PAGE_SIZE; i += PRINT_BLOCK_SIZE) {
+            int block_index = (p * PAGE_SIZE + i) / PRINT_BLOCK_SIZE;
+            printf("Block[%d]: { ", block_index);
+            for (int j = 0; j < PRINT_BLOCK_SIZE; j++) {
+                printf("%d", page[i + j]);
+                if (j < PRINT_BLOCK_SIZE - 1) {
+                    printf(", ");
+                }
             }
+            printf(" } - Address: %05X\n", (unsigned)block_index * PRINT_BLOCK_SIZE);
         }
-        printf(" } - Tag: %u\n", mem->blocks[i].tag);
     }
 
     printf("End of Main Memory.\n");
 }
-
-
-
@@ -12,23 +12,26 @@
 /************* Main Memory sizes setting ***************/
 /*******************************************************/
 
-#define BLOCK_SIZE 4            // 4 words in block
-//#define MAIN_MEMORY_SIZE 262144 // 2^18 (2^20/4) lines of 4 words block <= to big for prints
-#define MAIN_MEMORY_SIZE 16384
-#define NUM_OF_BLOCKS 4096 // number of blocks = 2^20/4 = 262,144
+#define MAX_BLOCK_SIZE 16       // the most words in a block the bus moves (the block size of the caches)
+#define MAIN_MEMORY_SIZE (1 << 20) // 2^20 words - the whole 20 bit address space
+#define PAGE_SIZE 1024          // words in a page (4 KB)
+#define NUM_OF_PAGES (MAIN_MEMORY_SIZE / PAGE_SIZE)
 
 /*******************************************************/
 /************** Main Memory Structs ********************/
 /*******************************************************/
 
-// Memory_block
+// Memory_block (the first block_size words of a transfer are used)
 typedef struct {
-    uint32_t tag;   
-    int data[BLOCK_SIZE];  
+    int data[MAX_BLOCK_SIZE];  
 } memory_block;
 
+/*
+ * The main memory is sparse: a page is allocated (zeroed) the first time a nonzero word is written to it,
+ * reading an untouched page returns zeros. The tag of a block is not stored, it follows from the address.
+ */
 typedef struct {
-    memory_block blocks[NUM_OF_BLOCKS];
+    int* pages[NUM_OF_PAGES];  // NULL for a page that was never written
 } main_memory;
 
 
@@ -40,18 +43,26 @@ typedef struct {
 int string_to_int(char* str);
 
 // Initializes the main_memory array in the core structure from the file "memin.txt".
-// If the file has fewer lines than MAIN_MEMORY_SIZE, the remaining values are set to 0.
+// Only the pages that hold a nonzero word of the file are allocated, the rest of the memory reads as 0.
 main_memory* init_main_memory(char* filename);
 
+// Returns the word at the address (0 for an untouched page)
+int read_word(main_memory* mem, uint32_t address);
+
+// Writes the word at the address, allocates its page on the first nonzero write
+void write_word(main_memory* mem, uint32_t address, int value);
+
 /*
-Returns a copy of the block from the memory array.
+Copies the block of block_size words of the address from the memory array into block and returns it (no allocation).
 Adjusts to memory boundaries so that there is no overflow.
-If the array is not initialized, an empty block is returned.
 */
-memory_block* get_block(main_memory* mem, uint32_t address);
+memory_block* get_block(main_memory* mem, uint32_t address, int block_size, memory_block* block);
+
+// Writes over the old block of block_size words in memory and essentially overwrites it
+void insert_block_to_memory(main_memory* mem, uint32_t address, int block_size, const memory_block* new_block);
 
-// Writes over the old block in memory and essentially overwrites it
-void insert_block_to_memory(main_memory* mem, uint32_t address, memory_block new_block);
+// Returns a new main memory with the same content (for several runs from one memin file), copies only the touched pages
+main_memory* copy_main_memory(const main_memory* source);
 
 // Frees the memory structure
 void free_main_memory(main_memory* memory);
@@ -60,6 +71,7 @@ void free_main_memory(main_memory* memory);
 /*************** Create output files *******************/
 /*******************************************************/
 
+// Writes the memory up to the last nonzero word, only the touched pages are searched for it
 void create_memout_file(main_memory* mem, char* filename);
 
 
@@ -70,7 +82,7 @@ void create_memout_file(main_memory* mem, char* filename);
 // Prints only the non-zero entries in the main_memory array in the core structure.
 void print_memory(main_memory* mem);
 
-// Prints the entire main_memory array in the core structure.
+// Prints the blocks of every touched page of the main_memory.
 void print_all_memory(main_memory* mem);
 
 
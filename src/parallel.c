@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "sram.h"
+#include "core.h"
+#include "memory.h"
+#include "processor.h"
+#include "parallel.h"
+#include "alloc.h"
+
+#define NO_ADDRESS ((uint32_t)-1) // makes pipeline_step skip its lookups of the bus block (done by the main thread)
+#define SPINS_BEFORE_YIELD 100
+
+
+/*******************************************************/
+/********************  Structs *************************/
+/*******************************************************/
+
+// Where a core is relative to the cycle the main thread is working on
+typedef enum {
+    CORE_DONE,    // the core finished before this cycle
+    CORE_AHEAD,   // the core already made its step of this cycle (no lw/sw in its MEM phase)
+    CORE_BLOCKED  // the core waits for the main thread to release this cycle (lw/sw in its MEM phase)
+} core_phase;
+
+struct parallel_engine;
+
+// A host thread that runs the pipeline of one core
+typedef struct {
+    struct parallel_engine* engine;
+    core* core;
+    instructions* pipeline;
+    pthread_t thread;
+    atomic_int completed;   // number of steps the core has made
+    atomic_int waiting_for; // the step the core waits to be released for
+    atomic_int done_step;   // the step in which the core finished (INT_MAX while running)
+    // the bus transfer as seen by the core in a released step
+    uint32_t address;
+    bool extra_delay;
+    cache_block* data_from_memory;
+} core_worker;
+
+typedef struct parallel_engine {
+    atomic_int released;    // the last step the cores with lw/sw in the MEM phase are allowed to make
+    int num_of_workers;
+    core_worker workers[MAX_NUM_OF_CORES];
+} parallel_engine;
+
+
+/*******************************************************/
+/******************* Engine Functions ******************/
+/*******************************************************/
+
+// Busy waits for a short while and then gives the host core to other threads
+static void relax(int* spins)
+{
+    if (++(*spins) > SPINS_BEFORE_YIELD) {
+        sched_yield();
+    }
+}
+
+// Returns the block of the address if it is in the cache (the lookup pipeline_step does for the run loop)
+static cache_block* lookup_block(Cache* cache, uint32_t address)
+{
+    if (address != NO_ADDRESS && search_block(cache, address)) {
+        return get_cache_block(cache, address);
+    }
+    return NULL;
+}
+
+// The loop of a core thread, makes steps until the core is done
+static void* core_worker_loop(void* arg)
+{
+    core_worker* worker = (core_worker*)arg;
+    core* cpu = worker->core;
+    while (!cpu->done) {
+        int step = cpu->cycle;
+        int opcode = worker->pipeline->memory->opcode;
+        if (opcode == 16 || opcode == 17) {
+            // lw/sw: wait for the main thread to do the bus work of this cycle
+            atomic_store(&worker->waiting_for, step);
+            int spins = 0;
+            while (atomic_load(&worker->engine->released) < step) {
+                relax(&spins);
+            }
+            // the main thread may have skipped idle cycles while the core waited
+            step = cpu->cycle;
+            pipeline_step(cpu, worker->pipeline, worker->data_from_memory, &worker->address, &worker->extra_delay);
+        }
+        else {
+            uint32_t no_address = NO_ADDRESS;
+            bool no_extra_delay = false;
+            pipeline_step(cpu, worker->pipeline, NULL, &no_address, &no_extra_delay);
+        }
+        if (cpu->done) {
+            atomic_store(&worker->done_step, step);
+        }
+        atomic_store(&worker->completed, step + 1);
+    }
+    return NULL;
+}
+
+// Waits until each core is done, ahead of the step or blocked on it
+static void wait_for_cores(parallel_engine* engine, int step, core_phase phases[])
+{
+    for (int i = 0; i < engine->num_of_workers; i++) {
+        core_worker* worker = &engine->workers[i];
+        int spins = 0;
+        while (true) {
+            if (atomic_load(&worker->done_step) < step) { phases[i] = CORE_DONE; break; }
+            if (atomic_load(&worker->completed) > step) { phases[i] = CORE_AHEAD; break; }
+            if (atomic_load(&worker->waiting_for) == step) { phases[i] = CORE_BLOCKED; break; }
+            relax(&spins);
+        }
+    }
+}
+
+/*
+ * Runs the processor with the pipeline of each core on its own host thread.
+ * For each cycle the main thread waits until every core is done, ahead of the cycle or blocked on it,
+ * does the bus work of the cycle, releases the blocked cores and finishes the cycle after their steps.
+ */
+void run_parallel(processor* cpu, main_memory* memory, bus_transfer* transfer)
+{
+    core** cores = cpu->cores;
+    instructions** pipelines = cpu->core_instructions;
+    int n = RUN_NUM_OF_CORES(cpu);
+    parallel_engine* engine = (parallel_engine*)sim_malloc(sizeof(parallel_engine));
+    if (!engine) {
+        perror("Failed to allocate memory for the parallel engine");
+        exit(EXIT_FAILURE);
+    }
+    atomic_init(&engine->released, -1);
+    engine->num_of_workers = n;
+    for (int i = 0; i < n; i++) {
+        core_worker* worker = &engine->workers[i];
+        worker->engine = engine;
+        worker->core = cores[i];
+        worker->pipeline = pipelines[i];
+        atomic_init(&worker->completed, 0);
+        atomic_init(&worker->waiting_for, -1);
+        // a core of a restored checkpoint may have finished already
+        atomic_init(&worker->done_step, cores[i]->done ? -1 : INT_MAX);
+        if (pthread_create(&worker->thread, NULL, core_worker_loop, worker) != 0) {
+            perror("Failed to create a core thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    coherence_snapshot before_cycle, after_cycle;
+    bool last_cycle_changed_nothing = cpu->last_cycle_changed_nothing;
+    core_phase phases[MAX_NUM_OF_CORES];
+    while (true) {
+        int step = cpu->cycle;
+        wait_for_cores(engine, step, phases);
+        bool all_done = true;
+        bool all_blocked = true;
+        for (int i = 0; i < n; i++) {
+            all_done = all_done && phases[i] == CORE_DONE;
+            all_blocked = all_blocked && phases[i] != CORE_AHEAD;
+        }
+        if (all_done) {
+            break;
+        }
+        // the cores are all waiting on lw/sw, the main thread can skip idle cycles for them
+        if (all_blocked && skip_idle_cycles(cpu, last_cycle_changed_nothing, transfer->extra_delay) > 0) {
+            step = cpu->cycle;
+            for (int i = 0; i < n; i++) {
+                if (phases[i] == CORE_BLOCKED) {
+                    atomic_store(&engine->workers[i].waiting_for, step);
+                }
+            }
+        }
+        take_coherence_snapshot(cpu, &before_cycle, transfer);
+        // No core is working with the bus at the moment, only a blocked core can ask for it
+        if (!bus_is_busy(cpu)) {
+            for (int i = 0; i < n; i++) {
+                cores[i]->need_the_bus = (phases[i] == CORE_BLOCKED) && core_needs_bus(cores[i], pipelines[i]);
+            }
+            grant_bus(cpu);
+        }
+        prepare_bus_transfer(cpu, memory, transfer);
+
+        // the bus owner looks up the old address before its step and the new one after it
+        int owner = -1;
+        for (int i = 0; i < n; i++) {
+            if (phases[i] == CORE_BLOCKED && cores[i]->hold_the_bus) {
+                owner = i;
+            }
+            cores[i]->address_done = -1;
+        }
+        cache_block* owner_block_before = (owner >= 0) ? lookup_block(cores[owner]->cache, transfer->address) : NULL;
+        for (int i = 0; i < n; i++) {
+            if (phases[i] == CORE_BLOCKED) {
+                core_worker* worker = &engine->workers[i];
+                worker->address = (i == owner) ? transfer->address : NO_ADDRESS;
+                worker->extra_delay = transfer->extra_delay;
+                worker->data_from_memory = transfer->data_from_memory;
+            }
+        }
+
+        // make the step of the blocked cores
+        cpu->cycle++;
+        atomic_store(&engine->released, step);
+        for (int i = 0; i < n; i++) {
+            if (phases[i] == CORE_BLOCKED) {
+                int spins = 0;
+                while (atomic_load(&engine->workers[i].completed) <= step) {
+                    relax(&spins);
+                }
+            }
+        }
+
+        // finish the cycle the way the serial engine does after the steps
+        uint32_t old_address = transfer->address;
+        if (owner >= 0) {
+            transfer->address = engine->workers[owner].address;
+            transfer->extra_delay = engine->workers[owner].extra_delay;
+        }
+        collect_address_done(cpu);
+        cache_block* blocks[MAX_NUM_OF_CORES];
+        for (int i = 0; i < n; i++) {
+            // the cores before the owner made their step before it moved the bus to the new address
+            uint32_t address = (owner >= 0 && i < owner) ? old_address : transfer->address;
+            blocks[i] = lookup_block(cores[i]->cache, address);
+            if (i == owner && !blocks[i]) {
+                blocks[i] = owner_block_before;
+            }
+            invalidate_other_copies(cpu, i, address);
+        }
+        update_cache_stats(cpu, blocks, NULL);
+        write_bus_events(cpu, memory, transfer);
+
+        take_coherence_snapshot(cpu, &after_cycle, transfer);
+        last_cycle_changed_nothing = same_coherence_snapshot(&before_cycle, &after_cycle);
+    }
+
+    for (int i = 0; i < n; i++) {
+        pthread_join(engine->workers[i].thread, NULL);
+    }
+    free(engine);
+}
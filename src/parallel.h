@@ -0,0 +1,25 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdbool.h>
+#include "core.h"
+#include "memory.h"
+#include "processor.h"
+
+
+/*******************************************************/
+/***************** Parallel engine *********************/
+/*******************************************************/
+
+/*
+ * Runs the processor with the pipeline of each core on its own host thread.
+ * A core runs ahead on its own as long as the instruction in its MEM phase is not lw/sw,
+ * such a step touches only the core itself (registers, pipeline, stats and coretrace file).
+ * A step with lw/sw in the MEM phase waits until the main thread did the bus work of that cycle
+ * (arbitration, snoops and write backs) and the main thread waits for it before it finishes the cycle,
+ * so the outputs are bit-identical to the serial engine.
+ */
+void run_parallel(processor* cpu, main_memory* memory, bus_transfer* transfer);
+
+
+#endif // PARALLEL_H
@@ -1,96 +1,191 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <limits.h>
 #include "memory.h"
 #include "core.h"
 #include "processor.h"
 #include "bus.h"
+#include "parallel.h"
+#include "trace_writer.h"
+#include "checkpoint.h"
+#include "functional.h"
+#include "sampling.h"
+#include "config.h"
+#include "alloc.h"
 
 //define DEBUG true 
 #define DEBUG false
+#define CYCLE_SKIPPING true // jump over the cycles in which the cores only wait for the bus countdown
+#define PIPELINE_BLOCKS true // the serial engine runs the ALU blocks of the pipelines at once (see pipeline_block)
 
 
 /*******************************************************/
 /*************** Processor Functions *******************/
 /*******************************************************/
 
+// The default names of the files of each core, "%d" is replaced by the core number
+#define IMEM_PATTERN "imem%d.txt"
+#define REGOUT_PATTERN "regout%d.txt"
+#define CORETRACE_PATTERN "core%dtrace.txt"
+#define DSRAM_PATTERN "dsram%d.txt"
+#define TSRAM_PATTERN "tsram%d.txt"
+#define STATS_PATTERN "stats%d.txt"
+
+// Returns a heap copy of dir/pattern with the first "%d" of the pattern replaced by the core number (dir can be NULL)
+static char* make_file_name(const char* dir, const char* pattern, int core_number)
+{
+    char number[16] = "";
+    const char* marker = (core_number >= 0) ? strstr(pattern, "%d") : NULL;
+    size_t prefix_length = marker ? (size_t)(marker - pattern) : strlen(pattern);
+    const char* suffix = marker ? marker + 2 : "";
+    if (marker) {
+        sprintf(number, "%d", core_number);
+    }
+    size_t dir_length = dir ? strlen(dir) + 1 : 0;
+    char* name = sim_malloc(dir_length + strlen(pattern) + sizeof(number));
+    if (!name) {
+        perror("Failed to allocate memory for filenames");
+        exit(EXIT_FAILURE);
+    }
+    name[0] = '\0';
+    if (dir) {
+        strcat(strcat(name, dir), "/");
+    }
+    strncat(name, pattern, prefix_length);
+    strcat(strcat(name, number), suffix);
+    return name;
+}
+
+// Replaces the name in the slot with a new one
+static void replace_file_name(char** slot, char* name)
+{
+    free(*slot);
+    *slot = name;
+}
+
 // Initializes file names to the argv[] arguments
-void set_file_names(filenames* filenames, char* argv[])
+void set_file_names(filenames* filenames, int num_of_cores, char* argv[])
 {
     if (!filenames) {
         printf("Error: filenames is NULL!\n");
         return;
     }
+    int n = num_of_cores;
+    set_default_file_names(filenames, n);
     // inputs files:
-    filenames->imem0_str = argv[1];
-    filenames->imem1_str = argv[2];
-    filenames->imem2_str = argv[3];
-    filenames->imem3_str = argv[4];
-    filenames->memin_str = argv[5];
-    filenames->memout_str = argv[6];
+    for (int i = 0; i < n; i++) {
+        replace_file_name(&filenames->imem_str[i], make_file_name(NULL, argv[1 + i], -1));
+    }
+    replace_file_name(&filenames->memin_str, make_file_name(NULL, argv[n + 1], -1));
     // outputs files:
-    filenames->regout0_str = argv[7];
-    filenames->regout1_str = argv[8];
-    filenames->regout2_str = argv[9];
-    filenames->regout3_str = argv[10];
-    filenames->core0trace_str = argv[11];
-    filenames->core1trace_str = argv[12];
-    filenames->core2trace_str = argv[13];
-    filenames->core3trace_str = argv[14];
-    filenames->bustrace_str = argv[15];
-    filenames->dsram0_str = argv[16];
-    filenames->dsram1_str = argv[17];
-    filenames->dsram2_str = argv[18];
-    filenames->dsram3_str = argv[19];
-    filenames->tsram0_str = argv[20];
-    filenames->tsram1_str = argv[21];
-    filenames->tsram2_str = argv[22];
-    filenames->tsram3_str = argv[23];
-    filenames->stats0_str = argv[24];
-    filenames->stats1_str = argv[25];
-    filenames->stats2_str = argv[26];
-    filenames->stats3_str = argv[27];
+    replace_file_name(&filenames->memout_str, make_file_name(NULL, argv[n + 2], -1));
+    for (int i = 0; i < n; i++) {
+        replace_file_name(&filenames->regout_str[i], make_file_name(NULL, argv[n + 3 + i], -1));
+        replace_file_name(&filenames->coretrace_str[i], make_file_name(NULL, argv[2 * n + 3 + i], -1));
+    }
+    replace_file_name(&filenames->bustrace_str, make_file_name(NULL, argv[3 * n + 3], -1));
+    for (int i = 0; i < n; i++) {
+        replace_file_name(&filenames->dsram_str[i], make_file_name(NULL, argv[3 * n + 4 + i], -1));
+        replace_file_name(&filenames->tsram_str[i], make_file_name(NULL, argv[4 * n + 4 + i], -1));
+        replace_file_name(&filenames->stats_str[i], make_file_name(NULL, argv[5 * n + 4 + i], -1));
+    }
 }
 
 
 // Initializes file names to the defined default values
-void set_default_file_names(filenames* filenames)
+void set_default_file_names(filenames* filenames, int num_of_cores)
 {
     if (!filenames) {
         printf("Error: filenames is NULL!\n");
         return;
     }
+    memset(filenames, 0, sizeof(*filenames));
+    filenames->num_of_cores = num_of_cores;
+    filenames->trace_format = TRACE_TEXT;
+    init_trace_filter(&filenames->trace_filter);
     // inputs files:
-    filenames->imem0_str = "imem0.txt";
-    filenames->imem1_str = "imem1.txt";
-    filenames->imem2_str = "imem2.txt";
-    filenames->imem3_str = "imem3.txt";
-    filenames->memin_str = "memin.txt";
-    filenames->memout_str = "memout.txt";
+    filenames->memin_str = make_file_name(NULL, "memin.txt", -1);
+    set_imem_file_names(filenames, IMEM_PATTERN);
     // outputs files:
-    filenames->bustrace_str = "bustrace.txt";
-    filenames->regout0_str = "regout0.txt";
-    filenames->regout1_str = "regout1.txt";
-    filenames->regout2_str = "regout2.txt";
-    filenames->regout3_str = "regout3.txt";
-    filenames->stats0_str = "stats0.txt";
-    filenames->stats1_str = "stats1.txt";
-    filenames->stats2_str = "stats2.txt";
-    filenames->stats3_str = "stats3.txt";
-    filenames->core0trace_str = "core0trace.txt";
-    filenames->core1trace_str = "core1trace.txt";
-    filenames->core2trace_str = "core2trace.txt";
-    filenames->core3trace_str = "core3trace.txt";
-    filenames->dsram0_str = "dsram0.txt";
-    filenames->dsram1_str = "dsram1.txt";
-    filenames->dsram2_str = "dsram2.txt";
-    filenames->dsram3_str = "dsram3.txt";
-    filenames->tsram0_str = "tsram0.txt";
-    filenames->tsram1_str = "tsram1.txt";
-    filenames->tsram2_str = "tsram2.txt";
-    filenames->tsram3_str = "tsram3.txt";
+    set_output_file_names(filenames, NULL);
+}
+
+
+// Names the imem file of each core by the pattern, "%d" is replaced by the core number
+void set_imem_file_names(filenames* filenames, const char* pattern)
+{
+    for (int i = 0; i < filenames->num_of_cores; i++) {
+        replace_file_name(&filenames->imem_str[i], make_file_name(NULL, pattern, i));
+    }
+}
+
+
+// Gives all the outputs their default names inside the directory (NULL for the working directory)
+void set_output_file_names(filenames* filenames, const char* dir)
+{
+    replace_file_name(&filenames->memout_str, make_file_name(dir, "memout.txt", -1));
+    replace_file_name(&filenames->bustrace_str, make_file_name(dir, "bustrace.txt", -1));
+    for (int i = 0; i < filenames->num_of_cores; i++) {
+        replace_file_name(&filenames->regout_str[i], make_file_name(dir, REGOUT_PATTERN, i));
+        replace_file_name(&filenames->coretrace_str[i], make_file_name(dir, CORETRACE_PATTERN, i));
+        replace_file_name(&filenames->dsram_str[i], make_file_name(dir, DSRAM_PATTERN, i));
+        replace_file_name(&filenames->tsram_str[i], make_file_name(dir, TSRAM_PATTERN, i));
+        replace_file_name(&filenames->stats_str[i], make_file_name(dir, STATS_PATTERN, i));
+    }
+}
+
+
+// Gives the outputs of the processor their default names inside the directory (the cores take the new names)
+void set_processor_output_names(processor* cpu, const char* dir)
+{
+    filenames* names = cpu->filenames;
+    set_output_file_names(names, dir);
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        core* core = cpu->cores[i];
+        core->cold->coretrace_filename = names->coretrace_str[i];
+        core->cold->regout_filename = names->regout_str[i];
+        core->cold->stats_filename = names->stats_str[i];
+        core->cold->dsram_filename = names->dsram_str[i];
+        core->cold->tsram_filename = names->tsram_str[i];
+    }
+}
+
+
+// Changes the bus latencies between two cycles in which no core holds the bus
+void set_processor_latency(processor* cpu, const latency_config* latency)
+{
+    if (!build_runs_config(cpu->num_of_cores, latency)) {
+        exit(EXIT_FAILURE);
+    }
+    cpu->latency = *latency;
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        set_core_latency(cpu->cores[i], cpu->core_instructions[i], latency);
+    }
+}
+
+
+// Frees the names and the filenames struct
+void free_file_names(filenames* filenames)
+{
+    if (!filenames) {
+        return;
+    }
+    free(filenames->memin_str);
+    free(filenames->memout_str);
+    free(filenames->bustrace_str);
+    for (int i = 0; i < filenames->num_of_cores; i++) {
+        free(filenames->imem_str[i]);
+        free(filenames->regout_str[i]);
+        free(filenames->coretrace_str[i]);
+        free(filenames->dsram_str[i]);
+        free(filenames->tsram_str[i]);
+        free(filenames->stats_str[i]);
+    }
+    free(filenames);
 }
 
 
@@ -101,379 +196,632 @@ void set_default_file_names(filenames* filenames)
  * - Initializes each core imem and prev_imem according to to the file instructions.
  * - Initializes each core cache and prev_cache using their respective initialization function.
  */
-processor* init_processor(filenames* filenames)
+processor* init_processor(filenames* filenames, const latency_config* latency)
 {
-    processor* cpu = malloc(sizeof(processor));
+    if (filenames->num_of_cores < 1 || filenames->num_of_cores > MAX_NUM_OF_CORES) {
+        printf("Error: the number of cores must be between 1 and %d\n", MAX_NUM_OF_CORES);
+        exit(EXIT_FAILURE);
+    }
+    processor* cpu = sim_malloc(sizeof(processor));
     if (!cpu) {
         perror("Failed to allocate memory for the processor");
         exit(EXIT_FAILURE);
     }
     cpu->filenames = filenames;
-
-    cpu->core0 = init_core(0, cpu->filenames->imem0_str, cpu->filenames->core0trace_str, cpu->filenames->regout0_str, cpu->filenames->stats0_str, cpu->filenames->dsram0_str, cpu->filenames->tsram0_str);
-    cpu->core1 = init_core(1, cpu->filenames->imem1_str, cpu->filenames->core1trace_str, cpu->filenames->regout1_str, cpu->filenames->stats1_str, cpu->filenames->dsram1_str, cpu->filenames->tsram1_str);
-    cpu->core2 = init_core(2, cpu->filenames->imem2_str, cpu->filenames->core2trace_str, cpu->filenames->regout2_str, cpu->filenames->stats2_str, cpu->filenames->dsram2_str, cpu->filenames->tsram2_str);
-    cpu->core3 = init_core(3, cpu->filenames->imem3_str, cpu->filenames->core3trace_str, cpu->filenames->regout3_str, cpu->filenames->stats3_str, cpu->filenames->dsram3_str, cpu->filenames->tsram3_str);
-    if (!cpu->core0 || !cpu->core1 || !cpu->core2 || !cpu->core3
-        || !cpu->core0->cache || !cpu->core1->cache || !cpu->core2->cache || !cpu->core3->cache) {
-        perror("Failed to allocate memory for the processor cores");
-        exit(EXIT_FAILURE);
+    cpu->num_of_cores = filenames->num_of_cores;
+    cpu->debug = DEBUG;
+    cpu->async_trace = false;
+    if (latency) {
+        cpu->latency = *latency;
     }
-    cpu->core0_instructions = create_instructions();
-    cpu->core1_instructions = create_instructions();
-    cpu->core2_instructions = create_instructions();
-    cpu->core3_instructions = create_instructions();
-    if (!cpu->core0_instructions || !cpu->core1_instructions || !cpu->core2_instructions || !cpu->core3_instructions) {
-        perror("Failed to allocate memory for the cores instructions");
+    else {
+        set_build_config(&cpu->latency);
+    }
+    if (!build_runs_config(cpu->num_of_cores, &cpu->latency)) {
         exit(EXIT_FAILURE);
     }
+    init_bus(&cpu->bus, cpu->num_of_cores);
+    cpu->directory = create_directory(&cpu->latency.cache);
+
+    cpu->core_slots = create_core_slots(cpu->num_of_cores, &cpu->latency.cache);
+    cpu->core_cold = create_core_cold(cpu->num_of_cores);
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        core_slot* slot = get_core_slot(cpu->core_slots, i, &cpu->latency.cache);
+        cpu->cores[i] = init_core(slot, &cpu->core_cold[i], i, filenames->imem_str[i], filenames->coretrace_str[i], filenames->regout_str[i],
+                                  filenames->stats_str[i], filenames->dsram_str[i], filenames->tsram_str[i], &cpu->latency,
+                                  filenames->trace_format, &filenames->trace_filter);
+        attach_directory(cpu->cores[i]->cache, cpu->directory, i);
+        cpu->core_instructions[i] = &slot->pipeline;
+        // Initializing the queue
+        cpu->round_robin_queue[i] = cpu->cores[i];
+    }
     cpu->cycle = 0;
-    // Initializing the queue
-    cpu->round_robin_queue[0] = cpu->core0;
-    cpu->round_robin_queue[1] = cpu->core1;
-    cpu->round_robin_queue[2] = cpu->core2;
-    cpu->round_robin_queue[3] = cpu->core3;
+    cpu->engine = SERIAL_ENGINE;
+    cpu->transfer.address = 0;
+    cpu->transfer.extra_delay = false;
+    cpu->transfer.data_from_memory = NULL;
+    memset(&cpu->transfer.memory_buffer, 0, sizeof(cache_block));
+    memset(cpu->transfer.memory_words, 0, sizeof(cpu->transfer.memory_words));
+    cpu->transfer.memory_buffer.data = cpu->transfer.memory_words;
+    cpu->last_cycle_changed_nothing = false;
+    memset(&cpu->checkpoint, 0, sizeof(checkpoint_config));
+    memset(&cpu->fast_forward, 0, sizeof(fast_forward_config));
+    memset(&cpu->sampling, 0, sizeof(sampling_config));
+    cpu->pause_cycle = INT_MAX;
+    cpu->trace_writer = NULL;
 
     return cpu;
 }
 
 
-// Executes the processor run
-void run(processor* cpu, main_memory* memory)
+/*******************************************************/
+/*************** Cycle phases **************************/
+/*******************************************************/
+
+// Returns true if one of the cores currently owns the bus
+bool bus_is_busy(processor* cpu)
 {
-    create_bustrace_file(cpu);
-    FILE *memout;
-    open_file(&memout, cpu->filenames->memout_str, "w");
+    for (int i = 0; i < RUN_NUM_OF_CORES(cpu); i++) {
+        if (cpu->cores[i]->hold_the_bus) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    // blocks to transfer data
-    memory_block *mem_block = NULL;
-    cache_block *data_from_memory = NULL;
-    cache_block *data_to_memory = NULL;
-    bool extra_delay = false;
-    uint32_t address = 0;
-    core* temp_core = (core*)malloc(sizeof(core));
-    if (!temp_core) {
-        printf("Memory allocation failed!\n");
-        return;
+// Returns true if the instruction in the MEM phase of the core is a lw/sw that misses the cache, or else its oldest buffered store misses
+bool core_needs_bus(core* core, instructions* instructions)
+{
+    core->bus_for_buffer = false;
+    if (mem_needs_bus(core, instructions->memory)) {
+        return true;
     }
-    if(DEBUG) { print_bus_status(cpu); }
-    while(!finish(cpu)) {
-        temp_core = NULL;
-        // No core is working with the bus at the moment
-        if (!cpu->core0->hold_the_bus && !cpu->core1->hold_the_bus && !cpu->core2->hold_the_bus && !cpu->core3->hold_the_bus)
-        {
-            // Checks if one of the cores needs the bus
-            if (cpu->core0_instructions->memory->opcode == 16 || cpu->core0_instructions->memory->opcode == 17)
-            {
-                cpu->core0->need_the_bus = !search_block(cpu->core0->cache, (uint32_t)cpu->core0_instructions->memory->ALU_result);
-            }
-            else
-            {
-                cpu->core0->need_the_bus = false;
-            }
-            if (cpu->core1_instructions->memory->opcode == 16 || cpu->core1_instructions->memory->opcode == 17)
-            {
-                cpu->core1->need_the_bus = !search_block(cpu->core1->cache, (uint32_t)cpu->core1_instructions->memory->ALU_result);
-            }
-            else
-            {
-                cpu->core1->need_the_bus = false;
-            }
-            if (cpu->core2_instructions->memory->opcode == 16 || cpu->core2_instructions->memory->opcode == 17)
-            {
-                cpu->core2->need_the_bus = !search_block(cpu->core2->cache, (uint32_t)cpu->core2_instructions->memory->ALU_result);
-            }
-            else
-            {
-                cpu->core2->need_the_bus = false;
-            }
-            if (cpu->core3_instructions->memory->opcode == 16 || cpu->core3_instructions->memory->opcode == 17)
-            {
-                cpu->core3->need_the_bus = !search_block(cpu->core3->cache, (uint32_t)cpu->core3_instructions->memory->ALU_result);
-            }
-            else
-            {
-                cpu->core3->need_the_bus = false;
-            }
+    core->bus_for_buffer = store_buffer_needs_bus(core);
+    return core->bus_for_buffer;
+}
 
-            // if at least one of the cores needs the bus
-            if(cpu->core0->need_the_bus || cpu->core1->need_the_bus || cpu->core2->need_the_bus || cpu->core3->need_the_bus){
-                // choose who will work with the bus and update the queue
-                temp_core = cpu->round_robin_queue[0];
-                if(temp_core->need_the_bus) {
-                    temp_core->hold_the_bus = true;
-                    // move the core to be the last in the queue
-                    cpu->round_robin_queue[0] = cpu->round_robin_queue[1];
-                    cpu->round_robin_queue[1] = cpu->round_robin_queue[2];
-                    cpu->round_robin_queue[2] = cpu->round_robin_queue[3];
-                    cpu->round_robin_queue[3] = temp_core;
-                }
-                else {
-                    temp_core = cpu->round_robin_queue[1];
-                    if(temp_core->need_the_bus) {
-                        temp_core->hold_the_bus = true;
-                        // move the core to be the last in the queue
-                        cpu->round_robin_queue[1] = cpu->round_robin_queue[2];
-                        cpu->round_robin_queue[2] = cpu->round_robin_queue[3];
-                        cpu->round_robin_queue[3] = temp_core;
-                    }
-                    else {
-                        temp_core = cpu->round_robin_queue[2];
-                        if(temp_core->need_the_bus) {
-                            temp_core->hold_the_bus = true;
-                            // move the core to be the last in the queue
-                            cpu->round_robin_queue[2] = cpu->round_robin_queue[3];
-                            cpu->round_robin_queue[3] = temp_core;
-                        }
-                        else{
-                            temp_core = cpu->round_robin_queue[3];
-                            if(temp_core->need_the_bus) {
-                                temp_core->hold_the_bus = true;
-                            }
-                        }
-                    }
-                }
+// Gives the bus to the first core in the round robin queue that needs it and moves that core to the end of the queue
+void grant_bus(processor* cpu)
+{
+    int n = RUN_NUM_OF_CORES(cpu);
+    for (int i = 0; i < n; i++) {
+        core* temp_core = cpu->round_robin_queue[i];
+        if (temp_core->need_the_bus) {
+            temp_core->hold_the_bus = true;
+            // move the core to be the last in the queue
+            for (int j = i; j < n - 1; j++) {
+                cpu->round_robin_queue[j] = cpu->round_robin_queue[j + 1];
             }
+            cpu->round_robin_queue[n - 1] = temp_core;
+            return;
         }
-        // check uniqe modified block in caches
-        bool about_to_be_overwritten = false;
-        uint32_t address_of_overwritten = 0;
-        uint32_t core_of_overwritten = 0;
-        int core_num = search_modified_block(cpu, address, &about_to_be_overwritten, &address_of_overwritten, &core_of_overwritten);
-        if (about_to_be_overwritten)
-        {
-            first_flush = core_of_overwritten;
-            flush_address = address_of_overwritten;
-            extra_delay = true;
-            switch (core_of_overwritten)
-            {
-            case 0:
-                data_to_memory = get_cache_block(cpu->core0->cache, address_of_overwritten);
-                break;
-            case 1:
-                data_to_memory = get_cache_block(cpu->core1->cache, address_of_overwritten);
-                break;
-            case 2:
-                data_to_memory = get_cache_block(cpu->core2->cache, address_of_overwritten);
-                break;
-            case 3:
-                data_to_memory = get_cache_block(cpu->core3->cache, address_of_overwritten);
-                break;
-            default:
-                break;
-            }
-            data_to_memory->state = EXCLUSIVE;
-            mem_block = convert_cache_block_to_mem_block(data_to_memory);
-            insert_block_to_memory(memory, address_of_overwritten, *mem_block);
+    }
+}
+
+/*
+ * Prepares the bus for the next cycle:
+ * - A modified block of the bus owner that is about to be overwritten is written back to memory (extra delay).
+ * - A modified copy of the requested block in another core is written to memory (that core is the data source).
+ * - Reads the requested block as it is in memory now.
+ */
+void prepare_bus_transfer(processor* cpu, main_memory* memory, bus_transfer* transfer)
+{
+    core** cores = cpu->cores;
+    int block_size = RUN_BLOCK_SIZE(&cpu->latency);
+    memory_block mem_block;
+    cache_block *data_to_memory = NULL;
+    // check uniqe modified block in caches
+    bool about_to_be_overwritten = false;
+    uint32_t address_of_overwritten = 0;
+    uint32_t core_of_overwritten = 0;
+    int core_num = search_modified_block(cpu, transfer->address, &about_to_be_overwritten, &address_of_overwritten, &core_of_overwritten);
+    if (about_to_be_overwritten)
+    {
+        cpu->bus.first_flush = core_of_overwritten;
+        cpu->bus.flush_address = address_of_overwritten;
+        transfer->extra_delay = true;
+        data_to_memory = get_cache_block(cores[core_of_overwritten]->cache, address_of_overwritten);
+        set_block_state(cores[core_of_overwritten]->cache, data_to_memory, EXCLUSIVE);
+        convert_cache_block_to_mem_block(data_to_memory, block_size, &mem_block);
+        insert_block_to_memory(memory, address_of_overwritten, block_size, &mem_block);
+    }
+    if (!transfer->extra_delay && core_num > 0)
+    {
+        cpu->bus.data_source = core_num - 1;
+        data_to_memory = get_cache_block(cores[core_num - 1]->cache, transfer->address);
+        set_block_state(cores[core_num - 1]->cache, data_to_memory, EXCLUSIVE);
+        convert_cache_block_to_mem_block(data_to_memory, block_size, &mem_block);
+        insert_block_to_memory(memory, transfer->address, block_size, &mem_block);
+    }
+    get_block(memory, transfer->address, block_size, &mem_block);
+    transfer->data_from_memory = convert_mem_block_to_cache_block(&mem_block, block_size, &transfer->memory_buffer);
+}
+
+// After a step of a core, a copy it marked as INVALID is invalidated in the other caches as well
+void invalidate_other_copies(processor* cpu, int core_index, uint32_t address)
+{
+    core** cores = cpu->cores;
+    if (!(search_block(cores[core_index]->cache, address) && get_cache_block(cores[core_index]->cache, address)->state == INVALID)) {
+        return;
+    }
+    // only the caches the directory lists as sharers hold the block
+    uint64_t sharers = directory_sharers(cpu->directory, address) & ~((uint64_t)1 << core_index);
+    while (sharers) {
+        int i = __builtin_ctzll(sharers);
+        sharers &= sharers - 1;
+        set_block_state(cores[i]->cache, get_cache_block(cores[i]->cache, address), INVALID);
+        directory_count_invalidation(cpu->directory);
+    }
+}
+
+/*
+ * A buffered store that missed without write-allocate (see store_word) writes its word to memory:
+ * the other copies of its block are written back if modified and invalidated, like the ones of a sw miss.
+ */
+void write_around_store(processor* cpu, main_memory* memory, int core_index)
+{
+    core* core = cpu->cores[core_index];
+    if (!core->wrote_around) {
+        return;
+    }
+    core->wrote_around = false;
+    uint32_t address = core->around.address;
+    int block_size = RUN_BLOCK_SIZE(&cpu->latency);
+    memory_block mem_block;
+    uint64_t sharers = directory_sharers(cpu->directory, address) & ~((uint64_t)1 << core_index);
+    while (sharers) {
+        int i = __builtin_ctzll(sharers);
+        sharers &= sharers - 1;
+        cache_block* copy = get_cache_block(cpu->cores[i]->cache, address);
+        if (copy->state == MODIFIED) {
+            convert_cache_block_to_mem_block(copy, block_size, &mem_block);
+            insert_block_to_memory(memory, address, block_size, &mem_block);
         }
-        if (!extra_delay && core_num > 0)
-        {
-            data_source = core_num - 1;
+        set_block_state(cpu->cores[i]->cache, copy, INVALID);
+        directory_count_invalidation(cpu->directory);
+    }
+    write_word(memory, address, core->around.value);
+}
 
-            switch (core_num)
-            {
-            case 1:
-                data_to_memory = get_cache_block(cpu->core0->cache, address);
-                break;
-            case 2:
-                data_to_memory = get_cache_block(cpu->core1->cache, address);
-                break;
-            case 3:
-                data_to_memory = get_cache_block(cpu->core2->cache, address);
-                break;
-            case 4:
-                data_to_memory = get_cache_block(cpu->core3->cache, address);
-                break;
-            default:
-                break;
-            }
-            data_to_memory->state = EXCLUSIVE;
-            mem_block = convert_cache_block_to_mem_block(data_to_memory);
-            insert_block_to_memory(memory, address, *mem_block);
+// The last core that accessed the memory in this cycle decides if the bus address is done
+void collect_address_done(processor* cpu)
+{
+    core** cores = cpu->cores;
+    for (int i = 0; i < RUN_NUM_OF_CORES(cpu); i++) {
+        if (cores[i]->address_done != -1) {
+            cpu->bus.address_done = cores[i]->address_done;
         }
-        mem_block = get_block(memory, address);
-        data_from_memory = convert_mem_block_to_cache_block(mem_block);
+    }
+}
 
-        // make one step in each core
-        cpu->cycle++;
-        cache_block *b1 = pipeline_step(cpu->core0, cpu->core0_instructions, data_from_memory, &address, &extra_delay);
-        if (search_block(cpu->core0->cache, address) && get_cache_block(cpu->core0->cache, address)->state == INVALID)
-        {
-            if (search_block(cpu->core1->cache, address))
-                get_cache_block(cpu->core1->cache, address)->state = INVALID;
-            if (search_block(cpu->core2->cache, address))
-                get_cache_block(cpu->core2->cache, address)->state = INVALID;
-            if (search_block(cpu->core3->cache, address))
-                get_cache_block(cpu->core3->cache, address)->state = INVALID;
-        }
-        cache_block *b2 = pipeline_step(cpu->core1, cpu->core1_instructions, data_from_memory, &address, &extra_delay);
-        if (search_block(cpu->core1->cache, address) && get_cache_block(cpu->core1->cache, address)->state == INVALID)
-        {
-            if (search_block(cpu->core0->cache, address))
-                get_cache_block(cpu->core0->cache, address)->state = INVALID;
-            if (search_block(cpu->core2->cache, address))
-                get_cache_block(cpu->core2->cache, address)->state = INVALID;
-            if (search_block(cpu->core3->cache, address))
-                get_cache_block(cpu->core3->cache, address)->state = INVALID;
-        }
-        cache_block *b3 = pipeline_step(cpu->core2, cpu->core2_instructions, data_from_memory, &address, &extra_delay);
-        if (search_block(cpu->core2->cache, address) && get_cache_block(cpu->core2->cache, address)->state == INVALID)
-        {
-            if (search_block(cpu->core0->cache, address))
-                get_cache_block(cpu->core0->cache, address)->state = INVALID;
-            if (search_block(cpu->core1->cache, address))
-                get_cache_block(cpu->core1->cache, address)->state = INVALID;
-            if (search_block(cpu->core3->cache, address))
-                get_cache_block(cpu->core3->cache, address)->state = INVALID;
-        }
-        cache_block *b4 = pipeline_step(cpu->core3, cpu->core3_instructions, data_from_memory, &address, &extra_delay);
-        if (search_block(cpu->core3->cache, address) && get_cache_block(cpu->core3->cache, address)->state == INVALID)
+// Writes a Flush line per word of the block to the bustrace, starting at the given cycle
+static void write_flush_to_bustrace(processor* cpu, main_memory* memory, char orig_id, uint32_t address, uint32_t cycle, bool shared)
+{
+    if (!TRACING) {
+        return;
+    }
+    int block_size = RUN_BLOCK_SIZE(&cpu->latency);
+    memory_block block;
+    get_block(memory, address, block_size, &block);
+    for (int i = 0; i < block_size; i++)
+    {
+        set_bus(&cpu->bus, orig_id, Flush, (address & ~(uint32_t)(block_size - 1)) + i, block.data[i]);
+        if (shared)
         {
-            if (search_block(cpu->core0->cache, address))
-                get_cache_block(cpu->core0->cache, address)->state = INVALID;
-            if (search_block(cpu->core1->cache, address))
-                get_cache_block(cpu->core1->cache, address)->state = INVALID;
-            if (search_block(cpu->core2->cache, address))
-                get_cache_block(cpu->core2->cache, address)->state = INVALID;
+            set_shared(&cpu->bus);
         }
-        update_cache_stats(b1, b2, b3, b4, NULL);
+        write_line_to_bustrace_file(&cpu->bus, cycle + i);
+    }
+}
 
-        if (cpu->core0->hold_the_bus && cpu->core0_instructions->memory->extra_delay == EXTRA_DELAY - 1)
-        {
-            set_bus(first_flush, Flush, (flush_address & ~0x03) + 0, get_block(memory, flush_address)->data[0]);
-            write_line_to_bustrace_file(cpu, cpu->cycle + 0);
-            set_bus(first_flush, Flush, (flush_address & ~0x03) + 1, get_block(memory, flush_address)->data[1]);
-            write_line_to_bustrace_file(cpu, cpu->cycle + 1);
-            set_bus(first_flush, Flush, (flush_address & ~0x03) + 2, get_block(memory, flush_address)->data[2]);
-            write_line_to_bustrace_file(cpu, cpu->cycle + 2);
-            set_bus(first_flush, Flush, (flush_address & ~0x03) + 3, get_block(memory, flush_address)->data[3]);
-            write_line_to_bustrace_file(cpu, cpu->cycle + 3);
-        }
-        else if (cpu->core1->hold_the_bus && cpu->core1_instructions->memory->extra_delay == EXTRA_DELAY - 1)
+/*
+ * Writes the bus transactions of the bus owner that happen in this cycle:
+ * - Flush of the modified block it is about to overwrite (first cycle of the extra delay).
+ * - BusRd/BusRdX of the requested block.
+ * - Flush of the requested block (last cycle of the block delay).
+ */
+void write_bus_events(processor* cpu, main_memory* memory, bus_transfer* transfer)
+{
+    core** cores = cpu->cores;
+    instructions** pipelines = cpu->core_instructions;
+    int n = RUN_NUM_OF_CORES(cpu);
+    for (int i = 0; i < n; i++) {
+        if (cores[i]->hold_the_bus && bus_access(cores[i], pipelines[i])->extra_delay == RUN_EXTRA_DELAY(&cpu->latency) - 1)
         {
-            set_bus(first_flush, Flush, (flush_address & ~0x03) + 0, get_block(memory, flush_address)->data[0]);
-            write_line_to_bustrace_file(cpu, cpu->cycle + 0);
-            set_bus(first_flush, Flush, (flush_address & ~0x03) + 1, get_block(memory, flush_address)->data[1]);
-            write_line_to_bustrace_file(cpu, cpu->cycle + 1);
-            set_bus(first_flush, Flush, (flush_address & ~0x03) + 2, get_block(memory, flush_address)->data[2]);
-            write_line_to_bustrace_file(cpu, cpu->cycle + 2);
-            set_bus(first_flush, Flush, (flush_address & ~0x03) + 3, get_block(memory, flush_address)->data[3]);
-            write_line_to_bustrace_file(cpu, cpu->cycle + 3);
-        }
-        else if (cpu->core2->hold_the_bus && cpu->core2_instructions->memory->extra_delay == EXTRA_DELAY - 1)
+            write_flush_to_bustrace(cpu, memory, cpu->bus.first_flush, cpu->bus.flush_address, cpu->cycle, false);
+            return;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        if (cores[i]->hold_the_bus && bus_access(cores[i], pipelines[i])->bus_delay == RUN_BUS_DELAY(&cpu->latency) - 2)
         {
-            set_bus(first_flush, Flush, (flush_address & ~0x03) + 0, get_block(memory, flush_address)->data[0]);
-            write_line_to_bustrace_file(cpu, cpu->cycle + 0);
-            set_bus(first_flush, Flush, (flush_address & ~0x03) + 1, get_block(memory, flush_address)->data[1]);
-            write_line_to_bustrace_file(cpu, cpu->cycle + 1);
-            set_bus(first_flush, Flush, (flush_address & ~0x03) + 2, get_block(memory, flush_address)->data[2]);
-            write_line_to_bustrace_file(cpu, cpu->cycle + 2);
-            set_bus(first_flush, Flush, (flush_address & ~0x03) + 3, get_block(memory, flush_address)->data[3]);
-            write_line_to_bustrace_file(cpu, cpu->cycle + 3);
-        }
-        else if (cpu->core3->hold_the_bus && cpu->core3_instructions->memory->extra_delay == EXTRA_DELAY - 1)
+            if (TRACING) {
+                set_bus(&cpu->bus, i, bus_access(cores[i], pipelines[i])->opcode == 16 ? BusRd : BusRdX, transfer->address, 0);
+                write_line_to_bustrace_file(&cpu->bus, cpu->cycle);
+            }
+            return;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        if (cores[i]->hold_the_bus && bus_access(cores[i], pipelines[i])->block_delay == 0)
         {
-            set_bus(first_flush, Flush, (flush_address & ~0x03) + 0, get_block(memory, flush_address)->data[0]);
-            write_line_to_bustrace_file(cpu, cpu->cycle + 0);
-            set_bus(first_flush, Flush, (flush_address & ~0x03) + 1, get_block(memory, flush_address)->data[1]);
-            write_line_to_bustrace_file(cpu, cpu->cycle + 1);
-            set_bus(first_flush, Flush, (flush_address & ~0x03) + 2, get_block(memory, flush_address)->data[2]);
-            write_line_to_bustrace_file(cpu, cpu->cycle + 2);
-            set_bus(first_flush, Flush, (flush_address & ~0x03) + 3, get_block(memory, flush_address)->data[3]);
-            write_line_to_bustrace_file(cpu, cpu->cycle + 3);
+            bool shared = (bus_access(cores[i], pipelines[i])->opcode == 16 && cpu->bus.data_source != cpu->bus.memory_id);
+            // the last word of the block comes in this cycle
+            write_flush_to_bustrace(cpu, memory, cpu->bus.data_source, transfer->address, cpu->cycle - (RUN_BLOCK_SIZE(&cpu->latency) - 1), shared);
+            cpu->bus.first_flush = cpu->bus.memory_id;
+            cpu->bus.data_source = cpu->bus.memory_id;
+            return;
         }
+    }
+}
 
-        else if (cpu->core0->hold_the_bus && cpu->core0_instructions->memory->bus_delay == BUS_DELAY - 2)
-        {
-            set_bus(0, cpu->core0_instructions->memory->opcode == 16 ? BusRd : BusRdX, address, 0);
-            write_line_to_bustrace_file(cpu, cpu->cycle);
+
+/*******************************************************/
+/***************** Cycle skipping **********************/
+/*******************************************************/
+
+// Records the shared state the run loop updates besides the cores
+void take_coherence_snapshot(processor* cpu, coherence_snapshot* snapshot, bus_transfer* transfer)
+{
+    // only the rows of the ways are written, the header is cleared for the compare
+    memset(snapshot, 0, offsetof(coherence_snapshot, tags));
+    snapshot->extra_delay = transfer->extra_delay;
+    snapshot->data_source = cpu->bus.data_source;
+    snapshot->first_flush = cpu->bus.first_flush;
+    snapshot->flush_address = cpu->bus.flush_address;
+    snapshot->address_done = cpu->bus.address_done;
+    snapshot->address = transfer->address;
+    // the directory keeps each way of a set of all the caches in one row
+    const Cache* cache = cpu->cores[0]->cache;
+    int first = (int)cache_set(cache, transfer->address) * CACHE_WAYS(cache);
+    snapshot->ways = CACHE_WAYS(cache);
+    snapshot->num_of_cores = RUN_NUM_OF_CORES(cpu);
+    for (int way = 0; way < CACHE_WAYS(cache); way++) {
+        memcpy(snapshot->tags[way], cpu->directory->tags[first + way], RUN_NUM_OF_CORES(cpu) * sizeof(uint32_t));
+        memcpy(snapshot->states[way], cpu->directory->states[first + way], RUN_NUM_OF_CORES(cpu) * sizeof(uint8_t));
+    }
+}
+
+// Returns true if the two snapshots of the run are the same
+bool same_coherence_snapshot(const coherence_snapshot* first, const coherence_snapshot* second)
+{
+    if (memcmp(first, second, offsetof(coherence_snapshot, tags)) != 0) {
+        return false;
+    }
+    for (int way = 0; way < CACHE_WAYS(first); way++) {
+        if (memcmp(first->tags[way], second->tags[way], RUN_NUM_OF_CORES(first) * sizeof(uint32_t)) != 0 ||
+            memcmp(first->states[way], second->states[way], RUN_NUM_OF_CORES(first) * sizeof(uint8_t)) != 0) {
+            return false;
         }
-        else if (cpu->core1->hold_the_bus && cpu->core1_instructions->memory->bus_delay == BUS_DELAY - 2)
-        {
-            set_bus(1, cpu->core1_instructions->memory->opcode == 16 ? BusRd : BusRdX, address, 0);
-            write_line_to_bustrace_file(cpu, cpu->cycle);
+    }
+    return true;
+}
+
+// Applies one cycle of the bus countdown of lw/sw, returns false if the instruction completes in this cycle
+static bool countdown_step(instruction* mem_instruction, bool extra_delay)
+{
+    if (extra_delay && mem_instruction->extra_delay > 0) { mem_instruction->extra_delay--; return true; }
+    if (mem_instruction->bus_delay > 0) { mem_instruction->bus_delay--; return true; }
+    if (mem_instruction->block_delay > 0) { mem_instruction->block_delay--; return true; }
+    return false;
+}
+
+// True if the run loop writes to the bustrace after a cycle that ends with this countdown
+static bool countdown_is_bus_event(instruction* mem_instruction, const latency_config* latency)
+{
+    return mem_instruction->extra_delay == RUN_EXTRA_DELAY(latency) - 1 || mem_instruction->bus_delay == RUN_BUS_DELAY(latency) - 2 || mem_instruction->block_delay == 0;
+}
+
+// Returns the number of cycles until the countdown of the bus owner reaches a bus event or completes
+static int cycles_until_bus_event(instruction* mem_instruction, bool extra_delay, const latency_config* latency)
+{
+    instruction countdown = *mem_instruction;
+    int cycles = 0;
+    while (countdown_step(&countdown, extra_delay) && !countdown_is_bus_event(&countdown, latency)) {
+        cycles++;
+    }
+    return cycles;
+}
+
+/*
+ * Jumps over the cycles in which nothing but the bus countdown can change.
+ * It is done only when the last cycle did not change the coherence state and every running core
+ * repeats its last step (the bus owner counts down, the others wait for the bus),
+ * the skipped cycles are still written to the core traces and counted in the stats.
+ * Returns the number of skipped cycles.
+ */
+int skip_idle_cycles(processor* cpu, bool last_cycle_changed_nothing, bool extra_delay)
+{
+    core** cores = cpu->cores;
+    instructions** pipelines = cpu->core_instructions;
+    if (!CYCLE_SKIPPING || !last_cycle_changed_nothing) {
+        return 0;
+    }
+    int owner = -1;
+    for (int i = 0; i < RUN_NUM_OF_CORES(cpu); i++) {
+        if (cores[i]->done) {
+            continue;
         }
-        else if (cpu->core2->hold_the_bus && cpu->core2_instructions->memory->bus_delay == BUS_DELAY - 2)
-        {
-            set_bus(2, cpu->core2_instructions->memory->opcode == 16 ? BusRd : BusRdX, address, 0);
-            write_line_to_bustrace_file(cpu, cpu->cycle);
+        // a core inside a block it ran ahead has the pipeline of a later cycle
+        if (cores[i]->block_cycles > 0 || !core_is_frozen(cores[i], pipelines[i])) {
+            return 0;
         }
-        else if (cpu->core3->hold_the_bus && cpu->core3_instructions->memory->bus_delay == BUS_DELAY - 2)
-        {
-            set_bus(3, cpu->core3_instructions->memory->opcode == 16 ? BusRd : BusRdX, address, 0);
-            write_line_to_bustrace_file(cpu, cpu->cycle);
+        if (cores[i]->hold_the_bus) {
+            owner = i;
+        }
+    }
+    if (owner < 0) {
+        return 0;
+    }
+    int cycles = cycles_until_bus_event(pipelines[owner]->memory, extra_delay, &cpu->latency);
+    if (cycles == 0) {
+        return 0;
+    }
+    for (int i = 0; i < cycles; i++) {
+        countdown_step(pipelines[owner]->memory, extra_delay);
+    }
+    for (int i = 0; i < RUN_NUM_OF_CORES(cpu); i++) {
+        if (!cores[i]->done) {
+            skip_frozen_cycles(cores[i], cycles);
         }
+    }
+    cpu->cycle += cycles;
+    return cycles;
+}
 
-        else if (cpu->core0->hold_the_bus && cpu->core0_instructions->memory->block_delay == 0)
-        {
-            for (int i = 0; i < 4; i++)
-            {
-                set_bus(data_source, Flush, (address & ~0x03) + i, get_block(memory, address)->data[i]);
-                if (cpu->core0_instructions->memory->opcode==16 && data_source != 4)
-                {
-                    set_shared();
-                }
-                write_line_to_bustrace_file(cpu, cpu->cycle - 3 + i);
-            }
-            first_flush = 4;
-            data_source = 4;
+
+/*******************************************************/
+/***************** Pipeline blocks *********************/
+/*******************************************************/
+
+// Returns the most cycles a pipeline block may run from this cycle on: it ends before the next checkpoint or pause
+static int max_block_cycles(processor* cpu)
+{
+    int last = cpu->pause_cycle;
+    if (cpu->checkpoint.filename && cpu->checkpoint.next_cycle < last) {
+        last = cpu->checkpoint.next_cycle;
+    }
+    // the processor already counts this cycle, the block may run up to the cycle of the stop
+    return PIPELINE_BLOCKS ? last - cpu->cycle + 1 : 0;
+}
+
+/*
+ * Runs the next pipeline block of the core, in lockstep with the later cores of the cycle that can join it
+ * (see joins_pipeline_block): they did not step in this cycle yet, so they count its first cycle on their own step.
+ * Returns the cycles of the block (0: the core cannot start one).
+ */
+static int run_pipeline_block(processor* cpu, int core_index, int max_block)
+{
+    core* members[MAX_LANES];
+    instructions* pipelines[MAX_LANES];
+    int count = 0;
+    members[count] = cpu->cores[core_index];
+    pipelines[count++] = cpu->core_instructions[core_index];
+    for (int i = core_index + 1; i < RUN_NUM_OF_CORES(cpu) && count < MAX_LANES; i++) {
+        if (cpu->cores[i]->block_cycles == 0 && joins_pipeline_block(members[0], pipelines[0], cpu->cores[i], cpu->core_instructions[i])) {
+            members[count] = cpu->cores[i];
+            pipelines[count++] = cpu->core_instructions[i];
         }
-        else if (cpu->core1->hold_the_bus && cpu->core1_instructions->memory->block_delay == 0)
-        {
-            for (int i = 0; i < 4; i++)
-            {
-                set_bus(data_source, Flush, (address & ~0x03) + i, get_block(memory, address)->data[i]);
-                if (cpu->core1_instructions->memory->opcode==16 && data_source != 4)
-                {
-                    set_shared();
-                }
-                write_line_to_bustrace_file(cpu, cpu->cycle - 3 + i);
-            }
-            first_flush = 4;
-            data_source = 4;
+    }
+    if (count == 1) {
+        int cycles = pipeline_block(members[0], pipelines[0], max_block);
+        if (cycles > 0) {
+            members[0]->block_cycles = cycles - 1;
         }
-        else if (cpu->core2->hold_the_bus && cpu->core2_instructions->memory->block_delay == 0)
-        {
-            for (int i = 0; i < 4; i++)
-            {
-                set_bus(data_source, Flush, (address & ~0x03) + i, get_block(memory, address)->data[i]);
-                if (cpu->core2_instructions->memory->opcode==16 && data_source != 4)
-                {
-                    set_shared();
-                }
-                write_line_to_bustrace_file(cpu, cpu->cycle - 3 + i);
-            }
-            first_flush = 4;
-            data_source = 4;
+        return cycles;
+    }
+    int cycles = pipeline_block_lanes(members, pipelines, count, max_block);
+    if (cycles > 0) {
+        members[0]->block_cycles = cycles - 1;
+        for (int k = 1; k < count; k++) {
+            members[k]->block_cycles = cycles;
+        }
+    }
+    return cycles;
+}
+
+/*
+ * Makes the step of the core in this cycle: a core inside a block it ran ahead only answers the snoop,
+ * a core that can start a block runs all its cycles now (see run_pipeline_block), the others make a pipeline_step.
+ * Returns the block of its cache the bus address hits, like pipeline_step.
+ */
+static cache_block* step_core(processor* cpu, int core_index, bus_transfer* transfer, int max_block)
+{
+    core* core = cpu->cores[core_index];
+    if (core->block_cycles > 0) {
+        core->block_cycles--;
+        return snooped_block(core, transfer->address);
+    }
+    if (max_block > 1 && run_pipeline_block(cpu, core_index, max_block) > 0) {
+        return snooped_block(core, transfer->address);
+    }
+    return pipeline_step(core, cpu->core_instructions[core_index], transfer->data_from_memory, &transfer->address, &transfer->extra_delay);
+}
+
+/*
+ * Jumps over the cycles in which every running core is inside a block it ran ahead and the bus is idle:
+ * like skip_idle_cycles it is done only when the last cycle did not change the coherence state,
+ * then no core needs the bus and the cycles repeat it. Returns the number of skipped cycles.
+ */
+static int skip_block_cycles(processor* cpu, bool last_cycle_changed_nothing)
+{
+    if (!last_cycle_changed_nothing || bus_is_busy(cpu)) {
+        return 0;
+    }
+    int cycles = INT_MAX;
+    for (int i = 0; i < RUN_NUM_OF_CORES(cpu); i++) {
+        if (!cpu->cores[i]->done && cpu->cores[i]->block_cycles < cycles) {
+            cycles = cpu->cores[i]->block_cycles;
         }
-        else if (cpu->core3->hold_the_bus && cpu->core3_instructions->memory->block_delay == 0)
+    }
+    if (cycles == INT_MAX || cycles == 0) {
+        return 0;
+    }
+    for (int i = 0; i < RUN_NUM_OF_CORES(cpu); i++) {
+        if (!cpu->cores[i]->done) {
+            cpu->cores[i]->block_cycles -= cycles;
+        }
+    }
+    cpu->cycle += cycles;
+    return cycles;
+}
+
+
+/*******************************************************/
+/***************** Serial engine ***********************/
+/*******************************************************/
+
+// Runs the cycles one after another, stepping the cores in core number order
+static void run_serial(processor* cpu, main_memory* memory, bus_transfer* transfer)
+{
+    core** cores = cpu->cores;
+    instructions** pipelines = cpu->core_instructions;
+    int n = RUN_NUM_OF_CORES(cpu);
+    coherence_snapshot before_cycle, after_cycle;
+    if(cpu->debug) { print_bus_status(cpu); }
+    while(!finish(cpu)) {
+        // a checkpoint is taken between two cycles
+        if (cpu->checkpoint.filename && checkpoint_if_due(cpu, memory)) {
+            break;
+        }
+        // a paused run can change its latencies and arbitration before the next bus grant
+        if (cpu->cycle >= cpu->pause_cycle && !bus_is_busy(cpu)) {
+            break;
+        }
+        skip_idle_cycles(cpu, cpu->last_cycle_changed_nothing, transfer->extra_delay);
+        if (skip_block_cycles(cpu, cpu->last_cycle_changed_nothing) > 0) {
+            continue;
+        }
+        take_coherence_snapshot(cpu, &before_cycle, transfer);
+        // No core is working with the bus at the moment
+        if (!bus_is_busy(cpu))
         {
-            for (int i = 0; i < 4; i++)
-            {
-                set_bus(data_source, Flush, (address & ~0x03) + i, get_block(memory, address)->data[i]);
-                if (cpu->core3_instructions->memory->opcode==16 && data_source != 4)
-                {
-                    set_shared();
-                }
-                write_line_to_bustrace_file(cpu, cpu->cycle - 3 + i);
+            // Checks if one of the cores needs the bus, and choose who will work with it (a core inside a block does not)
+            for (int i = 0; i < n; i++) {
+                cores[i]->need_the_bus = cores[i]->block_cycles == 0 && core_needs_bus(cores[i], pipelines[i]);
             }
-            first_flush = 4;
-            data_source = 4;
+            grant_bus(cpu);
         }
+        prepare_bus_transfer(cpu, memory, transfer);
 
-        if (DEBUG) {
+        // make one step in each core
+        cpu->cycle++;
+        cache_block* blocks[MAX_NUM_OF_CORES];
+        int max_block = max_block_cycles(cpu);
+        for (int i = 0; i < n; i++) {
+            cores[i]->address_done = -1;
+        }
+        for (int i = 0; i < n; i++) {
+            blocks[i] = step_core(cpu, i, transfer, max_block);
+            invalidate_other_copies(cpu, i, transfer->address);
+            write_around_store(cpu, memory, i);
+        }
+        collect_address_done(cpu);
+        update_cache_stats(cpu, blocks, NULL);
+        write_bus_events(cpu, memory, transfer);
+
+        take_coherence_snapshot(cpu, &after_cycle, transfer);
+        cpu->last_cycle_changed_nothing = same_coherence_snapshot(&before_cycle, &after_cycle);
+        if (cpu->debug) {
             print_bus_status(cpu);
         }
     }
-    create_memout_file(memory, cpu->filenames->memout_str);
-    close_bustrace_file();
-    create_output_files(cpu->core0);
-    create_output_files(cpu->core1);
-    create_output_files(cpu->core2);
-    create_output_files(cpu->core3);
+}
+
+
+// Hands the trace files of the cores (ring i) and the bus (the last ring) over to a writer thread
+static trace_writer* start_async_trace(processor* cpu)
+{
+    trace_format format = cpu->filenames->trace_format;
+    trace_writer* writer = create_trace_writer(cpu->num_of_cores + 1);
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        core* core = cpu->cores[i];
+        core->cold->trace_ring = attach_trace_file(writer, i, core->cold->coretrace_file, format);
+        core->cold->coretrace_file = NULL;
+        // a run restored from a checkpoint continues the trace it wrote so far
+        continue_core_trace(core->cold->trace_ring, &core->cold->trace_line, &core->cold->trace_state);
+    }
+    cpu->bus.trace_ring = attach_trace_file(writer, cpu->num_of_cores, cpu->bus.bustrace_file, format);
+    cpu->bus.bustrace_file = NULL;
+    start_trace_writer(writer);
+    return writer;
+}
+
+// Opens the trace files of the run (or continues the ones of a restored run) and starts the trace writer
+void start_run(processor* cpu)
+{
+    // the cores that finished before a restored checkpoint keep their closed coretrace
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        if (!cpu->cores[i]->done) {
+            open_core_trace_file(cpu->cores[i]);
+        }
+    }
+    create_bustrace_file(&cpu->bus, cpu->filenames->bustrace_str, cpu->filenames->trace_format, &cpu->filenames->trace_filter);
+    cpu->trace_writer = cpu->async_trace ? start_async_trace(cpu) : NULL;
+}
+
+// Runs the cycles until all the cores finish (or the run stops at a checkpoint or pauses)
+void run_cycles(processor* cpu, main_memory* memory)
+{
+    if (cpu->fast_forward.enabled) {
+        fast_forward(cpu, memory);
+    }
+    if (cpu->sampling.enabled) {
+        run_sampled(cpu, memory);
+    }
+    else {
+        run_detailed(cpu, memory);
+    }
+}
+
+// True if the engine can run the config: the store buffers drain in the serial engine only
+bool engine_runs_config(engine_type engine, const latency_config* latency)
+{
+    return engine == SERIAL_ENGINE || latency->store_buffer == 0;
+}
+
+// Runs the cycles of the detailed timing model with the engine of the run
+void run_detailed(processor* cpu, main_memory* memory)
+{
+    if (cpu->engine == PARALLEL_ENGINE) {
+        run_parallel(cpu, memory, &cpu->transfer);
+    }
+    else {
+        run_serial(cpu, memory, &cpu->transfer);
+    }
+}
+
+// Stops the trace writer, writes the outputs, closes the trace files and frees the processor. Returns the number of cycles
+int end_run(processor* cpu, main_memory* memory)
+{
+    if (cpu->trace_writer) {
+        stop_trace_writer(cpu->trace_writer);
+        cpu->trace_writer = NULL;
+    }
+    // a run that stopped at a checkpoint leaves only its traces (they continue when it is restored)
+    bool stopped = cpu->checkpoint.stopped;
+    if (!stopped) {
+        create_memout_file(memory, cpu->filenames->memout_str);
+    }
+    close_bustrace_file(&cpu->bus);
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        close_core_trace_file(cpu->cores[i]);
+        if (!stopped) {
+            create_output_files(cpu->cores[i]);
+        }
+    }
+    int cycles = cpu->cycle;
     // Ensure to free allocated memory at the end of the function
-    free_core(temp_core);
     free_processor(cpu);
+    return cycles;
+}
+
+// Executes the processor run, writes the outputs and frees the processor. Returns the number of cycles
+int run(processor* cpu, main_memory* memory)
+{
+    start_run(cpu);
+    run_cycles(cpu, memory);
+    return end_run(cpu, memory);
 }
 
 
@@ -483,12 +831,12 @@ bool finish(processor* cpu)
     if(!cpu){
         return false;
     }
-    bool b0 = (cpu->core0->done == true);
-    bool b1 = (cpu->core1->done == true);
-    bool b2 = (cpu->core2->done == true);
-    bool b3 = (cpu->core3->done == true);
-
-    return (b0 && b1 && b2 && b3);
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        if (!cpu->cores[i]->done) {
+            return false;
+        }
+    }
+    return true;
 }
 
 
@@ -498,62 +846,45 @@ void free_processor(processor* cpu)
     if (!cpu) {
         return;
     }
-    // Free instructions allocated memory
-    free_instructions(cpu->core0_instructions);
-    free_instructions(cpu->core1_instructions);
-    free_instructions(cpu->core2_instructions);
-    free_instructions(cpu->core3_instructions);
-    // Free cores allocated memory
-    free_core(cpu->core0);
-    free_core(cpu->core1);
-    free_core(cpu->core2);
-    free_core(cpu->core3);
+    for (int i = 0; i < RUN_NUM_OF_CORES(cpu); i++) {
+        free_core(cpu->cores[i]);
+    }
+    // Free the cores, their caches, stats and pipelines
+    free_core_slots(cpu->core_slots);
+    free_core_cold(cpu->core_cold);
+    free_directory(cpu->directory);
     // Free the filenames struct
-    free(cpu->filenames);
+    free_file_names(cpu->filenames);
     // Free the processor itself
     free(cpu);
 }
 
 
-// convert cache_block into mem_block
-memory_block* convert_cache_block_to_mem_block(cache_block* c_block) 
+// convert cache_block of block_size words into mem_block (fills m_block and returns it)
+memory_block* convert_cache_block_to_mem_block(cache_block* c_block, int block_size, memory_block* m_block) 
 {
     // without cache_block we have nothing to convert
     if (!c_block) {
         return NULL;
     }
-    // the memory_block is null => create one
-    memory_block* m_block = (memory_block*)malloc(sizeof(memory_block));
-    if (!m_block) {
-        printf("Memory allocation failed!\n");
-        return NULL;
-    }
-    m_block->tag = c_block->tag;
     // copy the data
-    for (int i = 0; i < BLOCK_SIZE && i < CACHE_BLOCK_SIZE; i++) {
+    for (int i = 0; i < block_size; i++) {
         m_block->data[i] = c_block->data[i];
     }
     return m_block;
 }
 
 
-// convert mem_block to cache_block
-cache_block* convert_mem_block_to_cache_block(memory_block* m_block) 
+// convert mem_block of block_size words to cache_block (fills c_block and returns it, the tag is set by its cache)
+cache_block* convert_mem_block_to_cache_block(memory_block* m_block, int block_size, cache_block* c_block) 
 {
     // without cache_block we have nothing to convert
     if (!m_block) {
         return NULL;
     }
-    // create cache clock
-    cache_block* c_block = (cache_block*)malloc(sizeof(cache_block));
-    if (!c_block) {
-        printf("Memory allocation failed!\n");
-        return NULL;
-    }
-    c_block->tag = m_block->tag;
     c_block->state = SHARED;
     // copy the data
-    for (int i = 0; i < BLOCK_SIZE && i < CACHE_BLOCK_SIZE; i++) {
+    for (int i = 0; i < block_size; i++) {
         c_block->data[i] = m_block->data[i];
     }
     return c_block;
@@ -566,45 +897,36 @@ cache_block* convert_mem_block_to_cache_block(memory_block* m_block)
 // is about to be overwritten by another core.
 int search_modified_block(processor *cpu, uint32_t address, bool *about_to_be_overwritten, uint32_t *address_of_overwritten, uint32_t *core_of_overwritten)
 {
-    if (address_done) {
+    if (cpu->bus.address_done) {
         return 0;
     }
 
     *about_to_be_overwritten = false;
-    uint32_t cache_index = get_cache_index(address);
-    if (cpu->core0->hold_the_bus && cpu->core0->cache->blocks[cache_index].state == MODIFIED)
-    {
-        *about_to_be_overwritten = true;
-        *core_of_overwritten = 0;
-        *address_of_overwritten = (cpu->core0->cache->blocks[cache_index].tag << 8) | (cache_index * CACHE_BLOCK_SIZE); //8 = INDEX_BITS + OFFSET_BITS
-    }
-    if (cpu->core1->hold_the_bus && cpu->core1->cache->blocks[cache_index].state == MODIFIED)
-    {
-        *about_to_be_overwritten = true;
-        *core_of_overwritten = 1;
-        *address_of_overwritten = (cpu->core1->cache->blocks[cache_index].tag << 8) | (cache_index * CACHE_BLOCK_SIZE); //8 = INDEX_BITS + OFFSET_BITS
-    }
-    if (cpu->core2->hold_the_bus && cpu->core2->cache->blocks[cache_index].state == MODIFIED)
-    {
-        *about_to_be_overwritten = true;
-        *core_of_overwritten = 2;
-        *address_of_overwritten = (cpu->core2->cache->blocks[cache_index].tag << 8) | (cache_index * CACHE_BLOCK_SIZE); //8 = INDEX_BITS + OFFSET_BITS
-    }
-    if (cpu->core3->hold_the_bus && cpu->core3->cache->blocks[cache_index].state == MODIFIED)
-    {
-        *about_to_be_overwritten = true;
-        *core_of_overwritten = 3;
-        *address_of_overwritten = (cpu->core3->cache->blocks[cache_index].tag << 8) | (cache_index * CACHE_BLOCK_SIZE); //8 = INDEX_BITS + OFFSET_BITS
+    uint64_t bus_holders = 0;
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        core* core = cpu->cores[i];
+        if (!core->hold_the_bus) {
+            continue;
+        }
+        bus_holders |= (uint64_t)1 << i;
+        // a store that goes around the cache replaces no block
+        if (!bus_access_allocates(core)) {
+            continue;
+        }
+        // the block the missing one replaces in its set
+        cache_block* victim = get_cache_block(core->cache, address);
+        if (victim->state == MODIFIED)
+        {
+            *about_to_be_overwritten = true;
+            *core_of_overwritten = i;
+            *address_of_overwritten = cache_block_address(core->cache, victim);
+        }
     }
 
-    if (!cpu->core0->hold_the_bus && search_block(cpu->core0->cache, address) && get_cache_block(cpu->core0->cache, address)->state == MODIFIED)
-        return 1;
-    if (!cpu->core1->hold_the_bus && search_block(cpu->core1->cache, address) && get_cache_block(cpu->core1->cache, address)->state == MODIFIED)
-        return 2;
-    if (!cpu->core2->hold_the_bus && search_block(cpu->core2->cache, address) && get_cache_block(cpu->core2->cache, address)->state == MODIFIED)
-        return 3;
-    if (!cpu->core3->hold_the_bus && search_block(cpu->core3->cache, address) && get_cache_block(cpu->core3->cache, address)->state == MODIFIED)
-        return 4;
+    // the directory lists the caches with a MODIFIED copy, the first one that does not hold the bus supplies the block
+    uint64_t owners = directory_owners(cpu->directory, address) & ~bus_holders;
+    if (owners)
+        return __builtin_ctzll(owners) + 1;
 
     return 0;
 }
@@ -612,52 +934,40 @@ int search_modified_block(processor *cpu, uint32_t address, bool *about_to_be_ov
 // The update_cache_stats function updates the cache block states across multiple cores based on the latest 
 // block information. The function ensures cache consistency between cores and updates the cache states 
 // accordingly.
-void update_cache_stats(cache_block *core0_block, cache_block *core1_block, cache_block *core2_block, cache_block *core3_block, cache_block *mem_block)
+void update_cache_stats(processor *cpu, cache_block *blocks[], cache_block *mem_block)
 {
-
-    cache_block *latest = core0_block;
-    if (core1_block && (!latest || (core1_block->cycle > latest->cycle)))
-        latest = core1_block;
-    if (core2_block && (!latest || (core2_block->cycle > latest->cycle)))
-        latest = core2_block;
-    if (core3_block && (!latest || (core3_block->cycle > latest->cycle)))
-        latest = core3_block;
+    int num_of_blocks = cpu->num_of_cores;
+
+    cache_block *latest = NULL;
+    int latest_core = 0;
+    for (int i = 0; i < num_of_blocks; i++) {
+        if (blocks[i] && (!latest || (blocks[i]->cycle > latest->cycle))) {
+            latest = blocks[i];
+            latest_core = i;
+        }
+    }
     if (!latest)
         return;
 
     if (latest->state == MODIFIED)
     {
-        if (core0_block && latest != core0_block && latest->tag == core0_block->tag)
-            core0_block->state = INVALID;
-        if (core1_block && latest != core1_block && latest->tag == core1_block->tag)
-            core1_block->state = INVALID;
-        if (core2_block && latest != core2_block && latest->tag == core2_block->tag)
-            core2_block->state = INVALID;
-        if (core3_block && latest != core3_block && latest->tag == core3_block->tag)
-            core3_block->state = INVALID;
+        for (int i = 0; i < num_of_blocks; i++) {
+            if (blocks[i] && latest != blocks[i] && latest->tag == blocks[i]->tag) {
+                if (blocks[i]->state != INVALID)
+                    directory_count_invalidation(cpu->directory);
+                set_block_state(cpu->cores[i]->cache, blocks[i], INVALID);
+            }
+        }
     }
 
     else if (latest->state != INVALID)
     {
-        if (core0_block && latest != core0_block && latest->tag == core0_block->tag)
-        {
-            core0_block->state = SHARED;
-            latest->state = SHARED;
-        }
-        if (core1_block && latest != core1_block && latest->tag == core1_block->tag)
-        {
-            core1_block->state = SHARED;
-            latest->state = SHARED;
-        }
-        if (core2_block && latest != core2_block && latest->tag == core2_block->tag)
-        {
-            core2_block->state = SHARED;
-            latest->state = SHARED;
-        }
-        if (core3_block && latest != core3_block && latest->tag == core3_block->tag)
-        {
-            core3_block->state = SHARED;
-            latest->state = SHARED;
+        for (int i = 0; i < num_of_blocks; i++) {
+            if (blocks[i] && latest != blocks[i] && latest->tag == blocks[i]->tag)
+            {
+                set_block_state(cpu->cores[i]->cache, blocks[i], SHARED);
+                set_block_state(cpu->cores[latest_core]->cache, latest, SHARED);
+            }
         }
     }
 }
@@ -668,27 +978,27 @@ void update_cache_stats(cache_block *core0_block, cache_block *core1_block, cach
 
 void print_bus_status(processor* cpu)
 {
-    char* core0_mem_inst = get_instruction_as_a_string(cpu->core0_instructions->memory);
-    char* core1_mem_inst = get_instruction_as_a_string(cpu->core1_instructions->memory);
-    char* core2_mem_inst = get_instruction_as_a_string(cpu->core2_instructions->memory);
-    char* core3_mem_inst = get_instruction_as_a_string(cpu->core3_instructions->memory);
-
     int delay = 0;
-    core* core;
-    if(cpu->core0->hold_the_bus)      {core = cpu->core0; delay = cpu->core0_instructions->memory->block_delay + cpu->core0_instructions->memory->bus_delay; }
-    else if(cpu->core1->hold_the_bus) {core = cpu->core1; delay = cpu->core1_instructions->memory->block_delay + cpu->core1_instructions->memory->bus_delay; }
-    else if(cpu->core2->hold_the_bus) {core = cpu->core2; delay = cpu->core2_instructions->memory->block_delay + cpu->core2_instructions->memory->bus_delay; }
-    else if(cpu->core3->hold_the_bus) {core = cpu->core3; delay = cpu->core3_instructions->memory->block_delay + cpu->core3_instructions->memory->bus_delay; }
-    else { core = NULL;}
+    core* core = NULL;
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        if (cpu->cores[i]->hold_the_bus) {
+            core = cpu->cores[i];
+            instruction* access = bus_access(core, cpu->core_instructions[i]);
+            delay = access->block_delay + access->bus_delay;
+            break;
+        }
+    }
     if(!core) {
         printf("cycle %d: the bus is ready and waiting for request\n", cpu->cycle);
         return;
     }else{
         printf("cycle %d: core%d hold the bus, left %d cycles on the bus\n", cpu->cycle, core->core_number, delay);
-        if(cpu->core0->need_the_bus && !cpu->core0->hold_the_bus) { printf("core0 is waiting for the bus, core0 mem_instructions: %s\n", core0_mem_inst); }
-        if(cpu->core1->need_the_bus && !cpu->core1->hold_the_bus) { printf("core1 is waiting for the bus, core1 mem_instructions: %s\n", core1_mem_inst); }
-        if(cpu->core2->need_the_bus && !cpu->core2->hold_the_bus) { printf("core2 is waiting for the bus, core2 mem_instructions: %s\n", core2_mem_inst); }
-        if(cpu->core3->need_the_bus && !cpu->core3->hold_the_bus) { printf("core3 is waiting for the bus, core3 mem_instructions: %s\n", core3_mem_inst); }
+        for (int i = 0; i < cpu->num_of_cores; i++) {
+            if (cpu->cores[i]->need_the_bus && !cpu->cores[i]->hold_the_bus) {
+                char* mem_inst = get_instruction_as_a_string(cpu->core_instructions[i]->memory);
+                printf("core%d is waiting for the bus, core%d mem_instructions: %s\n", i, i, mem_inst);
+                free(mem_inst);
+            }
+        }
     }
 }
-
@@ -9,66 +9,136 @@
 #include "sram.h"
 #include "core.h"
 #include "memory.h"
+#include "bus.h"
 
 
 /*******************************************************/
 /**************** Processor sizes setting **************/
 /*******************************************************/
 
-#define NUM_OF_CORES 4
+#define MAX_NUM_OF_CORES 64
+#ifdef FIXED_CONFIG
+#define DEFAULT_NUM_OF_CORES FIXED_NUM_OF_CORES // a fixed build runs its own cores (see fixed.h)
+#else
+#define DEFAULT_NUM_OF_CORES 4
+#endif
+#define NUM_OF_FILE_ARGUMENTS(num_of_cores) (3 + 6 * (num_of_cores)) // memin, memout, bustrace + 6 files per core
+
+// every core has a lane in the sharer directory
+_Static_assert(MAX_NUM_OF_CORES <= MAX_SHARERS, "the sharer directory tracks at most MAX_SHARERS caches");
+// every core has a lane in a lockstep group (functional.c)
+_Static_assert(MAX_NUM_OF_CORES <= MAX_LANES, "a lockstep group holds at most MAX_LANES cores");
 
 
 /*******************************************************/
 /*********************  Structs ************************/
 /*******************************************************/
 
-
+// The files of one simulation, all the names are owned by the struct (see free_file_names)
 typedef struct {
     char* sim_str;
-    char* imem0_str;
-    char* imem1_str;
-    char* imem2_str;
-    char* imem3_str;
+    int num_of_cores;
     char* memin_str;
     char* memout_str;
-    char* regout0_str;
-    char* regout1_str;
-    char* regout2_str;
-    char* regout3_str;
-    char* core0trace_str;
-    char* core1trace_str;
-    char* core2trace_str;
-    char* core3trace_str;
     char* bustrace_str;
-    char* dsram0_str;
-    char* dsram1_str;
-    char* dsram2_str;
-    char* dsram3_str;
-    char* tsram0_str;
-    char* tsram1_str;
-    char* tsram2_str;
-    char* tsram3_str;
-    char* stats0_str;
-    char* stats1_str;
-    char* stats2_str;
-    char* stats3_str;
-
+    char* imem_str[MAX_NUM_OF_CORES];
+    char* regout_str[MAX_NUM_OF_CORES];
+    char* coretrace_str[MAX_NUM_OF_CORES];
+    char* dsram_str[MAX_NUM_OF_CORES];
+    char* tsram_str[MAX_NUM_OF_CORES];
+    char* stats_str[MAX_NUM_OF_CORES];
+    trace_format trace_format;  // binary traces get TRACE_BINARY_SUFFIX after their names
+    trace_filter trace_filter;  // the cycles, cores and bus lines that are traced
 } filenames;
 
 
-// Core structures
+// The cycle engines that can run the processor
+typedef enum {
+    SERIAL_ENGINE,   // steps the cores one after another on the main thread
+    PARALLEL_ENGINE  // steps each core on its own host thread (same outputs as the serial engine)
+} engine_type;
+
+// The transfer the bus is working on, shared by the run loop and the pipelines of the cores
+typedef struct {
+    uint32_t address;              // the address of the block on the bus
+    bool extra_delay;              // the bus owner first writes back a modified block that is about to be overwritten
+    cache_block* data_from_memory; // the block as it is in the main memory in this cycle (points to memory_buffer)
+    cache_block memory_buffer;     // the storage of data_from_memory, refilled every cycle (no allocation)
+    int memory_words[MAX_CACHE_BLOCK_SIZE]; // the words of memory_buffer
+} bus_transfer;
+
+// When the run saves its state to a checkpoint file (see checkpoint.h)
+typedef struct {
+    char* filename;   // NULL: no checkpoints
+    int every;        // a checkpoint each time the cycle reaches a multiple of every
+    int next_cycle;   // the cycle of the next checkpoint
+    bool stop;        // end the run at the first checkpoint (the outputs besides the traces are not written)
+    bool stopped;     // the run ended at a checkpoint
+} checkpoint_config;
+
+// Where a functional fast-forward hands the run over to the detailed timing model (see functional.h)
+typedef enum {
+    SWITCH_AT_CYCLE,         // the cycle reaches value
+    SWITCH_AT_INSTRUCTIONS,  // the cores ran value instructions together
+    SWITCH_AT_PC             // the pc of the core (any core if core is -1) reaches value
+} switch_point;
+
+typedef struct {
+    bool enabled;       // the run starts with a fast-forward
+    switch_point point;
+    long value;
+    int core;
+    bool warm_caches;   // the loads and stores go through the caches (MESI), so they are warm at the switch
+} fast_forward_config;
+
+// The intervals of a sampled run (see sampling.h)
+typedef struct {
+    bool enabled;
+    long period;   // the instructions (all the cores) run functionally between two samples
+    int warmup;    // the detailed cycles before each sample, not measured
+    int length;    // the detailed cycles of each sample
+} sampling_config;
+
+// The shared state the run loop updates besides the cores, used to detect a cycle that changed nothing
+typedef struct {
+    bool extra_delay;
+    char data_source;
+    char first_flush;
+    uint32_t flush_address;
+    bool address_done;
+    uint32_t address;
+    int ways;                          // the rows below that hold the snapshot (the rest is not written)
+    int num_of_cores;
+    uint32_t tags[MAX_CACHE_WAYS][MAX_NUM_OF_CORES];   // the directory rows of the set of the bus address
+    uint8_t states[MAX_CACHE_WAYS][MAX_NUM_OF_CORES];
+} coherence_snapshot;
+
+/*
+ * Core structures - the context of one simulation.
+ * All the simulator state lives here (no globals), so a process can run several simulations at once.
+ */
 typedef struct {
     int cycle;
-    core* core0;
-    core* core1;
-    core* core2;
-    core* core3;
-    core* round_robin_queue [NUM_OF_CORES];
-    instructions* core0_instructions;
-    instructions* core1_instructions;
-    instructions* core2_instructions;
-    instructions* core3_instructions;
+    engine_type engine;
+    bool debug;              // print the bus status each cycle
+    bool async_trace;        // a writer thread formats and writes the core and bus traces (trace_writer.h)
+    latency_config latency;  // the configuration of this simulation (latencies, forwarding, caches and imem)
+    bus_state bus;           // the bus lines and the bustrace file
+    int num_of_cores;
+    core_slot* core_slots;   // the arena of the cores (cores[i] and core_instructions[i] live in slot i)
+    core_cold* core_cold;    // the cold states of the cores (cores[i]->cold is core_cold + i)
+    core* cores[MAX_NUM_OF_CORES];
+    core* round_robin_queue[MAX_NUM_OF_CORES];
+    instructions* core_instructions[MAX_NUM_OF_CORES];
+    sharer_directory* directory; // the caches that hold each block (bit i = core i)
     filenames* filenames;
+    bus_transfer transfer;           // the transfer the bus is working on
+    bool last_cycle_changed_nothing; // the last cycle did not change the coherence state (cycle skipping)
+    checkpoint_config checkpoint;
+    fast_forward_config fast_forward;
+    sampling_config sampling;
+    int pause_cycle;                 // the serial loop returns at the first cycle from here on with an idle bus (fanout.h)
+    trace_writer* trace_writer;      // the writer of an async run (NULL: the cores and the bus write their traces)
 
 } processor;
 
@@ -77,12 +147,28 @@ typedef struct {
 /*************** Processor Functions *******************/
 /*******************************************************/
 
-// Initializes file names to the argv[] arguments
-void set_file_names(filenames* filenames, char* argv[]);
+/*
+ * Initializes file names to the argv[] arguments, in the order:
+ * imem files, memin, memout, regout files, coretrace files, bustrace, dsram files, tsram files, stats files
+ * (NUM_OF_FILE_ARGUMENTS(num_of_cores) arguments starting at argv[1]).
+ */
+void set_file_names(filenames* filenames, int num_of_cores, char* argv[]);
+
+
+// Initializes file names to the defined default values (imem%d.txt, regout%d.txt, core%dtrace.txt...)
+void set_default_file_names(filenames* filenames, int num_of_cores);
+
 
+// Names the imem file of each core by the pattern, "%d" is replaced by the core number (no "%d": one file for all cores)
+void set_imem_file_names(filenames* filenames, const char* pattern);
 
-// Initializes file names to the defined default values
-void set_default_file_names(filenames* filenames);
+
+// Gives all the outputs their default names inside the directory
+void set_output_file_names(filenames* filenames, const char* dir);
+
+
+// Frees the names and the filenames struct
+void free_file_names(filenames* filenames);
 
 
 /*
@@ -91,12 +177,42 @@ void set_default_file_names(filenames* filenames);
  * - Initializes each core registers and prev_registers to 0.
  * - Initializes each core imem according to the file instructions.
  * - Initializes each core cache using their respective initialization function.
+ * - Places the cores (with their caches, stats and pipelines) in one arena of cache-aligned slots.
+ * - Initializes the bus, latency can be NULL for the default latencies.
+ * The number of cores is taken from the filenames.
+ */
+processor *init_processor(filenames *filenames, const latency_config *latency);
+
+
+// Executes the processor run, writes the outputs and frees the processor. Returns the number of cycles
+int run(processor* cpu, main_memory* memory);
+
+
+/*
+ * The phases of run, for the callers that work on the processor between its cycles (fanout.h):
+ * start_run opens the trace files (or continues them at their offsets) and starts the trace writer,
+ * run_cycles runs (after the fast-forward, if any) until all the cores finish, the run stops at a checkpoint or pauses at pause_cycle
+ * (a sampled run alternates functional and detailed intervals), run_detailed runs the detailed timing model alone,
+ * end_run stops the writer, writes the outputs, closes the traces and frees the processor (returns the cycles).
  */
-processor *init_processor(filenames *filenames);
+void start_run(processor* cpu);
+void run_cycles(processor* cpu, main_memory* memory);
+void run_detailed(processor* cpu, main_memory* memory);
+
+// True if the engine can run the config: the store buffers drain in the serial engine only
+bool engine_runs_config(engine_type engine, const latency_config* latency);
+int end_run(processor* cpu, main_memory* memory);
 
 
-// Executes the processor run
-void run(processor* cpu, main_memory* memory);
+// Gives the outputs of the processor their default names inside the directory (the cores take the new names)
+void set_processor_output_names(processor* cpu, const char* dir);
+
+
+/*
+ * Changes the bus latencies of the processor between two cycles in which no core holds the bus.
+ * The instructions already in the pipelines get the new delays, as if they were fetched with them.
+ */
+void set_processor_latency(processor* cpu, const latency_config* latency);
 
 
 // Check if all the cores finished running
@@ -107,21 +223,63 @@ bool finish(processor* cpu);
 void free_processor(processor* cpu);
 
 
-// convert cache_block into mem_block
-memory_block* convert_cache_block_to_mem_block(cache_block* c_block);
+// convert cache_block of block_size words into mem_block (fills m_block and returns it)
+memory_block* convert_cache_block_to_mem_block(cache_block* c_block, int block_size, memory_block* m_block);
 
 
-// convert mem_block to cache_block
-cache_block* convert_mem_block_to_cache_block(memory_block* m_block);
+// convert mem_block of block_size words to cache_block (fills c_block and returns it, the tag is set by its cache)
+cache_block* convert_mem_block_to_cache_block(memory_block* m_block, int block_size, cache_block* c_block);
 
 
-// After performing a step in each of the 4 pipelines in the cores, 
+// After performing a step in each of the pipelines in the cores,
 // we check and update the state of the corresponding block in the corresponding cache (if required).
 int search_modified_block(processor *cpu, uint32_t address, bool *about_to_be_overwritten, uint32_t *address_of_overwritten, uint32_t *core_of_overwritten);
 
 
-// A function that performs the actual update to the block state
-void update_cache_stats(cache_block *core0_block, cache_block *core1_block, cache_block *core2_block, cache_block *core3_block, cache_block *mem_block);
+// A function that performs the actual update to the block state (blocks has one entry per core, NULL if no block)
+void update_cache_stats(processor *cpu, cache_block *blocks[], cache_block *mem_block);
+
+/*******************************************************/
+/****** Cycle phases (shared by the cycle engines) *****/
+/*******************************************************/
+
+// Returns true if one of the cores currently owns the bus
+bool bus_is_busy(processor* cpu);
+
+// Returns true if the instruction in the MEM phase of the core is a lw/sw that misses the cache
+bool core_needs_bus(core* core, instructions* instructions);
+
+// Gives the bus to the first core in the round robin queue that needs it and moves that core to the end of the queue
+void grant_bus(processor* cpu);
+
+// Writes back the modified blocks the bus owner needs and reads the requested block from memory
+void prepare_bus_transfer(processor* cpu, main_memory* memory, bus_transfer* transfer);
+
+// After a step of a core, a copy it marked as INVALID is invalidated in the other caches as well
+void invalidate_other_copies(processor* cpu, int core_index, uint32_t address);
+
+// A buffered store that went around the cache of the core in its step is written to memory, the other copies of its block are invalidated
+void write_around_store(processor* cpu, main_memory* memory, int core_index);
+
+// The last core that accessed the memory in this cycle decides if the bus address is done
+void collect_address_done(processor* cpu);
+
+// Writes the bus transactions of the bus owner that happen in this cycle to the bustrace
+void write_bus_events(processor* cpu, main_memory* memory, bus_transfer* transfer);
+
+// Records the shared state the run loop updates besides the cores
+void take_coherence_snapshot(processor* cpu, coherence_snapshot* snapshot, bus_transfer* transfer);
+
+// Returns true if the two snapshots of the run are the same
+bool same_coherence_snapshot(const coherence_snapshot* first, const coherence_snapshot* second);
+
+/*
+ * Jumps over the cycles in which nothing but the bus countdown can change
+ * (every running core waits on a lw/sw miss and the last cycle did not change the coherence state).
+ * Returns the number of skipped cycles.
+ */
+int skip_idle_cycles(processor* cpu, bool last_cycle_changed_nothing, bool extra_delay);
+
 
 /*******************************************************/
 /*************** Debugging functions *******************/
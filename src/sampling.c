@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include "core.h"
+#include "memory.h"
+#include "processor.h"
+#include "functional.h"
+#include "sampling.h"
+
+
+/*******************************************************/
+/********************  Structs *************************/
+/*******************************************************/
+
+// The sums of one measure over the samples, for its mean and confidence interval
+typedef struct {
+    int count;
+    double sum;
+    double sum_of_squares;
+} sample_sums;
+
+// The counters of a core at the start of a sample
+typedef struct {
+    long cycles;
+    long retired;
+    long accesses;
+    long misses;
+} core_counters;
+
+
+/*******************************************************/
+/****************** Sampling Functions *****************/
+/*******************************************************/
+
+// Returns the instructions the core retired so far (done() replaces the raw counters by the totals)
+static long retired_instructions(core* core)
+{
+    if (core->done) {
+        return core->stats->total_instructions;
+    }
+    // every cycle retires one instruction except the ones with a stall in the WB phase
+    return core->cycle - core->stats->num_of_decode_stalls;
+}
+
+// Reads the counters of the core
+static void read_counters(core* core, core_counters* counters)
+{
+    stats* stats = core->stats;
+    counters->cycles = core->cycle;
+    counters->retired = retired_instructions(core);
+    counters->misses = stats->read_miss + stats->write_miss;
+    counters->accesses = stats->read_hit + stats->write_hit + counters->misses;
+}
+
+// Adds the value of one sample to the sums
+static void add_sample(sample_sums* sums, double value)
+{
+    sums->count++;
+    sums->sum += value;
+    sums->sum_of_squares += value * value;
+}
+
+// Returns the mean of the samples
+static double sample_mean(const sample_sums* sums)
+{
+    return sums->count > 0 ? sums->sum / sums->count : 0.0;
+}
+
+// Returns the half width of the confidence interval of the mean (0 with less than 2 samples)
+static double sample_half_width(const sample_sums* sums)
+{
+    if (sums->count < 2) {
+        return 0.0;
+    }
+    double mean = sample_mean(sums);
+    double variance = (sums->sum_of_squares - sums->count * mean * mean) / (sums->count - 1);
+    return variance > 0.0 ? SAMPLING_Z * sqrt(variance / sums->count) : 0.0;
+}
+
+// Runs the detailed timing model for the cycles (up to the first cycle after them in which the bus is idle)
+static void run_detailed_cycles(processor* cpu, main_memory* memory, int cycles)
+{
+    cpu->pause_cycle = cpu->cycle + cycles;
+    run_detailed(cpu, memory);
+    cpu->pause_cycle = INT_MAX;
+}
+
+/*
+ * Returns the warm-up cycles of the sample: the warm-up and an offset in [0, warm-up + length).
+ * The pipelines restart together after each functional interval, so with the same warm-up every sample
+ * would measure the same phase of the timing of the cores (the bus order, the misses in flight);
+ * the offsets follow the golden ratio sequence and spread the samples evenly over the phases.
+ */
+static int sample_warmup(const sampling_config* config, int sample)
+{
+    double offset = fmod(sample * SAMPLING_GOLDEN_RATIO, 1.0);
+    return config->warmup + (int)(offset * (config->warmup + config->length));
+}
+
+// Prints the estimates of the sampled run
+static void print_sampling_report(processor* cpu, sample_sums cpi[], sample_sums miss_rate[], int samples,
+                                  long detailed_cycles, long functional_instructions)
+{
+    sampling_config* config = &cpu->sampling;
+    printf("sampling: %d samples of %d cycles after %d to %d warm-up cycles, %ld instructions between samples\n",
+           samples, config->length, config->warmup, 2 * config->warmup + config->length, config->period);
+    printf("sampling: %ld detailed cycles, %ld functional instructions\n", detailed_cycles, functional_instructions);
+    printf("core  instructions  samples  cpi                miss_rate          cycles\n");
+    double run_cycles = -1.0;
+    double run_half_width = 0.0;
+    int slowest = -1;
+    for (int i = 0; i < cpu->num_of_cores; i++) {
+        long instructions = retired_instructions(cpu->cores[i]);
+        if (cpi[i].count == 0) {
+            printf("%-4d  %12ld  %7d  %-17s  %-17s  %s\n", i, instructions, 0, "-", "-", "-");
+            continue;
+        }
+        double cycles = instructions * sample_mean(&cpi[i]);
+        double half_width = instructions * sample_half_width(&cpi[i]);
+        printf("%-4d  %12ld  %7d  %7.3f +- %-6.3f  %7.4f +- %-6.4f  %.0f +- %.0f\n", i, instructions, cpi[i].count,
+               sample_mean(&cpi[i]), sample_half_width(&cpi[i]), sample_mean(&miss_rate[i]), sample_half_width(&miss_rate[i]),
+               cycles, half_width);
+        if (cycles > run_cycles) {
+            run_cycles = cycles;
+            run_half_width = half_width;
+            slowest = i;
+        }
+    }
+    if (slowest >= 0) {
+        printf("sampling: the run takes %.0f +- %.0f cycles (core %d finishes last)\n", run_cycles, run_half_width, slowest);
+    }
+}
+
+// Runs the processor with sampling: warm-up, a measured sample, then functional instructions, until the cores finish
+void run_sampled(processor* cpu, main_memory* memory)
+{
+    sampling_config* config = &cpu->sampling;
+    fast_forward_config functional = { true, SWITCH_AT_INSTRUCTIONS, config->period, -1, true };
+    sample_sums cpi[MAX_NUM_OF_CORES];
+    sample_sums miss_rate[MAX_NUM_OF_CORES];
+    memset(cpi, 0, sizeof(cpi));
+    memset(miss_rate, 0, sizeof(miss_rate));
+    int samples = 0;
+    long detailed_cycles = 0;
+    long functional_instructions = 0;
+    while (!finish(cpu)) {
+        int start = cpu->cycle;
+        run_detailed_cycles(cpu, memory, sample_warmup(config, samples));
+        core_counters before[MAX_NUM_OF_CORES];
+        for (int i = 0; i < cpu->num_of_cores; i++) {
+            read_counters(cpu->cores[i], &before[i]);
+        }
+        run_detailed_cycles(cpu, memory, config->length);
+        detailed_cycles += cpu->cycle - start;
+        samples++;
+        // a core that finished inside the sample ran only a part of it
+        for (int i = 0; i < cpu->num_of_cores; i++) {
+            if (cpu->cores[i]->done) {
+                continue;
+            }
+            core_counters after;
+            read_counters(cpu->cores[i], &after);
+            if (after.retired > before[i].retired) {
+                add_sample(&cpi[i], (double)(after.cycles - before[i].cycles) / (after.retired - before[i].retired));
+            }
+            if (after.accesses > before[i].accesses) {
+                add_sample(&miss_rate[i], (double)(after.misses - before[i].misses) / (after.accesses - before[i].accesses));
+            }
+        }
+        if (finish(cpu)) {
+            break;
+        }
+        functional_instructions += run_functional(cpu, memory, &functional);
+    }
+    print_sampling_report(cpu, cpi, miss_rate, samples, detailed_cycles, functional_instructions);
+}
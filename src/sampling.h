@@ -0,0 +1,29 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include "memory.h"
+#include "processor.h"
+
+#define SAMPLING_Z 1.96 // the confidence intervals are 95% (normal approximation)
+#define SAMPLING_GOLDEN_RATIO 0.6180339887 // the step of the warm-up offsets of the samples
+
+
+/*******************************************************/
+/******************* Sampled simulation ****************/
+/*******************************************************/
+
+/*
+ * Runs the processor with sampling (cpu->sampling, the serial engine):
+ * warm-up cycles of detailed timing (the warm-up and an offset below warm-up + length that differs
+ * from sample to sample, so the samples do not all measure the same phase of the restarted pipelines),
+ * a measured sample of detailed timing, then period instructions
+ * run functionally with warm caches (functional.h), and again until all the cores finish.
+ * A sample measures each running core: its CPI (cycles per retired instruction) and its miss rate.
+ * Prints per core the instructions, the mean CPI and miss rate with their confidence intervals,
+ * and the cycles it would take under detailed timing (instructions * CPI), and for the run the largest of them.
+ * The outputs of the run hold the final state, its traces only the detailed cycles.
+ */
+void run_sampled(processor* cpu, main_memory* memory);
+
+
+#endif // SAMPLING_H
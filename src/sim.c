@@ -2,28 +2,473 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
 #include "sram.h"
 #include "core.h"
 #include "memory.h"
 #include "processor.h"
+#include "sweep.h"
+#include "checkpoint.h"
+#include "fanout.h"
+#include "batch.h"
+#include "config.h"
+#include "alloc.h"
 
 
+// The options of the command line
+typedef struct {
+    engine_type engine;
+    char* sweep_list;  // NULL for a single simulation
+    int threads;       // threads of a sweep (0 for one per host core)
+    int num_of_cores;
+    char* imem_pattern; // NULL for the imem files of the command line (or the default names)
+    char* output_dir;   // NULL for the output files of the command line (or the default names)
+    bool alloc_stats;   // print the heap allocations of the run
+    trace_format trace_format;
+    bool async_trace;
+    trace_filter trace_filter;
+    char* checkpoint;   // the checkpoint file the run saves to (NULL: none)
+    int checkpoint_every;
+    bool checkpoint_stop;
+    char* restore;      // the checkpoint file the run starts from (NULL: memin and the imem files)
+    int fork_cycle;     // the cycle the variants fork at (-1: no fan-out)
+    char* variants;     // the variant list of a fan-out (NULL: one run)
+    fast_forward_config fast_forward;
+    sampling_config sampling;
+    char* batch_list;   // the memin list of a batch run (NULL: one run)
+    latency_config latency; // the configuration of the run (the defaults, --config, --set, --forwarding and --cache-ways change it)
+    bool throughput;    // print the simulated cycles per host second of the run
+} sim_options;
+
+// Prints the error of a bad option value and exits
+static void bad_option(const char* option, const char* value)
+{
+    printf("Error: bad value %s for %s\n", value, option);
+    exit(EXIT_FAILURE);
+}
+
+// Parses "first:last" (or "first:" for the rest of the run) into the cycle window of the filter
+static void parse_trace_cycles(char* value, trace_filter* filter)
+{
+    char* end;
+    filter->first_cycle = (int)strtol(value, &end, 10);
+    if (*end != ':' || filter->first_cycle < 0) {
+        bad_option("--trace-cycles", value);
+    }
+    // "A:" traces from cycle A to the end of the run
+    char* last = end + 1;
+    filter->last_cycle = (*last == '\0') ? INT_MAX : (int)strtol(last, &last, 10);
+    if (*last != '\0' || filter->last_cycle < filter->first_cycle) {
+        bad_option("--trace-cycles", value);
+    }
+}
+
+// Parses a comma separated list of core numbers into the cores of the filter
+static void parse_trace_cores(char* value, trace_filter* filter)
+{
+    filter->cores = 0;
+    char* rest = NULL;
+    for (char* field = strtok_r(value, ",", &rest); field; field = strtok_r(NULL, ",", &rest)) {
+        char* end;
+        long core_num = strtol(field, &end, 10);
+        if (*end != '\0' || core_num < 0 || core_num >= MAX_NUM_OF_CORES) {
+            bad_option("--trace-cores", field);
+        }
+        filter->cores |= (uint64_t)1 << core_num;
+    }
+}
+
+// Parses a comma separated list of hex address ranges "first:last" (or single addresses) into the filter
+static void parse_trace_addresses(char* value, trace_filter* filter)
+{
+    char* rest = NULL;
+    for (char* field = strtok_r(value, ",", &rest); field; field = strtok_r(NULL, ",", &rest)) {
+        if (filter->num_of_ranges == MAX_TRACE_RANGES) {
+            printf("Error: --trace-addr takes up to %d ranges\n", MAX_TRACE_RANGES);
+            exit(EXIT_FAILURE);
+        }
+        address_range* range = &filter->ranges[filter->num_of_ranges++];
+        char* end;
+        range->first = (uint32_t)strtoul(field, &end, 16);
+        range->last = (*end == ':') ? (uint32_t)strtoul(end + 1, &end, 16) : range->first;
+        if (end == field || *end != '\0' || range->last < range->first) {
+            bad_option("--trace-addr", field);
+        }
+    }
+}
+
+// Parses a comma separated list of bus commands (BusRd, BusRdX, Flush or their numbers) into the filter
+static void parse_trace_commands(char* value, trace_filter* filter)
+{
+    filter->bus_commands = 0;
+    char* rest = NULL;
+    for (char* field = strtok_r(value, ",", &rest); field; field = strtok_r(NULL, ",", &rest)) {
+        int cmd;
+        if (strcmp(field, "BusRd") == 0 || strcmp(field, "1") == 0) { cmd = BusRd; }
+        else if (strcmp(field, "BusRdX") == 0 || strcmp(field, "2") == 0) { cmd = BusRdX; }
+        else if (strcmp(field, "Flush") == 0 || strcmp(field, "3") == 0) { cmd = Flush; }
+        else { bad_option("--trace-cmd", field); return; }
+        filter->bus_commands |= 1u << cmd;
+    }
+}
+
+// Parses "cycle=N", "insts=N" or "pc=[core:]P" into the switch point of the fast-forward
+static void parse_fast_forward(char* value, fast_forward_config* config)
+{
+    char* number = strchr(value, '=');
+    if (!number) {
+        bad_option("--fast-forward", value);
+    }
+    *number++ = '\0';
+    config->core = -1;
+    if (strcmp(value, "cycle") == 0) { config->point = SWITCH_AT_CYCLE; }
+    else if (strcmp(value, "insts") == 0) { config->point = SWITCH_AT_INSTRUCTIONS; }
+    else if (strcmp(value, "pc") == 0) { config->point = SWITCH_AT_PC; }
+    else { bad_option("--fast-forward", value); }
+    char* end;
+    char* core_end = strchr(number, ':');
+    if (core_end && config->point == SWITCH_AT_PC) {
+        config->core = (int)strtol(number, &end, 10);
+        if (end != core_end || config->core < 0 || config->core >= MAX_NUM_OF_CORES) {
+            bad_option("--fast-forward", number);
+        }
+        number = core_end + 1;
+    }
+    // a pc can be given in hex (0x...)
+    config->value = strtol(number, &end, config->point == SWITCH_AT_PC ? 0 : 10);
+    if (end == number || *end != '\0' || config->value < 0) {
+        bad_option("--fast-forward", number);
+    }
+    config->enabled = true;
+}
+
+// Parses "P:W:L" into the intervals of a sampled run (period instructions, warm-up and sample cycles)
+static void parse_sampling(char* value, sampling_config* config)
+{
+    char* end;
+    config->period = strtol(value, &end, 10);
+    if (*end != ':' || config->period < 1) {
+        bad_option("--sample", value);
+    }
+    config->warmup = (int)strtol(end + 1, &end, 10);
+    if (*end != ':' || config->warmup < 0) {
+        bad_option("--sample", value);
+    }
+    config->length = (int)strtol(end + 1, &end, 10);
+    if (*end != '\0' || config->length < 1) {
+        bad_option("--sample", value);
+    }
+    config->enabled = true;
+}
+
+// Applies the config file of the command line (--config) to the options, the other options change it further
+static void read_config_option(int argc, char* argv[], sim_options* options)
+{
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--config") == 0 && !read_config_file(argv[i + 1], &options->latency)) {
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/*
+ * Removes the options (arguments that start with "--") from argv and applies them.
+ * Supported options:
+ * --engine serial|parallel : the cycle engine that runs the cores (default serial, parallel runs without a store buffer)
+ * --sweep <list file>      : runs all the simulations of the list on a thread pool (see sweep.h)
+ * --threads N              : the number of threads of a sweep (default one per host core)
+ * --cores N                : the number of cores, 1 to MAX_NUM_OF_CORES (default 4)
+ * --imem <pattern>         : the imem file of each core, "%d" is replaced by the core number
+ * --outdir <dir>           : writes the outputs with their default names inside the directory
+ * --alloc-stats            : prints the number of heap allocations before and during the run
+ * --trace-format text|binary : binary core/bus traces (".bin" after the names, see trace_decode)
+ * --async-trace            : a writer thread formats and writes the traces off the cycle loop
+ * --trace-cycles A:B       : writes the core and bus trace lines of cycles A to B only ("A:" to the end)
+ * --trace-cores i,j,...    : writes the core traces of these cores only (the others stay empty)
+ * --trace-addr X:Y,...     : writes the bus lines of these hex address ranges only
+ * --trace-cmd BusRd,...    : writes the bus lines of these commands only (BusRd, BusRdX, Flush)
+ * --checkpoint <file>      : saves the state of the run to the file (serial engine, see checkpoint.h)
+ * --checkpoint-every N     : saves a checkpoint each time the cycle reaches a multiple of N
+ * --checkpoint-stop        : ends the run at the first checkpoint (only the traces are written)
+ * --restore <file>         : continues the run of the checkpoint (the traces are cut at its cycle and continued)
+ * --fork-at N              : runs to cycle N, then forks a child process per variant (see fanout.h)
+ * --variants <list file>   : the variants of --fork-at, --threads of them run at a time
+ * --fast-forward cycle=N|insts=N|pc=[core:]P : runs functionally up to the point, then with detailed timing
+ * --warm-caches            : the fast-forward keeps the caches warm (its loads and stores go through them)
+ * --sample P:W:L           : sampled run, P functional instructions between samples of W warm-up and L measured cycles
+ * --batch <list file>      : runs the imem files against each memin of the list, side by side in lockstep up to the
+ *                            --fast-forward switch point (see batch.h), without --fast-forward the runs are
+ *                            one after the other in the detailed model (no faster than separate runs)
+ * --forwarding             : the pipelines forward results to EXE and to the branches in decode (see pipeline_step)
+ * --cache-ways N           : N-way set-associative data caches with LRU replacement, N a power of 2 up to 64 (default 1)
+ * --config <file>          : the configuration of the run: cache geometry, latencies, imem size (see config.h),
+ *                            applied before the other options, which change it further
+ * --set key=value          : sets one key of the configuration (the keys of a config file)
+ * --throughput             : prints the simulated cycles per second of the run (make bench compares the builds)
+ * Returns the number of the remaining arguments.
+ */
+static int parse_options(int argc, char* argv[], sim_options* options)
+{
+    engine_type* engine = &options->engine;
+    int remaining = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--sweep") == 0 && i + 1 < argc) {
+            options->sweep_list = argv[++i];
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options->threads = atoi(argv[++i]);
+            if (options->threads < 1) {
+                printf("Error: --threads needs a positive number\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "--cores") == 0 && i + 1 < argc) {
+            options->num_of_cores = atoi(argv[++i]);
+            if (options->num_of_cores < 1 || options->num_of_cores > MAX_NUM_OF_CORES) {
+                printf("Error: --cores needs a number between 1 and %d\n", MAX_NUM_OF_CORES);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "--imem") == 0 && i + 1 < argc) {
+            options->imem_pattern = argv[++i];
+        }
+        else if (strcmp(argv[i], "--outdir") == 0 && i + 1 < argc) {
+            options->output_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--alloc-stats") == 0) {
+            options->alloc_stats = true;
+        }
+        else if (strcmp(argv[i], "--throughput") == 0) {
+            options->throughput = true;
+        }
+        else if (strcmp(argv[i], "--async-trace") == 0) {
+            options->async_trace = true;
+        }
+        else if (strcmp(argv[i], "--trace-cycles") == 0 && i + 1 < argc) {
+            parse_trace_cycles(argv[++i], &options->trace_filter);
+        }
+        else if (strcmp(argv[i], "--trace-cores") == 0 && i + 1 < argc) {
+            parse_trace_cores(argv[++i], &options->trace_filter);
+        }
+        else if (strcmp(argv[i], "--trace-addr") == 0 && i + 1 < argc) {
+            parse_trace_addresses(argv[++i], &options->trace_filter);
+        }
+        else if (strcmp(argv[i], "--trace-cmd") == 0 && i + 1 < argc) {
+            parse_trace_commands(argv[++i], &options->trace_filter);
+        }
+        else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+            options->checkpoint = argv[++i];
+        }
+        else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc) {
+            options->checkpoint_every = atoi(argv[++i]);
+            if (options->checkpoint_every < 1) {
+                printf("Error: --checkpoint-every needs a positive number\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "--checkpoint-stop") == 0) {
+            options->checkpoint_stop = true;
+        }
+        else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+            options->restore = argv[++i];
+        }
+        else if (strcmp(argv[i], "--fork-at") == 0 && i + 1 < argc) {
+            options->fork_cycle = atoi(argv[++i]);
+            if (options->fork_cycle < 0) {
+                printf("Error: --fork-at needs a cycle >= 0\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "--variants") == 0 && i + 1 < argc) {
+            options->variants = argv[++i];
+        }
+        else if (strcmp(argv[i], "--fast-forward") == 0 && i + 1 < argc) {
+            parse_fast_forward(argv[++i], &options->fast_forward);
+        }
+        else if (strcmp(argv[i], "--warm-caches") == 0) {
+            options->fast_forward.warm_caches = true;
+        }
+        else if (strcmp(argv[i], "--sample") == 0 && i + 1 < argc) {
+            parse_sampling(argv[++i], &options->sampling);
+        }
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            options->batch_list = argv[++i];
+        }
+        else if (strcmp(argv[i], "--forwarding") == 0) {
+            options->latency.forwarding = true;
+        }
+        else if (strcmp(argv[i], "--cache-ways") == 0 && i + 1 < argc) {
+            options->latency.cache.ways = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            i++; // read by read_config_option before the other options
+        }
+        else if (strcmp(argv[i], "--set") == 0 && i + 1 < argc) {
+            i++;
+            if (!set_config_setting(&options->latency, argv[i])) {
+                bad_option("--set", argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--trace-format") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "binary") == 0) {
+                options->trace_format = TRACE_BINARY;
+            }
+            else if (strcmp(argv[i], "text") == 0) {
+                options->trace_format = TRACE_TEXT;
+            }
+            else {
+                printf("Error: unknown trace format %s (text or binary)\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "parallel") == 0) {
+                *engine = PARALLEL_ENGINE;
+            }
+            else if (strcmp(argv[i], "serial") == 0) {
+                *engine = SERIAL_ENGINE;
+            }
+            else {
+                printf("Error: unknown engine %s (serial or parallel)\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strncmp(argv[i], "--", 2) == 0) {
+            printf("Error: unknown option %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+        else {
+            argv[remaining++] = argv[i];
+        }
+    }
+    return remaining;
+}
+
+// Runs the simulation with the options of the run, frees it and returns the exit code of the simulator
+static int run_simulation(processor* cpu, main_memory* memory, sim_options* options)
+{
+    cpu->engine = options->engine;
+    cpu->async_trace = options->async_trace;
+    cpu->fast_forward = options->fast_forward;
+    cpu->sampling = options->sampling;
+    if (options->checkpoint) {
+        set_checkpoints(cpu, options->checkpoint, options->checkpoint_every, options->checkpoint_stop);
+    }
+    if (options->variants) {
+        int failed = run_fanout(cpu, memory, options->fork_cycle, options->variants, options->threads);
+        free_main_memory(memory);
+        return failed == 0 ? 0 : EXIT_FAILURE;
+    }
+
+    // Step 3: Run the cpu
+    long setup_allocations = allocation_count();
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int cycles = run(cpu, memory);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (options->alloc_stats) {
+        long run_allocations = allocation_count() - setup_allocations;
+        printf("allocations: %ld before the run, %ld in the run (%.6f per cycle over %d cycles)\n",
+               setup_allocations, run_allocations, cycles > 0 ? (double)run_allocations / cycles : 0.0, cycles);
+    }
+    if (options->throughput) {
+        double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("throughput: %d cycles in %.6f s (%.0f cycles/s)\n", cycles, seconds, seconds > 0 ? cycles / seconds : 0.0);
+    }
+
+    // Step 4: free memory
+    free_main_memory(memory);
+
+    return 0;
+}
+
 // check the core functions
 //int main()
 int main(int argc, char* argv[])
 {
     // Step 1: Initialize the cpu
-    filenames *file_names = malloc(sizeof(filenames));
+    sim_options options = { SERIAL_ENGINE, NULL, 0, DEFAULT_NUM_OF_CORES, NULL, NULL, false, TRACE_TEXT, false };
+    init_trace_filter(&options.trace_filter);
+    options.fork_cycle = -1;
+    set_build_config(&options.latency);
+    read_config_option(argc, argv, &options);
+    argc = parse_options(argc, argv, &options);
+    if (!valid_config(&options.latency)) {
+        exit(EXIT_FAILURE);
+    }
+    if (options.checkpoint && (options.checkpoint_every == 0 || options.engine != SERIAL_ENGINE || options.async_trace)) {
+        printf("Error: --checkpoint needs --checkpoint-every, the serial engine and no --async-trace\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((options.variants != NULL) != (options.fork_cycle >= 0) || (options.variants && (options.checkpoint || options.sweep_list))) {
+        printf("Error: --fork-at and --variants go together, without --checkpoint or --sweep\n");
+        exit(EXIT_FAILURE);
+    }
+    if (options.fast_forward.enabled && options.restore) {
+        printf("Error: --fast-forward starts a run from its beginning, not from --restore\n");
+        exit(EXIT_FAILURE);
+    }
+    if (options.fast_forward.warm_caches && !options.fast_forward.enabled) {
+        printf("Error: --warm-caches goes with --fast-forward\n");
+        exit(EXIT_FAILURE);
+    }
+    if (options.sampling.enabled && (options.engine != SERIAL_ENGINE || options.checkpoint || options.variants)) {
+        printf("Error: --sample needs the serial engine, without --checkpoint or --variants\n");
+        exit(EXIT_FAILURE);
+    }
+    if (!engine_runs_config(options.engine, &options.latency)) {
+        printf("Error: --engine parallel goes without a store buffer (store_buffer 0)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (options.batch_list && (options.sweep_list || options.variants || options.checkpoint || options.restore || options.sampling.enabled)) {
+        printf("Error: --batch goes without --sweep, --variants, --checkpoint, --restore or --sample\n");
+        exit(EXIT_FAILURE);
+    }
+    if (!is_build_config(&options.latency) && options.restore) {
+        printf("Error: --config, --set, --forwarding and --cache-ways go without --restore (the checkpoint sets the configuration)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (options.sweep_list) {
+        return run_sweep(options.sweep_list, options.threads, options.num_of_cores, options.engine, &options.latency) == 0 ? 0 : EXIT_FAILURE;
+    }
+    filenames *file_names = sim_malloc(sizeof(filenames));
     if (!file_names) {
         perror("Failed to allocate memory for filenames");
         exit(EXIT_FAILURE);
     }
-    if (argc == 28) {
-        set_file_names(file_names, argv);
+    if (argc == 1 + NUM_OF_FILE_ARGUMENTS(options.num_of_cores)) {
+        set_file_names(file_names, options.num_of_cores, argv);
     }else{
-        set_default_file_names(file_names);
+        set_default_file_names(file_names, options.num_of_cores);
     }
-    processor *cpu = init_processor(file_names);
+    if (options.imem_pattern) {
+        set_imem_file_names(file_names, options.imem_pattern);
+    }
+    if (options.output_dir) {
+        set_output_file_names(file_names, options.output_dir);
+    }
+    file_names->trace_format = options.trace_format;
+    file_names->trace_filter = options.trace_filter;
+    if (options.batch_list) {
+        // the memin and the outputs of each simulation come from the list
+        int failed = run_batch(options.batch_list, file_names, &options.latency, &options.fast_forward, options.engine);
+        free_file_names(file_names);
+        return failed == 0 ? 0 : EXIT_FAILURE;
+    }
+    if (options.restore) {
+        // Steps 1 and 2 from a checkpoint (its trace settings replace the options)
+        main_memory* memory = NULL;
+        processor* cpu = restore_checkpoint(options.restore, file_names, &memory);
+        if (!engine_runs_config(options.engine, &cpu->latency)) {
+            printf("Error: --engine parallel goes without a store buffer, the checkpoint has one\n");
+            exit(EXIT_FAILURE);
+        }
+        return run_simulation(cpu, memory, &options);
+    }
+    processor *cpu = init_processor(file_names, &options.latency);
     if (!cpu)
     {
         perror("Failed to allocate memory for the cpu");
@@ -35,12 +480,5 @@ int main(int argc, char* argv[])
         perror("Failed to allocate memory for core");
         exit(EXIT_FAILURE);
     }
-    
-    // Step 3: Run the cpu
-    run(cpu, memory);
-
-    // Step 4: free memory
-    free_main_memory(memory);
-
-    return 0;
+    return run_simulation(cpu, memory, &options);
 }
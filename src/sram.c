@@ -2,31 +2,93 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "sram.h"
+#include "alloc.h"
 #include <stdint.h>
 #include <stdio.h>
 
+#define DIRECTORY_ALIGNMENT 64  // the directory rows start on host cache lines (and 32 byte vectors)
+#define DIRECTORY_LANE_GROUP 16 // a query compares the lanes 16 at a time (one SSE2 vector of states)
+#define ADDRESS_MASK ((1u << ADDRESS_BITS) - 1)
+
 
 /*******************************************************/
 /**************** cashe functions **********************/
 /*******************************************************/
 
-uint32_t get_tag(uint32_t address)
+// Returns true if the number is a power of 2
+static bool power_of_2(int number)
+{
+    return number > 0 && (number & (number - 1)) == 0;
+}
+
+// Sets the default geometry (CACHE_SIZE words, CACHE_BLOCK_SIZE words a block, direct-mapped)
+void set_default_geometry(cache_geometry *geometry)
 {
-    address &= 0x000FFFFF;
-    return address >> 8;
+    geometry->size = CACHE_SIZE;
+    geometry->block_size = CACHE_BLOCK_SIZE;
+    geometry->ways = 1;
 }
 
+// Returns true if a cache can have the geometry, otherwise prints what is wrong with it and returns false
+bool valid_cache_geometry(const cache_geometry *geometry)
+{
+    if (!power_of_2(geometry->block_size) || geometry->block_size > MAX_CACHE_BLOCK_SIZE) {
+        printf("Error: block_size must be a power of 2 up to %d\n", MAX_CACHE_BLOCK_SIZE);
+        return false;
+    }
+    if (!power_of_2(geometry->size) || geometry->size < geometry->block_size || geometry->size / geometry->block_size > MAX_CACHE_BLOCKS) {
+        printf("Error: cache_size must be a power of 2 from block_size up to %d blocks\n", MAX_CACHE_BLOCKS);
+        return false;
+    }
+    if (!power_of_2(geometry->ways) || geometry->ways > MAX_CACHE_WAYS || geometry->ways > geometry->size / geometry->block_size) {
+        printf("Error: cache_ways must be a power of 2 up to %d and up to the blocks of the cache\n", MAX_CACHE_WAYS);
+        return false;
+    }
+    return true;
+}
 
-uint32_t get_index(uint32_t address) 
+// Extracts the set of the address in the cache
+uint32_t cache_set(const Cache *cache, uint32_t address)
 {
-    address = address & 0x000FFFFF;
-    return (address / 4);
+    return ((address & ADDRESS_MASK) >> CACHE_BLOCK_BITS(cache)) & ((1u << CACHE_SET_BITS(cache)) - 1);
 }
 
-uint32_t get_cache_index(uint32_t address) 
+// Extracts the tag of the address in the cache (the address bits above the set)
+uint32_t cache_tag(const Cache *cache, uint32_t address)
 {
-    return get_index(address) % 64;
+    return (address & ADDRESS_MASK) >> (CACHE_BLOCK_BITS(cache) + CACHE_SET_BITS(cache));
+}
+
+// Returns the address of the first word of a block of the cache (from its tag and its set)
+uint32_t cache_block_address(const Cache *cache, const cache_block *block)
+{
+    uint32_t set = (uint32_t)(block - cache->blocks) / (uint32_t)cache->ways;
+    return (block->tag << (cache->set_bits + cache->block_bits)) | (set << cache->block_bits);
+}
+
+// Returns the words of a block of the cache
+int cache_block_size(const Cache *cache)
+{
+    return 1 << CACHE_BLOCK_BITS(cache);
+}
+
+// Returns the offset of the address in its block of the cache
+uint32_t cache_block_offset(const Cache *cache, uint32_t address)
+{
+    return address & ((1u << CACHE_BLOCK_BITS(cache)) - 1);
+}
+
+// Returns the bits of the tags of the cache (ADDRESS_BITS less the set and the offset bits, 12 by default)
+int cache_tag_bits(const Cache *cache)
+{
+    return ADDRESS_BITS - cache->set_bits - cache->block_bits;
 }
 
 
@@ -35,58 +97,102 @@ uint32_t get_cache_index(uint32_t address)
 * each tag iniital as 0
 * each state iniital as "invalid"
 * each data iniital as 0 
+* and the blocks and the sets of the geometry (valid_cache_geometry)
 */
-void cache_initialization(Cache *cache) 
+// Returns the bytes of the storage of a cache of the geometry (its blocks and their words)
+size_t cache_storage_size(const cache_geometry *geometry)
+{
+    int num_blocks = geometry->size / geometry->block_size;
+    return num_blocks * sizeof(cache_block) + geometry->size * sizeof(int);
+}
+
+void cache_initialization(Cache *cache, const cache_geometry *geometry, void *storage) 
 {
-    for (int i = 0; i < NUM_BLOCKS; i++) {
+    cache->blocks = storage;
+    cache->words = (int*)(cache->blocks + geometry->size / geometry->block_size);
+    cache->directory = NULL;
+    cache->id = 0;
+    cache->num_blocks = geometry->size / geometry->block_size;
+    cache->ways = geometry->ways;
+    cache->set_bits = __builtin_ctz((unsigned)(cache->num_blocks / geometry->ways));
+    cache->block_bits = __builtin_ctz((unsigned)geometry->block_size);
+    for (int i = 0; i < cache->num_blocks; i++) {
         cache->blocks[i].tag = 0;               // tag iniital as 0
         cache->blocks[i].cycle = 0;
+        cache->blocks[i].last_use = 0;
         cache->blocks[i].state = INVALID;       // invalid
-        for (int j = 0; j < CACHE_BLOCK_SIZE; j++) {
-            cache->blocks[i].data[j] = 0;       // initial data = 0
-        }
+        cache->blocks[i].data = &cache->words[i * geometry->block_size];
     }
+    memset(cache->words, 0, geometry->size * sizeof(int)); // initial data = 0
 }
 
 
+/*
+ * Returns the valid block of the address in its set, NULL on a miss.
+ * The victim gets the block a new one would replace (an invalid way first, then the least recently used).
+ */
+static cache_block* find_block(Cache *cache, uint32_t address, cache_block** victim)
+{
+    uint32_t index = (address & ADDRESS_MASK) >> CACHE_BLOCK_BITS(cache); // the block of the address, inline on the hot path
+    uint32_t tag = index >> CACHE_SET_BITS(cache);
+    cache_block* set = &cache->blocks[(index & ((1u << CACHE_SET_BITS(cache)) - 1)) * CACHE_WAYS(cache)];
+    cache_block* replaced = NULL;
+    for (int way = 0; way < CACHE_WAYS(cache); way++) {
+        cache_block* block = &set[way];
+        if (block->state == INVALID) {
+            if (!replaced || replaced->state != INVALID) {
+                replaced = block;
+            }
+        }
+        else if (block->tag == tag) {
+            return block;
+        }
+        else if (!replaced || (replaced->state != INVALID && block->last_use < replaced->last_use)) {
+            replaced = block;
+        }
+    }
+    if (victim) {
+        *victim = replaced;
+    }
+    return NULL;
+}
+
 // The function looks for the block in the cache, if it is found it returns true and otherwise it returns false.
 bool search_block(Cache *cache, uint32_t address) {
-    uint32_t tag = get_tag(address);
-    uint32_t cache_index = get_cache_index(address);
-    
-    
-    // get the block from the cache
-    cache_block* cache_block_ptr = &cache->blocks[cache_index];
-    // hit
-    //if (cache_block_ptr->state != INVALID && cache_block_ptr->tag == tag) {
-    if (cache_block_ptr->state != INVALID && cache_block_ptr->tag == tag) {
-        return true;
-    }
-    // miss
-    return false;
-}
-
-// return pointer to copy of the cache block
+    return find_block(cache, address, NULL) != NULL;
+}
+
+// return pointer to the cache block of the address (on a miss, the block a new one replaces)
 cache_block* get_cache_block(Cache *cache, uint32_t address)
 {
-    uint32_t cache_index = get_cache_index(address);
-    return &cache->blocks[cache_index];
+    cache_block* victim;
+    cache_block* block = find_block(cache, address, &victim);
+    return block ? block : victim;
+}
+
+// Records an access to the block in the cycle (the LRU order)
+void use_block(cache_block *block, int cycle)
+{
+    block->last_use = cycle;
 }
 
 
 /*
  * The function inserts a block into the cache.
- * If a block exists at the target index, it will be overwritten.
+ * The block of get_cache_block is overwritten, the new block counts as used in the cycle.
  * Returns true on success and false in case of a failure.
  */
 bool insert_block(Cache *cache, uint32_t address, cache_block *new_block, int cycle) {
-    uint32_t cache_index = get_cache_index(address);
-    // Check if the index is within bounds
-    if (cache_index >= NUM_BLOCKS) {
-        return false;; // Failure: index out of bounds
-    }
+    cache_block* block = get_cache_block(cache, address);
     new_block->cycle = cycle;
-    cache->blocks[cache_index] = *new_block;
+    new_block->last_use = cycle;
+    // the overwritten block leaves the cache
+    set_block_state(cache, block, INVALID);
+    block->tag = new_block->tag;
+    block->cycle = new_block->cycle;
+    block->last_use = new_block->last_use;
+    memcpy(block->data, new_block->data, cache_block_size(cache) * sizeof(int));
+    set_block_state(cache, block, new_block->state);
 
     return true;; // Success
 }
@@ -98,12 +204,10 @@ bool insert_block(Cache *cache, uint32_t address, cache_block *new_block, int cy
  */
 bool update_state(Cache *cache, uint32_t address, MESI_state new_state) 
 {
-    uint32_t index = (address / CACHE_BLOCK_SIZE) % NUM_BLOCKS; // Extract the index
-    uint32_t tag = address / (CACHE_BLOCK_SIZE * NUM_BLOCKS);   // Extract the tag
-    cache_block *block = &cache->blocks[index];
+    cache_block *block = find_block(cache, address, NULL);
     // Check if the block is valid and the tag matches
-    if (block->state != INVALID && block->tag == tag) {
-        block->state = new_state; // Update the state
+    if (block) {
+        set_block_state(cache, block, new_state); // Update the state
         return true; // Success
     }
     return false; // Block not found
@@ -111,6 +215,22 @@ bool update_state(Cache *cache, uint32_t address, MESI_state new_state)
 
 
 
+/*
+ * Sets the MESI state of a block of the cache and keeps the directory up to date.
+ * Every state change of a block that is in a cache must go through here (or insert_block).
+ */
+void set_block_state(Cache *cache, cache_block *block, MESI_state new_state)
+{
+    sharer_directory* directory = cache->directory;
+    if (directory) {
+        uint32_t slot = (uint32_t)(block - cache->blocks);
+        directory->tags[slot][cache->id] = block->tag;
+        directory->states[slot][cache->id] = (uint8_t)new_state;
+    }
+    block->state = new_state;
+}
+
+
 void free_cache(Cache* cache)
 {
     if (!cache) return;
@@ -118,18 +238,152 @@ void free_cache(Cache* cache)
 }
 
 
+/*******************************************************/
+/*************** Sharer directory **********************/
+/*******************************************************/
+
+// Creates an empty directory for caches of the geometry (no cache holds any block)
+sharer_directory* create_directory(const cache_geometry *geometry)
+{
+    // a row per block slot after the struct, in one allocation (the rows are aligned for the vector loads)
+    int num_blocks = geometry->size / geometry->block_size;
+    size_t header = (sizeof(sharer_directory) + DIRECTORY_ALIGNMENT - 1) & ~(size_t)(DIRECTORY_ALIGNMENT - 1);
+    size_t tags_size = num_blocks * MAX_SHARERS * sizeof(uint32_t);
+    size_t states_size = num_blocks * MAX_SHARERS * sizeof(uint8_t);
+    char* storage = sim_aligned_alloc(DIRECTORY_ALIGNMENT, header + tags_size + states_size);
+    if (!storage) {
+        perror("Failed to allocate memory for the sharer directory");
+        exit(EXIT_FAILURE);
+    }
+    sharer_directory* directory = (sharer_directory*)storage;
+    directory->tags = (uint32_t (*)[MAX_SHARERS])(storage + header);
+    directory->states = (uint8_t (*)[MAX_SHARERS])(storage + header + tags_size);
+    memset(directory->tags, 0, tags_size);
+    memset(directory->states, INVALID, states_size);
+    directory->num_of_caches = 0;
+    directory->ways = geometry->ways;
+    directory->set_bits = __builtin_ctz((unsigned)(num_blocks / geometry->ways));
+    directory->block_bits = __builtin_ctz((unsigned)geometry->block_size);
+    atomic_init(&directory->invalidations, 0);
+    return directory;
+}
+
+// Tracks the cache in the directory under the id (the cache must be empty and have the geometry of the directory)
+void attach_directory(Cache *cache, sharer_directory *directory, int id)
+{
+    cache->directory = directory;
+    cache->id = id;
+    if (id >= directory->num_of_caches) {
+        directory->num_of_caches = id + 1;
+    }
+}
+
+// Returns the bit-vector of the lanes of the row that hold the tag
+static uint64_t tag_lanes(const uint32_t* row, int lanes, uint32_t tag)
+{
+    uint64_t mask = 0;
+#if defined(__AVX2__)
+    __m256i key = _mm256_set1_epi32((int)tag);
+    for (int lane = 0; lane < lanes; lane += 8) {
+        __m256i tags = _mm256_load_si256((const __m256i*)(row + lane));
+        uint64_t equal = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(tags, key)));
+        mask |= equal << lane;
+    }
+#elif defined(__SSE2__)
+    __m128i key = _mm_set1_epi32((int)tag);
+    for (int lane = 0; lane < lanes; lane += 4) {
+        __m128i tags = _mm_load_si128((const __m128i*)(row + lane));
+        uint64_t equal = (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(tags, key)));
+        mask |= equal << lane;
+    }
+#else
+    for (int lane = 0; lane < lanes; lane++) {
+        mask |= (uint64_t)(row[lane] == tag) << lane;
+    }
+#endif
+    return mask;
+}
+
+// Returns the bit-vector of the lanes of the row that are in the state
+static uint64_t state_lanes(const uint8_t* row, int lanes, MESI_state state)
+{
+    uint64_t mask = 0;
+#if defined(__SSE2__)
+    __m128i key = _mm_set1_epi8((char)state);
+    for (int lane = 0; lane < lanes; lane += 16) {
+        __m128i states = _mm_load_si128((const __m128i*)(row + lane));
+        uint64_t equal = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(states, key));
+        mask |= equal << lane;
+    }
+#else
+    for (int lane = 0; lane < lanes; lane++) {
+        mask |= (uint64_t)(row[lane] == state) << lane;
+    }
+#endif
+    return mask;
+}
+
+// Returns the lanes a query of the directory compares (whole vectors, the lanes after the caches are INVALID)
+static int directory_lanes(const sharer_directory *directory)
+{
+    return (directory->num_of_caches + DIRECTORY_LANE_GROUP - 1) & ~(DIRECTORY_LANE_GROUP - 1);
+}
+
+// Returns the bit-vector of the caches that hold a valid copy of the block of the address (only the MODIFIED ones if modified)
+static uint64_t directory_holders(const sharer_directory *directory, uint32_t address, bool modified)
+{
+    uint32_t index = (address & ADDRESS_MASK) >> CACHE_BLOCK_BITS(directory);
+    uint32_t tag = index >> CACHE_SET_BITS(directory);
+    int first = (int)(index & ((1u << CACHE_SET_BITS(directory)) - 1)) * CACHE_WAYS(directory);
+    int lanes = directory_lanes(directory);
+    uint64_t mask = 0;
+    // a cache holds the block in one way of the set at most
+    for (int slot = first; slot < first + CACHE_WAYS(directory); slot++) {
+        uint64_t in_state = modified ? state_lanes(directory->states[slot], lanes, MODIFIED)
+                                     : ~state_lanes(directory->states[slot], lanes, INVALID);
+        mask |= tag_lanes(directory->tags[slot], lanes, tag) & in_state;
+    }
+    return mask;
+}
+
+// Returns the bit-vector of the caches that hold a valid copy of the block of the address
+uint64_t directory_sharers(sharer_directory *directory, uint32_t address)
+{
+    return directory_holders(directory, address, false);
+}
+
+// Returns the bit-vector of the caches that hold the block of the address MODIFIED
+uint64_t directory_owners(sharer_directory *directory, uint32_t address)
+{
+    return directory_holders(directory, address, true);
+}
+
+// Counts an invalidation of a copy by another cache
+void directory_count_invalidation(sharer_directory *directory)
+{
+    atomic_fetch_add_explicit(&directory->invalidations, 1, memory_order_relaxed);
+}
+
+void free_directory(sharer_directory* directory)
+{
+    if (!directory) return;
+    free(directory);
+}
+
+
 /*******************************************************/
 /*************** Debugging functions *******************/
 /*******************************************************/
 
 // Prints the entire cache, including all blocks regardless of their MESI state.
 void print_all_cache(Cache *cache) {
-    for (int i = 0; i < NUM_BLOCKS; i++) {
+    int block_size = cache_block_size(cache);
+    for (int i = 0; i < cache->num_blocks; i++) {
         cache_block *block = &cache->blocks[i];
         printf("block(%d): tag = %u, data = {", i, block->tag);
-        for (int j = 0; j < CACHE_BLOCK_SIZE; j++) {
+        for (int j = 0; j < block_size; j++) {
             printf("%u", block->data[j]);
-            if (j < CACHE_BLOCK_SIZE - 1) {
+            if (j < block_size - 1) {
                 printf(", ");
             }
         }
@@ -155,13 +409,14 @@ void print_all_cache(Cache *cache) {
 
 // Prints only the valid blocks of the cache (blocks with MESI state not INVALID).
 void print_cache(Cache *cache) {
-    for (int i = 0; i < NUM_BLOCKS; i++) {
+    int block_size = cache_block_size(cache);
+    for (int i = 0; i < cache->num_blocks; i++) {
         cache_block *block = &cache->blocks[i];
         if (block->state != INVALID) {
             printf("block(%d): tag = %u, data = {", i, block->tag);
-            for (int j = 0; j < CACHE_BLOCK_SIZE; j++) {
+            for (int j = 0; j < block_size; j++) {
                 printf("%u", block->data[j]);
-                if (j < CACHE_BLOCK_SIZE - 1) {
+                if (j < block_size - 1) {
                     printf(", ");
                 }
             }
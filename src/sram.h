@@ -6,14 +6,20 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include "fixed.h"
 
 /*******************************************************/
 /****************** Cache sizes setting ****************/
 /*******************************************************/
 
-#define CACHE_SIZE 256       // 256 words in the cache
-#define CACHE_BLOCK_SIZE 4   // 4 words in block
-#define NUM_BLOCKS (CACHE_SIZE / CACHE_BLOCK_SIZE) // number of blocks - 64 (256/4 = 64)
+#define CACHE_SIZE 256       // 256 words in the cache (the default, see cache_geometry)
+#define CACHE_BLOCK_SIZE 4   // 4 words in block (the default)
+#define ADDRESS_BITS 20      // the bits of a word address (tag, set and offset in a block)
+#define MAX_CACHE_BLOCKS 1024    // the most blocks a cache can have (the storage of a cache is sized by its geometry)
+#define MAX_CACHE_BLOCK_SIZE 16  // the most words a block can have (MAX_BLOCK_SIZE of the main memory)
+#define MAX_CACHE_WAYS 64    // the most ways a set can have
+#define MAX_SHARERS 64       // caches a directory can track (the bits of its sharer vectors)
 
 /*******************************************************/
 /****************** Cashe Structs **********************/
@@ -32,35 +38,95 @@ typedef struct {
     uint32_t tag;
     MESI_state state;
     int cycle;         
-    int data[CACHE_BLOCK_SIZE];  
+    int last_use;      // the cycle of the last access (the LRU order of the ways of a set)
+    int* data;         // the block_size words of the block (in the storage of its cache, or a buffer of a block outside one)
 } cache_block;
 
-// Cache
+/*
+ * The geometry of the data caches: size words in blocks of block_size words, in sets of ways blocks.
+ * All three are powers of 2, an address splits into its tag, its set and its offset in the block
+ * (valid_cache_geometry). The defaults are CACHE_SIZE, CACHE_BLOCK_SIZE and one way: direct-mapped.
+ */
+typedef struct {
+    int size;        // the words of the cache
+    int block_size;  // the words of a block (the words the bus moves on a miss)
+    int ways;        // the blocks of a set
+} cache_geometry;
+
+/*
+ * Sharer directory - the tag and the MESI state of the block each cache holds in each of its block slots,
+ * stored per slot across the caches (tags[slot][id]), so a vector compare of the rows of a set tells
+ * which caches hold a block and in what state (SSE2/AVX2 when the build targets them, scalar otherwise).
+ * All the caches of a directory have the same ways.
+ * A sw hit on a shared block can leave more than one MODIFIED copy until the run loop settles them,
+ * the owners of a block are all of them. Each cache writes only its own lanes (the parallel engine
+ * runs the cores on their own threads), the run loop reads the rows between the steps of the cores.
+ */
+typedef struct {
+    uint32_t (*tags)[MAX_SHARERS];   // a row per block slot of the caches, after the struct in its allocation
+    uint8_t (*states)[MAX_SHARERS];  // INVALID in the lanes of the caches that are not attached
+    int num_of_caches;                        // one past the highest id attached
+    int ways;                                 // the ways of the caches (the rows of a set)
+    int set_bits;                             // log2 of the number of sets of the caches
+    int block_bits;                           // log2 of the words of a block of the caches
+    atomic_long invalidations;  // copies invalidated by other caches (sharing statistics)
+} sharer_directory;
+
+/*
+ * Cache - num_blocks blocks in sets of ways blocks: set s holds blocks[s * ways] to blocks[s * ways + ways - 1].
+ * One way is the direct-mapped cache, a new block replaces an invalid way of its set first, then the least recently used one.
+ * The blocks and their words live in the storage the cache is initialized with (cache_storage_size of its geometry).
+ */
 typedef struct {
-    cache_block blocks[NUM_BLOCKS]; 
+    cache_block* blocks;         // num_blocks blocks
+    int* words;                  // block_size words per block, the data of blocks[i] starts at i * block_size
+    int num_blocks;              // size / block_size of the geometry
+    int ways;                    // the blocks of a set (a power of 2 up to MAX_CACHE_WAYS)
+    int set_bits;                // log2 of the number of sets
+    int block_bits;              // log2 of the words of a block
+    sharer_directory* directory; // NULL if the cache is not tracked
+    int id;                      // the lane of the cache in the directory rows (its bit in the sharer vectors)
 } Cache;
 
 /*******************************************************/
 /**************** cashe functions **********************/
 /*******************************************************/
 
-// Extracts the index from an address
-uint32_t get_index(uint32_t address);
+// Sets the default geometry (CACHE_SIZE words, CACHE_BLOCK_SIZE words a block, direct-mapped)
+void set_default_geometry(cache_geometry *geometry);
+
+// Returns true if a cache can have the geometry, otherwise prints what is wrong with it and returns false
+bool valid_cache_geometry(const cache_geometry *geometry);
+
+// Extracts the set of the address in the cache
+uint32_t cache_set(const Cache *cache, uint32_t address);
 
+// Extracts the tag of the address in the cache (the address bits above the set)
+uint32_t cache_tag(const Cache *cache, uint32_t address);
 
-// Extracts the tag from an address
-uint32_t get_tag(uint32_t address);
+// Returns the address of the first word of a block of the cache (from its tag and its set)
+uint32_t cache_block_address(const Cache *cache, const cache_block *block);
 
+// Returns the words of a block of the cache
+int cache_block_size(const Cache *cache);
 
-uint32_t get_cache_index(uint32_t address);
+// Returns the offset of the address in its block of the cache
+uint32_t cache_block_offset(const Cache *cache, uint32_t address);
+
+// Returns the bits of the tags of the cache (ADDRESS_BITS less the set and the offset bits, 12 by default)
+int cache_tag_bits(const Cache *cache);
+
+// Returns the bytes of the storage of a cache of the geometry (its blocks and their words)
+size_t cache_storage_size(const cache_geometry *geometry);
 
 /* 
 * The function initializes the cache with:
 * each tag iniital as 0
 * each state iniital as "invalid"
 * each data iniital as 0 
+* and the blocks and the sets of the geometry (valid_cache_geometry), in the storage (cache_storage_size bytes)
 */
-void cache_initialization(Cache *cache);
+void cache_initialization(Cache *cache, const cache_geometry *geometry, void *storage);
 
 
 /*
@@ -70,18 +136,32 @@ void cache_initialization(Cache *cache);
 bool search_block(Cache *cache, uint32_t address);
 
 
-// return pointer to copy of the cache block
+/*
+ * return pointer to the cache block of the address. If the address misses, it is the block
+ * a new block of the address replaces (insert_block): an invalid way of the set, else the least recently used.
+ */
 cache_block* get_cache_block(Cache *cache, uint32_t address);
 
 
+// Records an access to the block in the cycle (the LRU order)
+void use_block(cache_block *block, int cycle);
+
+
 /*
  * The function inserts a block into the cache.
- * If a block exists at the target index, it will be overwritten.
+ * The block of get_cache_block is overwritten (its words are copied from the new block), the new block counts as used in the cycle.
  * Returns true on success and false in case of a failure.
  */
 bool insert_block(Cache *cache, uint32_t address, cache_block *new_block, int cycle);
 
 
+/*
+ * Sets the MESI state of a block of the cache and keeps the directory up to date.
+ * Every state change of a block that is in a cache must go through here (or insert_block).
+ */
+void set_block_state(Cache *cache, cache_block *block, MESI_state new_state);
+
+
 /*
  * The function updates the MESI state of a block in the cache if it exists.
  * If the block is found, updates its state and true, if not found, returns false.
@@ -91,6 +171,27 @@ bool update_state(Cache *cache, uint32_t address, MESI_state new_state);
 
 void free_cache(Cache* cache);
 
+/*******************************************************/
+/*************** Sharer directory **********************/
+/*******************************************************/
+
+// Creates an empty directory for caches of the geometry (no cache holds any block)
+sharer_directory* create_directory(const cache_geometry *geometry);
+
+// Tracks the cache in the directory under the id (the cache must be empty and have the geometry of the directory)
+void attach_directory(Cache *cache, sharer_directory *directory, int id);
+
+// Returns the bit-vector of the caches that hold a valid copy of the block of the address
+uint64_t directory_sharers(sharer_directory *directory, uint32_t address);
+
+// Returns the bit-vector of the caches that hold the block of the address MODIFIED
+uint64_t directory_owners(sharer_directory *directory, uint32_t address);
+
+// Counts an invalidation of a copy by another cache
+void directory_count_invalidation(sharer_directory *directory);
+
+void free_directory(sharer_directory* directory);
+
 /*******************************************************/
 /*************** Debugging functions *******************/
 /*******************************************************/
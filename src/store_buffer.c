@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "sram.h"
+#include "store_buffer.h"
+
+#define ADDRESS_MASK ((1u << ADDRESS_BITS) - 1)
+
+
+/*******************************************************/
+/**************** Store buffer functions ***************/
+/*******************************************************/
+
+// Empties the buffer and sets the stores it takes
+void init_store_buffer(store_buffer* buffer, int size)
+{
+    buffer->head = 0;
+    buffer->count = 0;
+    buffer->size = size;
+}
+
+// True if no store waits in the buffer
+bool store_buffer_empty(const store_buffer* buffer)
+{
+    return buffer->count == 0;
+}
+
+// True if a new store has to wait for the oldest one to drain
+bool store_buffer_full(const store_buffer* buffer)
+{
+    return buffer->count >= buffer->size;
+}
+
+// Adds the store after the youngest one (the buffer is not full)
+void push_store(store_buffer* buffer, uint32_t address, int value)
+{
+    buffered_store* store = &buffer->entries[(buffer->head + buffer->count) % MAX_STORE_BUFFER];
+    store->address = address;
+    store->value = value;
+    buffer->count++;
+}
+
+// Returns the oldest store (the buffer is not empty)
+const buffered_store* oldest_store(const store_buffer* buffer)
+{
+    return &buffer->entries[buffer->head];
+}
+
+// Removes the oldest store (it reached the cache or the memory)
+void pop_store(store_buffer* buffer)
+{
+    buffer->head = (buffer->head + 1) % MAX_STORE_BUFFER;
+    buffer->count--;
+}
+
+// Returns the youngest store to the word of the address (NULL: the buffer has none)
+const buffered_store* find_store(const store_buffer* buffer, uint32_t address)
+{
+    for (int i = buffer->count - 1; i >= 0; i--) {
+        const buffered_store* store = &buffer->entries[(buffer->head + i) % MAX_STORE_BUFFER];
+        if (((store->address ^ address) & ADDRESS_MASK) == 0) {
+            return store;
+        }
+    }
+    return NULL;
+}
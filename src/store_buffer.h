@@ -0,0 +1,62 @@
+#ifndef STORE_BUFFER_H
+#define STORE_BUFFER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MAX_STORE_BUFFER 64  // the most entries a store buffer can have
+
+
+/*******************************************************/
+/********************  Structs *************************/
+/*******************************************************/
+
+// A store that retired from the MEM phase before it reached the cache
+typedef struct {
+    uint32_t address;
+    int value;
+} buffered_store;
+
+/*
+ * The store buffer of a core (the store_buffer entries of its latency_config, none by default).
+ * A sw that misses the cache, or that finds older stores still in the buffer, retires into it
+ * and the core drains the oldest store in the background (see pipeline_step): a hit writes the cache,
+ * a miss takes the bus like a sw. A lw of a buffered word gets the youngest store to it,
+ * a fence (and the halt) waits in MEM until the buffer is empty.
+ * The entries are a ring of MAX_STORE_BUFFER, so a new size keeps the stores in order.
+ */
+typedef struct {
+    buffered_store entries[MAX_STORE_BUFFER];
+    int head;      // the oldest store
+    int count;
+    int size;      // the stores the buffer takes (count can stay above it after the size shrinks)
+} store_buffer;
+
+
+/*******************************************************/
+/**************** Store buffer functions ***************/
+/*******************************************************/
+
+// Empties the buffer and sets the stores it takes
+void init_store_buffer(store_buffer* buffer, int size);
+
+// True if no store waits in the buffer
+bool store_buffer_empty(const store_buffer* buffer);
+
+// True if a new store has to wait for the oldest one to drain
+bool store_buffer_full(const store_buffer* buffer);
+
+// Adds the store after the youngest one (the buffer is not full)
+void push_store(store_buffer* buffer, uint32_t address, int value);
+
+// Returns the oldest store (the buffer is not empty)
+const buffered_store* oldest_store(const store_buffer* buffer);
+
+// Removes the oldest store (it reached the cache or the memory)
+void pop_store(store_buffer* buffer);
+
+// Returns the youngest store to the word of the address (NULL: the buffer has none)
+const buffered_store* find_store(const store_buffer* buffer, uint32_t address);
+
+
+#endif // STORE_BUFFER_H
@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "core.h"
+#include "memory.h"
+#include "processor.h"
+#include "sweep.h"
+#include "config.h"
+#include "alloc.h"
+
+#define SWEEP_LINE_SIZE 65536
+#define SWEEP_MAX_SETTINGS 8                    // key=value settings of a line (one per key of a config file)
+#define SWEEP_MAX_FIELDS (MAX_NUM_OF_CORES + 5 + SWEEP_MAX_SETTINGS) // imem files, memin, outdir, 3 latencies and the settings
+
+
+/*******************************************************/
+/********************  Structs *************************/
+/*******************************************************/
+
+// A memin file parsed once for all the simulations that use it
+typedef struct memin_image {
+    char* filename;
+    main_memory* memory;
+    struct memin_image* next;
+} memin_image;
+
+// One simulation of the sweep
+typedef struct {
+    int line_number;
+    int num_of_cores;
+    char* imem[MAX_NUM_OF_CORES];
+    char* memin_filename;
+    char* outdir;
+    latency_config latency;
+    const main_memory* memin;
+    int cycles;                  // the result of the run (-1 if it failed)
+} sweep_config;
+
+// The shared state of the thread pool
+typedef struct {
+    sweep_config* configs;
+    int num_of_configs;
+    atomic_int next;             // the next config a thread takes
+    engine_type engine;
+} sweep_pool;
+
+/*******************************************************/
+/****************** Sweep Functions ********************/
+/*******************************************************/
+
+// Returns a heap copy of the string
+static char* copy_string(const char* str)
+{
+    char* copy = sim_malloc(strlen(str) + 1);
+    if (!copy) {
+        perror("Failed to allocate memory for the sweep list");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(copy, str);
+    return copy;
+}
+
+// True if the file can be opened for reading
+static bool file_is_readable(const char* filename)
+{
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        return false;
+    }
+    fclose(file);
+    return true;
+}
+
+// Returns the parsed memin file, parses it only the first time it is asked for
+static const main_memory* get_memin_image(memin_image** images, char* filename)
+{
+    for (memin_image* image = *images; image; image = image->next) {
+        if (strcmp(image->filename, filename) == 0) {
+            return image->memory;
+        }
+    }
+    main_memory* memory = init_main_memory(filename);
+    if (!memory) {
+        return NULL;
+    }
+    memin_image* image = sim_malloc(sizeof(memin_image));
+    if (!image) {
+        perror("Failed to allocate memory for the sweep list");
+        exit(EXIT_FAILURE);
+    }
+    image->filename = filename;
+    image->memory = memory;
+    image->next = *images;
+    *images = image;
+    return memory;
+}
+
+// Parses a latency of a sweep line, false if it is not a whole number >= min
+static bool parse_delay(const char* value, int min, int* delay)
+{
+    char* end;
+    long number = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || number < min || number > INT_MAX) {
+        return false;
+    }
+    *delay = (int)number;
+    return true;
+}
+
+/*
+ * Parses one line of the sweep list into the config, its latencies and settings start from the base ones.
+ * Returns 1 for a config, 0 for a blank or comment line and -1 for a bad line.
+ */
+static int parse_sweep_line(char* line, int line_number, int num_of_cores, const latency_config* base, sweep_config* config)
+{
+    char* fields[SWEEP_MAX_FIELDS + 1];
+    char* rest = NULL;
+    int count = 0;
+    for (char* field = strtok_r(line, " \t\r\n", &rest); field && count <= SWEEP_MAX_FIELDS; field = strtok_r(NULL, " \t\r\n", &rest)) {
+        fields[count++] = field;
+    }
+    if (count == 0 || fields[0][0] == '#') {
+        return 0;
+    }
+    // the key=value settings end the line
+    int settings = 0;
+    while (settings < count && strchr(fields[count - 1 - settings], '=')) {
+        settings++;
+    }
+    count -= settings;
+    int n = num_of_cores;
+    if (count != n + 2 && count != n + 5) {
+        printf("Error: sweep line %d needs %d or %d fields, got %d\n", line_number, n + 2, n + 5, count);
+        return -1;
+    }
+    memset(config, 0, sizeof(sweep_config));
+    config->line_number = line_number;
+    config->num_of_cores = n;
+    config->latency = *base;
+    if (count == n + 5 && !(parse_delay(fields[n + 2], 2, &config->latency.bus_delay) &&
+                            parse_delay(fields[n + 3], 1, &config->latency.block_delay) &&
+                            parse_delay(fields[n + 4], 1, &config->latency.extra_delay))) {
+        printf("Error: sweep line %d has bad latencies %s %s %s (bus_delay >= 2, block_delay >= 1, extra_delay >= 1)\n",
+               line_number, fields[n + 2], fields[n + 3], fields[n + 4]);
+        return -1;
+    }
+    for (int i = count; i < count + settings; i++) {
+        if (!set_config_setting(&config->latency, fields[i])) {
+            printf("Error: sweep line %d has a bad setting %s (see config.h)\n", line_number, fields[i]);
+            return -1;
+        }
+    }
+    if (!valid_config(&config->latency)) {
+        printf("Error: sweep line %d has a bad configuration\n", line_number);
+        return -1;
+    }
+    // the file names are copied once the line is good, a bad line leaves nothing to free
+    for (int i = 0; i < n; i++) {
+        config->imem[i] = copy_string(fields[i]);
+    }
+    config->memin_filename = copy_string(fields[n]);
+    config->outdir = copy_string(fields[n + 1]);
+    return 1;
+}
+
+// Frees the file names of the configs and the array
+static void free_sweep_configs(sweep_config* configs, int num_of_configs)
+{
+    for (int i = 0; i < num_of_configs; i++) {
+        for (int j = 0; j < configs[i].num_of_cores; j++) {
+            free(configs[i].imem[j]);
+        }
+        free(configs[i].memin_filename);
+        free(configs[i].outdir);
+    }
+    free(configs);
+}
+
+// Reads the sweep list file, returns the configs and sets their number (NULL on error)
+static sweep_config* read_sweep_list(char* list_filename, int num_of_cores, const latency_config* base, int* num_of_configs)
+{
+    FILE* file = fopen(list_filename, "r");
+    if (!file) {
+        perror("Error opening the sweep list");
+        return NULL;
+    }
+    int capacity = 4;
+    sweep_config* configs = sim_malloc(capacity * sizeof(sweep_config));
+    if (!configs) {
+        perror("Failed to allocate memory for the sweep list");
+        exit(EXIT_FAILURE);
+    }
+    *num_of_configs = 0;
+    char line[SWEEP_LINE_SIZE];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        if (*num_of_configs == capacity) {
+            capacity *= 2;
+            configs = sim_realloc(configs, capacity * sizeof(sweep_config));
+            if (!configs) {
+                perror("Failed to allocate memory for the sweep list");
+                exit(EXIT_FAILURE);
+            }
+        }
+        int result = parse_sweep_line(line, line_number, num_of_cores, base, &configs[*num_of_configs]);
+        if (result < 0) {
+            fclose(file);
+            free_sweep_configs(configs, *num_of_configs);
+            return NULL;
+        }
+        *num_of_configs += result;
+    }
+    fclose(file);
+    return configs;
+}
+
+// Returns the file names of the simulation (freed by free_processor)
+static filenames* sweep_file_names(sweep_config* config)
+{
+    filenames* names = sim_malloc(sizeof(filenames));
+    if (!names) {
+        perror("Failed to allocate memory for filenames");
+        exit(EXIT_FAILURE);
+    }
+    set_default_file_names(names, config->num_of_cores);
+    for (int i = 0; i < config->num_of_cores; i++) {
+        free(names->imem_str[i]);
+        names->imem_str[i] = copy_string(config->imem[i]);
+    }
+    free(names->memin_str);
+    names->memin_str = copy_string(config->memin_filename);
+    set_output_file_names(names, config->outdir);
+    return names;
+}
+
+// The loop of a pool thread, takes the next config until none are left
+static void* sweep_worker_loop(void* arg)
+{
+    sweep_pool* pool = (sweep_pool*)arg;
+    while (true) {
+        int index = atomic_fetch_add(&pool->next, 1);
+        if (index >= pool->num_of_configs) {
+            break;
+        }
+        sweep_config* config = &pool->configs[index];
+        if (!config->memin) {
+            config->cycles = -1;
+            continue;
+        }
+        processor* cpu = init_processor(sweep_file_names(config), &config->latency);
+        cpu->engine = pool->engine;
+        cpu->debug = false;
+        main_memory* memory = copy_main_memory(config->memin);
+        config->cycles = run(cpu, memory);
+        free_main_memory(memory);
+    }
+    return NULL;
+}
+
+/*
+ * Runs every simulation of the sweep list file on a pool of host threads.
+ * Prints one summary line per simulation and returns the number of failed simulations.
+ */
+int run_sweep(char* list_filename, int threads, int num_of_cores, engine_type engine, const latency_config* latency)
+{
+    int num_of_configs = 0;
+    sweep_config* configs = read_sweep_list(list_filename, num_of_cores, latency, &num_of_configs);
+    if (!configs) {
+        return -1;
+    }
+    // check the inputs and parse each memin file once before the threads start
+    memin_image* images = NULL;
+    for (int i = 0; i < num_of_configs; i++) {
+        bool readable = true;
+        for (int j = 0; j < num_of_cores; j++) {
+            if (!file_is_readable(configs[i].imem[j])) {
+                printf("Error: sweep line %d: cannot read %s\n", configs[i].line_number, configs[i].imem[j]);
+                readable = false;
+            }
+        }
+        if (!engine_runs_config(engine, &configs[i].latency)) {
+            printf("Error: sweep line %d: the parallel engine runs without a store buffer (store_buffer 0)\n", configs[i].line_number);
+            readable = false;
+        }
+        configs[i].memin = readable ? get_memin_image(&images, configs[i].memin_filename) : NULL;
+    }
+
+    if (threads <= 0) {
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads > num_of_configs) {
+        threads = num_of_configs;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    sweep_pool pool;
+    pool.configs = configs;
+    pool.num_of_configs = num_of_configs;
+    pool.engine = engine;
+    atomic_init(&pool.next, 0);
+    pthread_t* pool_threads = sim_malloc(threads * sizeof(pthread_t));
+    if (!pool_threads) {
+        perror("Failed to allocate memory for the sweep threads");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&pool_threads[i], NULL, sweep_worker_loop, &pool) != 0) {
+            perror("Failed to create a sweep thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(pool_threads[i], NULL);
+    }
+    free(pool_threads);
+
+    // print the summary in the order of the list
+    int failed = 0;
+    printf("line  bus_delay  block_delay  extra_delay  cycles  outdir\n");
+    for (int i = 0; i < num_of_configs; i++) {
+        sweep_config* config = &configs[i];
+        if (config->cycles < 0) {
+            printf("%-4d  %9d  %11d  %11d  %6s  %s\n", config->line_number, config->latency.bus_delay,
+                   config->latency.block_delay, config->latency.extra_delay, "failed", config->outdir);
+            failed++;
+        }
+        else {
+            printf("%-4d  %9d  %11d  %11d  %6d  %s\n", config->line_number, config->latency.bus_delay,
+                   config->latency.block_delay, config->latency.extra_delay, config->cycles, config->outdir);
+        }
+    }
+    while (images) {
+        memin_image* next = images->next;
+        free_main_memory(images->memory);
+        free(images);
+        images = next;
+    }
+    free_sweep_configs(configs, num_of_configs);
+    return failed;
+}
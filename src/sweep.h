@@ -0,0 +1,26 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "processor.h"
+
+
+/*******************************************************/
+/****************** Parameter sweeps *******************/
+/*******************************************************/
+
+/*
+ * Runs every simulation of the sweep list file on a pool of host threads.
+ * Each line of the list is one simulation:
+ *     imem0 ... imem<num_of_cores-1> memin outdir [bus_delay block_delay extra_delay] [key=value ...]
+ * Each simulation starts from the latency config of the run, the three latencies and the key=value
+ * settings (the keys of a config file, see config.h) change it, so a line can also change the caches.
+ * Blank lines and lines that start with '#' are skipped.
+ * The outputs of a simulation get their default names inside outdir (the directory must exist).
+ * A memin file is parsed once and every simulation that uses it starts from a copy.
+ * threads <= 0 means one thread per online host core.
+ * Prints one summary line per simulation and returns the number of failed simulations.
+ */
+int run_sweep(char* list_filename, int threads, int num_of_cores, engine_type engine, const latency_config* latency);
+
+
+#endif // SWEEP_H
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include "trace.h"
+#include "alloc.h"
+
+
+/*******************************************************/
+/****************** Byte encoding **********************/
+/*******************************************************/
+
+static void put_u16(uint8_t* buffer, uint16_t value)
+{
+    buffer[0] = (uint8_t)value;
+    buffer[1] = (uint8_t)(value >> 8);
+}
+
+static void put_u32(uint8_t* buffer, uint32_t value)
+{
+    buffer[0] = (uint8_t)value;
+    buffer[1] = (uint8_t)(value >> 8);
+    buffer[2] = (uint8_t)(value >> 16);
+    buffer[3] = (uint8_t)(value >> 24);
+}
+
+
+/*******************************************************/
+/****************** Trace functions ********************/
+/*******************************************************/
+
+// Opens an existing trace file and cuts it at the offset, the next write goes there
+static FILE* continue_trace_file(const char* filename, long offset)
+{
+    FILE* file = fopen(filename, "r+b");
+    if (!file || fseek(file, 0, SEEK_END) != 0 || ftell(file) < offset) {
+        printf("Error: %s is missing or shorter than its checkpoint offset %ld\n", filename, offset);
+        exit(EXIT_FAILURE);
+    }
+    fflush(file);
+    if (ftruncate(fileno(file), offset) != 0 || fseek(file, offset, SEEK_SET) != 0) {
+        printf("Error: cannot continue %s at offset %ld\n", filename, offset);
+        exit(EXIT_FAILURE);
+    }
+    return file;
+}
+
+// Returns the name of the binary trace file (a heap copy of the name with TRACE_BINARY_SUFFIX)
+static char* binary_trace_name(const char* filename)
+{
+    char* name = sim_malloc(strlen(filename) + sizeof(TRACE_BINARY_SUFFIX));
+    if (!name) {
+        perror("Failed to allocate memory for the trace file name");
+        exit(EXIT_FAILURE);
+    }
+    return strcat(strcpy(name, filename), TRACE_BINARY_SUFFIX);
+}
+
+// Opens a trace file for writing (binary mode: the name gets TRACE_BINARY_SUFFIX and a new file gets the header)
+FILE* open_trace_file(const char* filename, trace_format format, trace_kind kind, long offset)
+{
+    char* name = (format == TRACE_BINARY) ? binary_trace_name(filename) : NULL;
+    FILE* file;
+    if (offset != TRACE_NEW_FILE) {
+        file = continue_trace_file(name ? name : filename, offset);
+    }
+    else {
+        file = fopen(name ? name : filename, name ? "wb" : "w");
+        if (!file) {
+            printf("Error opening file: %s\n", name ? name : filename);
+            exit(EXIT_FAILURE);
+        }
+        if (name) {
+            uint8_t header[TRACE_MAGIC_SIZE + 2];
+            memcpy(header, TRACE_MAGIC, TRACE_MAGIC_SIZE);
+            header[TRACE_MAGIC_SIZE] = TRACE_VERSION;
+            header[TRACE_MAGIC_SIZE + 1] = (uint8_t)kind;
+            fwrite(header, 1, sizeof(header), file);
+        }
+    }
+    free(name);
+    return file;
+}
+
+// Copies the trace file written so far to a new file (in binary mode both names get TRACE_BINARY_SUFFIX)
+void copy_trace_file(const char* source, const char* destination, trace_format format)
+{
+    char* source_name = (format == TRACE_BINARY) ? binary_trace_name(source) : NULL;
+    char* destination_name = (format == TRACE_BINARY) ? binary_trace_name(destination) : NULL;
+    FILE* from = fopen(source_name ? source_name : source, "rb");
+    FILE* to = fopen(destination_name ? destination_name : destination, "wb");
+    if (!from || !to) {
+        printf("Error: cannot copy %s to %s\n", source_name ? source_name : source, destination_name ? destination_name : destination);
+        exit(EXIT_FAILURE);
+    }
+    char buffer[TRACE_COPY_BUFFER_SIZE];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), from)) > 0) {
+        fwrite(buffer, 1, length, to);
+    }
+    fclose(from);
+    fclose(to);
+    free(source_name);
+    free(destination_name);
+}
+
+// Sets the filter to write every line of every trace
+void init_trace_filter(trace_filter* filter)
+{
+    memset(filter, 0, sizeof(trace_filter));
+    filter->first_cycle = 0;
+    filter->last_cycle = INT_MAX;
+    filter->cores = ~(uint64_t)0;
+    filter->bus_commands = ~0u;
+    filter->num_of_ranges = 0;
+}
+
+// True if the coretrace of the core is written (in the cycle window of the filter)
+bool core_is_traced(const trace_filter* filter, int core_num)
+{
+    return core_num < 64 && (filter->cores >> core_num) & 1;
+}
+
+// True if a bus line of the cycle, command and address is written
+bool bus_line_is_traced(const trace_filter* filter, int cycle, int cmd, uint32_t addr)
+{
+    if (cycle < filter->first_cycle || cycle > filter->last_cycle || !((filter->bus_commands >> cmd) & 1)) {
+        return false;
+    }
+    if (filter->num_of_ranges == 0) {
+        return true;
+    }
+    for (int i = 0; i < filter->num_of_ranges; i++) {
+        if (addr >= filter->ranges[i].first && addr <= filter->ranges[i].last) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Resets the previous line of a binary core trace (every register is 0)
+void init_core_trace_state(core_trace_state* state)
+{
+    memset(state->last_registers, 0, sizeof(state->last_registers));
+}
+
+// Encodes a core trace line into the buffer as a LINE record, returns its size
+int encode_core_line(core_trace_state* state, const core_trace_line* line, uint8_t* buffer)
+{
+    buffer[0] = CORE_RECORD_LINE;
+    put_u32(buffer + 1, (uint32_t)line->cycle);
+    for (int i = 0; i < NUM_OF_TRACE_STAGES; i++) {
+        put_u16(buffer + 5 + 2 * i, (uint16_t)line->pcs[i]);
+    }
+    uint16_t mask = 0;
+    int size = CORE_LINE_HEADER_SIZE;
+    for (int i = 0; i < NUM_OF_TRACE_REGISTERS; i++) {
+        if (line->registers[i] != state->last_registers[i]) {
+            mask |= (uint16_t)(1 << i);
+            put_u32(buffer + size, (uint32_t)line->registers[i]);
+            size += 4;
+            state->last_registers[i] = line->registers[i];
+        }
+    }
+    put_u16(buffer + CORE_LINE_HEADER_SIZE - 2, mask);
+    return size;
+}
+
+// Encodes a REPEAT record into the buffer, returns its size
+int encode_core_repeat(int cycle, int count, uint8_t* buffer)
+{
+    buffer[0] = CORE_RECORD_REPEAT;
+    put_u32(buffer + 1, (uint32_t)cycle);
+    put_u32(buffer + 5, (uint32_t)count);
+    return CORE_REPEAT_SIZE;
+}
+
+// Encodes a bus trace line into the buffer, returns its size (BUS_RECORD_SIZE)
+int encode_bus_line(const bus_trace_line* line, uint8_t* buffer)
+{
+    put_u32(buffer, (uint32_t)line->cycle);
+    buffer[4] = line->orig_id;
+    buffer[5] = line->cmd;
+    put_u32(buffer + 6, line->addr);
+    put_u32(buffer + 10, line->data);
+    buffer[14] = line->shared;
+    return BUS_RECORD_SIZE;
+}
+
+// Writes the text form of a core trace line (the format of coretrace.txt) into text, returns its length
+int format_core_line(const core_trace_line* line, char* text)
+{
+    int length = sprintf(text, "%d ", line->cycle);
+    for (int i = 0; i < NUM_OF_TRACE_STAGES; i++) {
+        if (line->pcs[i] != -1) { length += sprintf(text + length, "%03X ", line->pcs[i]); }
+        else { length += sprintf(text + length, "--- "); }
+    }
+    for (int i = 0; i < NUM_OF_TRACE_REGISTERS; i++) {
+        length += sprintf(text + length, "%08X ", line->registers[i]);
+    }
+    length += sprintf(text + length, "\n");
+    return length;
+}
+
+// Writes the text form of a bus trace line (the format of bustrace.txt) into text, returns its length
+int format_bus_line(const bus_trace_line* line, char* text)
+{
+    return sprintf(text, "%d %d %d %05X %08X %d\n", line->cycle, line->orig_id, line->cmd, line->addr, line->data, line->shared);
+}
@@ -0,0 +1,138 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/*******************************************************/
+/****************** Trace file format ******************/
+/*******************************************************/
+
+/*
+ * The binary trace format (all numbers little endian):
+ * - Header: the 8 bytes "SIMTRACE", a version byte and a kind byte (core or bus trace).
+ * - Core trace records, a kind byte first:
+ *     LINE:   cycle (4), the pcs of the 5 stages (5 x 2, -1 for "---"), a mask of the registers R2..R15
+ *             that changed since the previous line (2), then the value of each changed register (4 each).
+ *     REPEAT: cycle (4), count (4) - the previous line repeats for count cycles starting at cycle.
+ * - Bus trace records (fixed 15 bytes): cycle (4), orig_id (1), cmd (1), addr (4), data (4), shared (1).
+ * trace_decode rebuilds the text traces byte for byte.
+ */
+
+#define TRACE_MAGIC "SIMTRACE"
+#define TRACE_MAGIC_SIZE 8
+#define TRACE_VERSION 1
+#define TRACE_BINARY_SUFFIX ".bin"      // appended to the trace file names in binary mode
+#define TRACE_NEW_FILE (-1L)            // the offset of open_trace_file for a new file
+#define TRACE_COPY_BUFFER_SIZE 65536    // the bytes copy_trace_file moves at a time
+
+#define NUM_OF_TRACE_STAGES 5
+#define NUM_OF_TRACE_REGISTERS 14       // R2..R15
+#define FIRST_TRACE_REGISTER 2
+
+#define CORE_RECORD_LINE 0
+#define CORE_RECORD_REPEAT 1
+#define CORE_LINE_HEADER_SIZE (1 + 4 + 2 * NUM_OF_TRACE_STAGES + 2)
+#define CORE_LINE_MAX_SIZE (CORE_LINE_HEADER_SIZE + 4 * NUM_OF_TRACE_REGISTERS)
+#define CORE_REPEAT_SIZE (1 + 4 + 4)
+#define BUS_RECORD_SIZE 15
+
+#define MAX_TRACE_RANGES 16             // address ranges of a bus trace filter
+
+// The format of the core and bus traces
+typedef enum {
+    TRACE_TEXT,
+    TRACE_BINARY
+} trace_format;
+
+// The kind byte of the header
+typedef enum {
+    CORE_TRACE = 1,
+    BUS_TRACE = 2
+} trace_kind;
+
+// A coretrace line in numbers
+typedef struct {
+    int cycle;
+    int16_t pcs[NUM_OF_TRACE_STAGES];                 // -1 for "---"
+    int32_t registers[NUM_OF_TRACE_REGISTERS];        // R2..R15
+} core_trace_line;
+
+// A bustrace line in numbers
+typedef struct {
+    int cycle;
+    uint8_t orig_id;
+    uint8_t cmd;
+    uint32_t addr;
+    uint32_t data;
+    uint8_t shared;
+} bus_trace_line;
+
+// An inclusive range of word addresses
+typedef struct {
+    uint32_t first;
+    uint32_t last;
+} address_range;
+
+// Which lines of the core and bus traces are written (the others cost a compare or two)
+typedef struct {
+    int first_cycle;            // the cycle window of both traces (inclusive)
+    int last_cycle;
+    uint64_t cores;             // bit i: the coretrace of core i is written
+    unsigned bus_commands;      // bit c: the bus lines of command c are written
+    int num_of_ranges;          // the bus lines of these addresses are written (0: every address)
+    address_range ranges[MAX_TRACE_RANGES];
+} trace_filter;
+
+// The writer of a binary core trace keeps the registers of the previous line
+typedef struct {
+    int32_t last_registers[NUM_OF_TRACE_REGISTERS];
+} core_trace_state;
+
+
+/*******************************************************/
+/****************** Trace functions ********************/
+/*******************************************************/
+
+/*
+ * Opens a trace file for writing. In binary mode TRACE_BINARY_SUFFIX is appended to the name.
+ * offset TRACE_NEW_FILE creates the file (and writes the binary header),
+ * any other offset continues an existing file: it is cut at the offset (a restored checkpoint).
+ * Exits on failure like open_file.
+ */
+FILE* open_trace_file(const char* filename, trace_format format, trace_kind kind, long offset);
+
+// Copies the trace file written so far to a new file (in binary mode both names get TRACE_BINARY_SUFFIX)
+void copy_trace_file(const char* source, const char* destination, trace_format format);
+
+// Sets the filter to write every line of every trace
+void init_trace_filter(trace_filter* filter);
+
+// True if the coretrace of the core is written (in the cycle window of the filter)
+bool core_is_traced(const trace_filter* filter, int core_num);
+
+// True if a bus line of the cycle, command and address is written
+bool bus_line_is_traced(const trace_filter* filter, int cycle, int cmd, uint32_t addr);
+
+// Resets the previous line of a binary core trace (every register is 0)
+void init_core_trace_state(core_trace_state* state);
+
+// Encodes a core trace line into the buffer as a LINE record, returns its size
+int encode_core_line(core_trace_state* state, const core_trace_line* line, uint8_t* buffer);
+
+// Encodes a REPEAT record into the buffer, returns its size
+int encode_core_repeat(int cycle, int count, uint8_t* buffer);
+
+// Encodes a bus trace line into the buffer, returns its size (BUS_RECORD_SIZE)
+int encode_bus_line(const bus_trace_line* line, uint8_t* buffer);
+
+// Writes the text form of a core trace line (the format of coretrace.txt) into text, returns its length
+int format_core_line(const core_trace_line* line, char* text);
+
+// Writes the text form of a bus trace line (the format of bustrace.txt) into text, returns its length
+int format_bus_line(const bus_trace_line* line, char* text);
+
+
+#endif // TRACE_H
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+
+/*
+ * trace_decode - rebuilds the text form of a binary core or bus trace, byte for byte.
+ * Usage: trace_decode <binary trace> <text trace>
+ */
+
+
+/*******************************************************/
+/****************** Byte decoding **********************/
+/*******************************************************/
+
+static uint16_t get_u16(const uint8_t* buffer)
+{
+    return (uint16_t)(buffer[0] | (buffer[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t* buffer)
+{
+    return (uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8) | ((uint32_t)buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+}
+
+// Reads exactly size bytes, returns 0 at a clean end of the file and exits on a truncated record
+static int read_record(FILE* in, uint8_t* buffer, size_t size, int allow_end)
+{
+    size_t got = fread(buffer, 1, size, in);
+    if (got == 0 && allow_end) {
+        return 0;
+    }
+    if (got != size) {
+        printf("Error: truncated trace record\n");
+        exit(EXIT_FAILURE);
+    }
+    return 1;
+}
+
+
+/*******************************************************/
+/****************** Trace decoders *********************/
+/*******************************************************/
+
+// Decodes the records of a core trace
+static void decode_core_trace(FILE* in, FILE* out)
+{
+    core_trace_line line;
+    memset(&line, 0, sizeof(line));
+    uint8_t record[CORE_LINE_MAX_SIZE];
+    char text[256];
+    while (read_record(in, record, 1, 1)) {
+        if (record[0] == CORE_RECORD_LINE) {
+            read_record(in, record + 1, CORE_LINE_HEADER_SIZE - 1, 0);
+            line.cycle = (int)get_u32(record + 1);
+            for (int i = 0; i < NUM_OF_TRACE_STAGES; i++) {
+                line.pcs[i] = (int16_t)get_u16(record + 5 + 2 * i);
+            }
+            uint16_t mask = get_u16(record + CORE_LINE_HEADER_SIZE - 2);
+            for (int i = 0; i < NUM_OF_TRACE_REGISTERS; i++) {
+                if (mask & (1 << i)) {
+                    read_record(in, record, 4, 0);
+                    line.registers[i] = (int32_t)get_u32(record);
+                }
+            }
+            format_core_line(&line, text);
+            fputs(text, out);
+        }
+        else if (record[0] == CORE_RECORD_REPEAT) {
+            read_record(in, record + 1, CORE_REPEAT_SIZE - 1, 0);
+            int cycle = (int)get_u32(record + 1);
+            int count = (int)get_u32(record + 5);
+            for (int i = 0; i < count; i++) {
+                line.cycle = cycle + i;
+                format_core_line(&line, text);
+                fputs(text, out);
+            }
+        }
+        else {
+            printf("Error: unknown core trace record %d\n", record[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Decodes the records of a bus trace
+static void decode_bus_trace(FILE* in, FILE* out)
+{
+    uint8_t record[BUS_RECORD_SIZE];
+    char text[128];
+    while (read_record(in, record, BUS_RECORD_SIZE, 1)) {
+        bus_trace_line line;
+        line.cycle = (int)get_u32(record);
+        line.orig_id = record[4];
+        line.cmd = record[5];
+        line.addr = get_u32(record + 6);
+        line.data = get_u32(record + 10);
+        line.shared = record[14];
+        format_bus_line(&line, text);
+        fputs(text, out);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 3) {
+        printf("Usage: %s <binary trace> <text trace>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    FILE* in = fopen(argv[1], "rb");
+    if (!in) {
+        printf("Error opening file: %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    uint8_t header[TRACE_MAGIC_SIZE + 2];
+    if (fread(header, 1, sizeof(header), in) != sizeof(header) || memcmp(header, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0) {
+        printf("Error: %s is not a binary trace\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    if (header[TRACE_MAGIC_SIZE] != TRACE_VERSION) {
+        printf("Error: %s has trace version %d (expected %d)\n", argv[1], header[TRACE_MAGIC_SIZE], TRACE_VERSION);
+        return EXIT_FAILURE;
+    }
+    FILE* out = fopen(argv[2], "w");
+    if (!out) {
+        printf("Error opening file: %s\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    if (header[TRACE_MAGIC_SIZE + 1] == CORE_TRACE) {
+        decode_core_trace(in, out);
+    }
+    else if (header[TRACE_MAGIC_SIZE + 1] == BUS_TRACE) {
+        decode_bus_trace(in, out);
+    }
+    else {
+        printf("Error: %s has an unknown trace kind\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    fclose(in);
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "trace.h"
+#include "trace_writer.h"
+#include "alloc.h"
+
+#define SPINS_BEFORE_YIELD 100
+#define YIELDS_BEFORE_SLEEP 1000
+#define IDLE_SLEEP_NS 50000 // the writer sleeps this long when the rings stay empty
+
+
+/*******************************************************/
+/****************** Writer Functions *******************/
+/*******************************************************/
+
+// Busy waits for a short while, then gives the host core to other threads, then sleeps
+static void relax(int* spins)
+{
+    (*spins)++;
+    if (*spins > SPINS_BEFORE_YIELD + YIELDS_BEFORE_SLEEP) {
+        struct timespec pause = { 0, IDLE_SLEEP_NS };
+        nanosleep(&pause, NULL);
+    }
+    else if (*spins > SPINS_BEFORE_YIELD) {
+        sched_yield();
+    }
+}
+
+// Writes the collected bytes of the ring to its file
+static void flush_batch(trace_ring* ring)
+{
+    if (ring->batch_length > 0) {
+        fwrite(ring->batch, 1, ring->batch_length, ring->file);
+        ring->batch_length = 0;
+    }
+}
+
+// Returns room for one more line in the batch, writes the batch to the file first if it is full
+static char* batch_room(trace_ring* ring)
+{
+    if (ring->batch_length + TRACE_MAX_LINE_SIZE > TRACE_BATCH_SIZE) {
+        flush_batch(ring);
+    }
+    return ring->batch + ring->batch_length;
+}
+
+// Formats one record into the batch of the ring
+static void write_record(trace_ring* ring, const trace_record* record)
+{
+    bool binary = ring->format == TRACE_BINARY;
+    switch (record->type) {
+    case RECORD_CORE_LINE:
+        ring->last_line = record->core_line;
+        if (binary) {
+            ring->batch_length += encode_core_line(&ring->state, &record->core_line, (uint8_t*)batch_room(ring));
+        }
+        else {
+            ring->batch_length += format_core_line(&record->core_line, batch_room(ring));
+        }
+        break;
+    case RECORD_CORE_REPEAT:
+        if (binary) {
+            ring->batch_length += encode_core_repeat(record->repeat.cycle, record->repeat.count, (uint8_t*)batch_room(ring));
+        }
+        else {
+            for (int i = 0; i < record->repeat.count; i++) {
+                ring->last_line.cycle = record->repeat.cycle + i;
+                ring->batch_length += format_core_line(&ring->last_line, batch_room(ring));
+            }
+        }
+        break;
+    case RECORD_BUS_LINE:
+        if (binary) {
+            ring->batch_length += encode_bus_line(&record->bus_line, (uint8_t*)batch_room(ring));
+        }
+        else {
+            ring->batch_length += format_bus_line(&record->bus_line, batch_room(ring));
+        }
+        break;
+    }
+}
+
+// Formats the records waiting in the ring, returns their number
+static int drain_ring(trace_ring* ring)
+{
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    int count = 0;
+    while (tail != head) {
+        write_record(ring, &ring->records[tail & (TRACE_RING_SIZE - 1)]);
+        tail++;
+        count++;
+        // give the room back to the producer as soon as possible
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+    return count;
+}
+
+// The loop of the writer thread, drains the rings until it is stopped and they are empty
+static void* trace_writer_loop(void* arg)
+{
+    trace_writer* writer = (trace_writer*)arg;
+    int spins = 0;
+    while (true) {
+        // read the flag before draining, the records pushed before the stop are drained after it
+        bool stopping = atomic_load(&writer->stop);
+        int count = 0;
+        for (int i = 0; i < writer->num_of_rings; i++) {
+            if (writer->rings[i].file) {
+                count += drain_ring(&writer->rings[i]);
+            }
+        }
+        if (count > 0) {
+            spins = 0;
+        }
+        else if (stopping) {
+            break;
+        }
+        else {
+            relax(&spins);
+        }
+    }
+    return NULL;
+}
+
+// Allocates a writer with the given number of rings (no file attached, the thread is not running yet)
+trace_writer* create_trace_writer(int num_of_rings)
+{
+    trace_writer* writer = sim_malloc(sizeof(trace_writer));
+    if (!writer) {
+        perror("Failed to allocate memory for the trace writer");
+        exit(EXIT_FAILURE);
+    }
+    writer->rings = sim_calloc(num_of_rings, sizeof(trace_ring));
+    if (!writer->rings) {
+        perror("Failed to allocate memory for the trace rings");
+        exit(EXIT_FAILURE);
+    }
+    writer->num_of_rings = num_of_rings;
+    atomic_init(&writer->stop, false);
+    for (int i = 0; i < num_of_rings; i++) {
+        atomic_init(&writer->rings[i].head, 0);
+        atomic_init(&writer->rings[i].tail, 0);
+    }
+    return writer;
+}
+
+// Hands the open trace file over to the given ring and returns the ring
+trace_ring* attach_trace_file(trace_writer* writer, int ring, FILE* file, trace_format format)
+{
+    trace_ring* attached = &writer->rings[ring];
+    attached->file = file;
+    attached->format = format;
+    init_core_trace_state(&attached->state);
+    return attached;
+}
+
+// Continues a core trace that was written before the file was attached (before the thread starts)
+void continue_core_trace(trace_ring* ring, const core_trace_line* last_line, const core_trace_state* state)
+{
+    ring->last_line = *last_line;
+    ring->state = *state;
+}
+
+// Starts the writer thread
+void start_trace_writer(trace_writer* writer)
+{
+    if (pthread_create(&writer->thread, NULL, trace_writer_loop, writer) != 0) {
+        perror("Failed to create the trace writer thread");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Adds a record to the ring, waits while the ring is full
+void push_trace_record(trace_ring* ring, const trace_record* record)
+{
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - ring->cached_tail == TRACE_RING_SIZE) {
+        int spins = 0;
+        while (true) {
+            ring->cached_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+            if (head - ring->cached_tail < TRACE_RING_SIZE) {
+                break;
+            }
+            relax(&spins);
+        }
+    }
+    ring->records[head & (TRACE_RING_SIZE - 1)] = *record;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// Waits until every pushed record is written, closes the files, stops the thread and frees the writer
+void stop_trace_writer(trace_writer* writer)
+{
+    atomic_store(&writer->stop, true);
+    pthread_join(writer->thread, NULL);
+    for (int i = 0; i < writer->num_of_rings; i++) {
+        trace_ring* ring = &writer->rings[i];
+        if (ring->file) {
+            flush_batch(ring);
+            fclose(ring->file);
+        }
+    }
+    free(writer->rings);
+    free(writer);
+}
@@ -0,0 +1,100 @@
+#ifndef TRACE_WRITER_H
+#define TRACE_WRITER_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "trace.h"
+
+#define TRACE_RING_SIZE 1024            // records in a ring (a power of 2)
+#define TRACE_BATCH_SIZE (64 * 1024)    // bytes the writer collects for a file before it writes them
+#define TRACE_MAX_LINE_SIZE 256         // the longest text line or binary record of one trace line
+
+
+/*******************************************************/
+/********************  Structs *************************/
+/*******************************************************/
+
+// The kinds of records a ring carries
+typedef enum {
+    RECORD_CORE_LINE,
+    RECORD_CORE_REPEAT,  // the previous core line repeats for count cycles starting at cycle
+    RECORD_BUS_LINE
+} trace_record_type;
+
+// A raw trace line, formatted by the writer thread
+typedef struct {
+    trace_record_type type;
+    union {
+        core_trace_line core_line;
+        struct {
+            int cycle;
+            int count;
+        } repeat;
+        bus_trace_line bus_line;
+    };
+} trace_record;
+
+/*
+ * A single producer / single consumer ring of the trace records of one file.
+ * The producer (the thread that steps the core, or the main thread for the bus) owns head,
+ * the writer thread owns tail. The records array keeps the two apart in memory.
+ */
+typedef struct {
+    // producer side
+    atomic_uint head;          // the next record the producer writes
+    unsigned cached_tail;      // the last tail the producer saw (saves reading the writer's line)
+    trace_record records[TRACE_RING_SIZE];
+    // writer side
+    atomic_uint tail;          // the next record the writer reads
+    FILE* file;
+    trace_format format;
+    core_trace_state state;    // the registers of the last binary line
+    core_trace_line last_line; // the last core line, for the REPEAT records of a text trace
+    int batch_length;
+    char batch[TRACE_BATCH_SIZE];
+} trace_ring;
+
+// The writer thread and the rings it drains
+typedef struct {
+    pthread_t thread;
+    atomic_bool stop;
+    int num_of_rings;
+    trace_ring* rings;
+} trace_writer;
+
+
+/*******************************************************/
+/**************** Trace writer functions ***************/
+/*******************************************************/
+
+// Allocates a writer with the given number of rings (no file attached, the thread is not running yet)
+trace_writer* create_trace_writer(int num_of_rings);
+
+/*
+ * Hands the open trace file over to the given ring and returns the ring.
+ * From here on the writer owns the file: it writes the records pushed to the ring and closes it.
+ */
+trace_ring* attach_trace_file(trace_writer* writer, int ring, FILE* file, trace_format format);
+
+/*
+ * Continues a core trace that was written before the file was attached (a restored checkpoint):
+ * the line the first REPEAT records repeat and the registers of the last binary line.
+ */
+void continue_core_trace(trace_ring* ring, const core_trace_line* last_line, const core_trace_state* state);
+
+// Starts the writer thread
+void start_trace_writer(trace_writer* writer);
+
+/*
+ * Adds a record to the ring. Waits while the ring is full (back-pressure),
+ * so a producer never gets more than TRACE_RING_SIZE records ahead of the files.
+ */
+void push_trace_record(trace_ring* ring, const trace_record* record);
+
+// Waits until every pushed record is written, closes the files, stops the thread and frees the writer
+void stop_trace_writer(trace_writer* writer);
+
+
+#endif // TRACE_WRITER_H
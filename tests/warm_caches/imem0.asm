@@ -0,0 +1,7 @@
+	add $r2, $zero, $imm, 93	# PC=0
+	sw $r2, $zero, $imm, 0		# PC=1
+	add $r3, $zero, $imm, 40	# PC=2
+	sub $r3, $r3, $imm, 1		# PC=3
+	bne $imm, $r3, $zero, 3		# PC=4
+	add $r4, $r4, $imm, 1		# PC=5
+	halt $zero, $zero, $zero, 0	# PC=6